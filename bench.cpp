@@ -28,11 +28,31 @@
  * POSSIBILITY OF SUCH DAMAGE.
  *
  ******************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <thread>
+#include <vector>
 #include "sqlite3cpp.h"
+#include "sqlite3cpp_collation.h"
+#include "sqlite3cpp_fts5.h"
+#include "sqlite3cpp_io_stats.h"
+#include "sqlite3cpp_maintenance.h"
+#include "sqlite3cpp_pager.h"
+#include "sqlite3cpp_parallel_scan.h"
+#include "sqlite3cpp_pcache.h"
+#include "sqlite3cpp_prefetch.h"
+#include "sqlite3cpp_rtree.h"
+#include "sqlite3cpp_script.h"
+#include "sqlite3cpp_slow_query.h"
+#include "sqlite3cpp_vector.h"
 
 std::function<void()> gen_test_data(int index, int argc, char **argv) {
   if (index + 1 >= argc) throw std::invalid_argument("missing data size (mb)");
@@ -108,6 +128,760 @@ struct scan {
   }
 };
 
+template <typename F>
+void time_it(char const *name, F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  size_t cnt = f();
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << cnt << " rows in " << elapsed.count() << " ms"
+            << std::endl;
+}
+
+std::function<void()> vector_similarity(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing dimensions");
+
+  size_t dims = strtoul(argv[index + 1], 0, 10);
+
+  return [dims]() {
+    using namespace sqlite3cpp;
+    size_t const rows = 20000;
+
+    database db(":memory:");
+    create_vector_functions(db);
+    auto c = db.make_cursor();
+    c.executescript("create table E (id integer primary key, v blob)");
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(-1, 1);
+    auto random_vector = [&] {
+      std::string v(dims * sizeof(float), '\0');
+      for (size_t i = 0; i < dims; ++i) {
+        float x = dist(gen);
+        std::memcpy(&v[i * sizeof(float)], &x, sizeof(x));
+      }
+      return v;
+    };
+
+    {
+      transaction trns(db);
+      for (size_t i = 0; i < rows; ++i) {
+        c.execute("insert into E(v) values(cast(? as blob))", random_vector());
+      }
+      trns.commit();
+    }
+    std::string const query = random_vector();
+
+    time_it("naive loop", [&] {
+      auto c = db.make_cursor();
+      size_t cnt = 0;
+      std::vector<float> a(dims), b(dims);
+      std::memcpy(b.data(), query.data(), query.size());
+      for (auto const &row : c.execute("select v from E")) {
+        auto [v] = row.to<std::string_view>();
+        std::memcpy(a.data(), v.data(), v.size());
+        float dot = 0;
+        for (size_t i = 0; i < dims; ++i) dot += a[i] * b[i];
+        if (dot > 0) ++cnt;
+      }
+      return cnt;
+    });
+
+    for (auto level :
+         {simd_level::scalar, simd_level::avx2, simd_level::avx512}) {
+      if (get_vector_kernels(level).level != level) continue;
+      create_vector_functions(db, level);
+      char const *names[] = {"vec_dot scalar", "vec_dot avx2",
+                             "vec_dot avx512"};
+      time_it(names[(int)level], [&] {
+        auto c = db.make_cursor();
+        auto [cnt] = c.execute("select count(*) from E "
+                               "where vec_dot(v, cast(? as blob)) > 0",
+                               query)
+                         .begin()
+                         ->to<int>();
+        return (size_t)cnt;
+      });
+    }
+  };
+}
+
+std::function<void()> collations(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing row count");
+
+  size_t rows = strtoul(argv[index + 1], 0, 10);
+
+  return [rows]() {
+    using namespace sqlite3cpp;
+
+    database db(":memory:");
+    create_collations(db);
+    db.create_collation("lambda_nocase", ascii_nocase_compare);
+    auto c = db.make_cursor();
+    c.executescript("create table S (s text)");
+
+    std::mt19937 gen(42);
+    char const *prefixes[] = {"Item", "item", "ITEM-", "Report_", "report_"};
+    {
+      transaction trns(db);
+      for (size_t i = 0; i < rows; ++i) {
+        std::string s = prefixes[gen() % 5] + std::to_string(gen() % 100000);
+        s.append(gen() % 24, 'a' + gen() % 26);
+        c.execute("insert into S values(?)", s);
+      }
+      trns.commit();
+    }
+
+    for (auto coll : {"binary", "nocase", "ascii_nocase", "lambda_nocase",
+                      "natural_order"}) {
+      std::string name = coll;
+      time_it(("sort " + name).c_str(), [&] {
+        size_t cnt = 0;
+        for (auto const &row :
+             c.execute("select s from S order by s collate " + name)) {
+          (void)row;
+          ++cnt;
+        }
+        return cnt;
+      });
+      time_it(("index " + name).c_str(), [&] {
+        c.executescript("create index I on S(s collate " + name +
+                        "); drop index I;");
+        return rows;
+      });
+    }
+  };
+}
+
+std::function<void()> full_text(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing row count");
+
+  size_t rows = strtoul(argv[index + 1], 0, 10);
+
+  return [rows]() {
+    using namespace sqlite3cpp;
+
+    database db(":memory:");
+    create_fts5_tokenizer<identifier_tokenizer>(db, "identifier");
+    auto c = db.make_cursor();
+
+    // Lines of code-like text made of camelCase and snake_case identifiers
+    std::mt19937 gen(42);
+    char const *words[] = {"get",    "set",   "user", "name",  "id",
+                           "parse",  "http",  "json", "value", "count",
+                           "buffer", "index", "next", "node",  "cache"};
+    auto word = [&] { return std::string(words[gen() % 15]); };
+    std::vector<std::string> docs(rows);
+    for (auto &doc : docs) {
+      for (int i = 0; i < 12; ++i) {
+        std::string w = word(), v = word();
+        if (gen() % 2) {
+          v[0] += 'A' - 'a';
+          doc += w + v + "(" + word() + "_" + word() + "); ";
+        } else {
+          doc += w + "_" + v + " = " + std::to_string(gen() % 1000) + "; ";
+        }
+      }
+    }
+
+    for (auto tokenizer : {"unicode61", "identifier"}) {
+      std::string name = tokenizer;
+      c.executescript("drop table if exists Doc; create virtual table Doc "
+                      "using fts5(body, tokenize='" + name + "')");
+      time_it(("index " + name).c_str(), [&] {
+        transaction trns(db);
+        for (auto const &doc : docs) {
+          c.execute("insert into Doc values(?)", doc);
+        }
+        trns.commit();
+        return docs.size();
+      });
+      time_it(("query " + name).c_str(), [&] {
+        auto c = db.make_cursor();
+        size_t cnt = 0;
+        for (int i = 0; i < 200; ++i) {
+          auto [n] = c.execute("select count(*) from Doc(?)", word())
+                         .begin()
+                         ->to<int>();
+          cnt += n;
+        }
+        return cnt;
+      });
+    }
+  };
+}
+
+std::function<void()> scripts(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing run count");
+
+  size_t runs = strtoul(argv[index + 1], 0, 10);
+
+  return [runs]() {
+    using namespace sqlite3cpp;
+
+    database db(":memory:");
+    std::string const sql =
+        "create table if not exists Job (id integer primary key, state int,"
+        "  updated int);"
+        "create index if not exists JobState on Job(state);"
+        "insert into Job(state, updated) values(0, 0);"
+        "update Job set state = 1, updated = updated + 1 where state = 0;"
+        "delete from Job where state = 1 and id % 2 = 0;";
+
+    time_it("executescript", [&] {
+      auto c = db.make_cursor();
+      for (size_t i = 0; i < runs; ++i) c.executescript(sql);
+      return runs;
+    });
+
+    script job(db, sql);
+    time_it("script", [&] {
+      for (size_t i = 0; i < runs; ++i) job.run();
+      return runs;
+    });
+  };
+}
+
+std::function<void()> errors(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing insert count");
+
+  size_t count = strtoul(argv[index + 1], 0, 10);
+
+  return [count]() {
+    using namespace sqlite3cpp;
+
+    // Half of the inserts violate the unique constraint
+    auto reset = [](database &db) {
+      db.executescript(
+          "drop table if exists U;"
+          "create table U (k integer primary key)");
+    };
+    char const *sql = "insert into U values(?)";
+    database db(":memory:");
+
+    reset(db);
+    time_it("throwing execute", [&] {
+      auto c = db.make_cursor();
+      size_t failed = 0;
+      for (size_t i = 0; i < count; ++i) {
+        try {
+          c.execute(sql, (int)(i / 2));
+        } catch (error const &) {
+          failed += 1;
+        }
+      }
+      return count;
+    });
+
+    reset(db);
+    time_it("try_execute", [&] {
+      auto c = db.make_cursor();
+      size_t failed = 0;
+      for (size_t i = 0; i < count; ++i) {
+        if (!c.try_execute(sql, (int)(i / 2))) failed += 1;
+      }
+      return count;
+    });
+
+    reset(db);
+    time_it("try_bind + try_step", [&] {
+      auto c = db.make_cursor();
+      size_t failed = 0;
+      c.try_execute(sql, -1);
+      for (size_t i = 0; i < count; ++i) {
+        if (!c.try_bind((int)(i / 2)) || !c.try_step()) failed += 1;
+      }
+      return count;
+    });
+  };
+}
+
+std::function<void()> parallel_scans(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing row count");
+
+  size_t rows = strtoul(argv[index + 1], 0, 10);
+
+  return [rows]() {
+    using namespace sqlite3cpp;
+
+    std::remove("scandata.db");
+    std::remove("scandata.db-wal");
+    std::remove("scandata.db-shm");
+    database db("scandata.db");
+    db.executescript(
+        "pragma journal_mode=wal;"
+        "create table E (id integer primary key, v real, tag text)");
+    {
+      transaction trns(db);
+      auto c = db.make_cursor();
+      for (size_t i = 0; i < rows; ++i)
+        c.execute("insert into E(v, tag) values(?, ?)", (double)(i % 1000),
+                  i % 3 ? "a" : "b");
+      trns.commit();
+    }
+
+    char const *sql =
+        "select v, tag from E where id between ?1 and ?2 and v > 10";
+    for (unsigned threads : {1u, 2u, 4u, 8u}) {
+      parallel_scan::params_t params;
+      params.threads = threads;
+      parallel_scan scan(db, "E", params);
+      std::string name =
+          "parallel_scan x" + std::to_string(scan.concurrency());
+      time_it(name.c_str(), [&] {
+        auto sum = scan.reduce(
+            sql, 0.0,
+            [](double &acc, row const &r) {
+              auto [v, tag] = r.to<double, std::string_view>();
+              if (tag == "a") acc += v;
+            },
+            [](double &acc, double partial) { acc += partial; });
+        return (size_t)sum ? rows : 0;
+      });
+    }
+  };
+}
+
+std::function<void()> io_stats_overhead(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing row count");
+
+  size_t rows = strtoul(argv[index + 1], 0, 10);
+
+  return [rows]() {
+    using namespace sqlite3cpp;
+
+    io_stats_vfs vfs("iostats");
+    int const flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+
+    // Small transactions and a cold page cache make the workload I/O bound
+    auto workload = [rows](database &db) {
+      db.executescript(
+          "pragma journal_mode=wal;"
+          "pragma cache_size=16;"
+          "drop table if exists IO;"
+          "create table IO (id integer primary key, v text)");
+      auto c = db.make_cursor();
+      for (size_t i = 0; i < rows; ++i)
+        c.execute("insert into IO(v) values(?)", "v" + std::to_string(i));
+      size_t cnt = 0;
+      for (auto const &r : c.execute("select v from IO order by v")) {
+        (void)r;
+        cnt += 1;
+      }
+      return cnt;
+    };
+
+    for (char const *vfs_name : {(char const *)nullptr, vfs.name()}) {
+      std::remove("iodata.db");
+      std::remove("iodata.db-wal");
+      std::remove("iodata.db-shm");
+      database db("iodata.db", flags, vfs_name);
+      time_it(vfs_name ? "io_stats_vfs" : "default vfs",
+              [&] { return workload(db); });
+    }
+    std::cout << vfs.stats().to_json() << std::endl;
+  };
+}
+
+std::function<void()> images(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing row count");
+
+  size_t rows = strtoul(argv[index + 1], 0, 10);
+
+  return [rows]() {
+    using namespace sqlite3cpp;
+
+    std::remove("imagedata.db");
+    {
+      database db("imagedata.db");
+      db.executescript("create table K (k integer primary key, v text)");
+      transaction trns(db);
+      auto c = db.make_cursor();
+      for (size_t i = 0; i < rows; ++i)
+        c.execute("insert into K values(?, ?)", (int)i, std::to_string(i));
+      trns.commit();
+    }
+
+    // Open, then look up every key once
+    auto lookups = [rows](database &db) {
+      auto c = db.make_cursor();
+      size_t found = 0;
+      for (size_t i = 0; i < rows; ++i) {
+        for (auto const &r : c.execute("select v from K where k = ?", (int)i)) {
+          (void)r;
+          found += 1;
+        }
+      }
+      return found;
+    };
+
+    time_it("open file", [&] {
+      database db("imagedata.db");
+      return lookups(db);
+    });
+    time_it("map_file image", [&] {
+      database db(database_image::map_file("imagedata.db"));
+      return lookups(db);
+    });
+
+    image_reader reader(database_image::map_file("imagedata.db"));
+    size_t const swaps = 1000;
+    time_it("image_reader swap", [&] {
+      for (size_t i = 0; i < swaps; ++i)
+        reader.swap(database_image::map_file("imagedata.db"));
+      return swaps;
+    });
+  };
+}
+
+std::function<void()> slow_queries(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing query count");
+
+  size_t count = strtoul(argv[index + 1], 0, 10);
+
+  return [count]() {
+    using namespace sqlite3cpp;
+
+    database db(":memory:");
+    db.executescript(
+        "create table Q (k integer primary key, v int);"
+        "with recursive n(i) as (select 1 union all select i + 1 from n "
+        "  where i < 10000) "
+        "insert into Q select i, i % 100 from n;");
+
+    // Fast point queries; the log only pays for timing them
+    auto queries = [&db, count] {
+      auto c = db.make_cursor();
+      for (size_t i = 0; i < count; ++i)
+        c.execute("select v from Q where k = ?", (int)(i % 10000));
+      return count;
+    };
+
+    time_it("without log", queries);
+    {
+      slow_query_log::params_t params;
+      params.threshold = std::chrono::milliseconds(100);
+      slow_query_log log(db, params);
+      time_it("slow_query_log", queries);
+    }
+  };
+}
+
+std::function<void()> prefetches(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing row count");
+
+  size_t rows = strtoul(argv[index + 1], 0, 10);
+
+  return [rows]() {
+    using namespace sqlite3cpp;
+
+    database db(":memory:");
+    db.executescript("create table P (k integer primary key, body text)");
+    {
+      transaction trns(db);
+      auto c = db.make_cursor();
+      for (size_t i = 0; i < rows; ++i)
+        c.execute("insert into P(body) values(?)",
+                  std::string(64 + i % 64, 'a' + i % 26));
+      trns.commit();
+    }
+
+    // Per-row work of the application, comparable to stepping a row
+    auto work = [](std::string const &body) {
+      uint64_t h = 1469598103934665603ull;
+      for (int round = 0; round < 8; ++round)
+        for (char ch : body) h = (h ^ (unsigned char)ch) * 1099511628211ull;
+      return h;
+    };
+    char const *sql = "select k, body from P where body like '%a%' or k > 0";
+
+    uint64_t sink = 0;
+    auto c = db.make_cursor();
+    time_it("row_iter", [&] {
+      size_t cnt = 0;
+      for (auto const &r : c.execute(sql)) {
+        auto [k, body] = r.to<int64_t, std::string>();
+        sink += work(body) + k;
+        ++cnt;
+      }
+      return cnt;
+    });
+
+    for (size_t batch_rows : {16, 256}) {
+      prefetch<int64_t, std::string>::params_t params;
+      params.batch_rows = batch_rows;
+      c.execute(sql);
+      prefetch<int64_t, std::string> pf(c, params);
+      std::string name = "prefetch batch " + std::to_string(batch_rows);
+      time_it(name.c_str(), [&] {
+        size_t cnt = 0;
+        for (auto const &[k, body] : pf) {
+          sink += work(body) + k;
+          ++cnt;
+        }
+        return cnt;
+      });
+      auto s = pf.stats();
+      std::cout << "  batches " << s.batches << ", producer waits "
+                << s.producer_waits << ", consumer waits " << s.consumer_waits
+                << std::endl;
+    }
+    if (sink == 42) std::cout << std::endl;
+  };
+}
+
+std::function<void()> pagers(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing row count");
+
+  size_t rows = strtoul(argv[index + 1], 0, 10);
+
+  return [rows]() {
+    using namespace sqlite3cpp;
+    using namespace std::chrono;
+
+    database db(":memory:");
+    db.executescript(
+        "create table A (id integer primary key, name text);"
+        "create index A_name on A(name, id);");
+    {
+      transaction trns(db);
+      auto c = db.make_cursor();
+      for (size_t i = 0; i < rows; ++i)
+        c.execute("insert into A(name) values(?)",
+                  "name" + std::to_string(i % 1000));
+      trns.commit();
+    }
+
+    size_t const page_size = 100;
+    auto c = db.make_cursor();
+    keyset_pager::params_t params;
+    params.page_size = page_size;
+    keyset_pager pager(db, "select name, id from A", {"name", "id"}, params);
+
+    // Walk all pages; report time of pages at growing depths
+    std::string token;
+    size_t page = 0, next_report = 1;
+    do {
+      auto start = steady_clock::now();
+      c.execute("select name, id from A order by name, id limit ? offset ?",
+                (int)page_size, (int64_t)(page * page_size));
+      size_t n = 0;
+      for (auto const &r : c) n += r.get() ? 1 : 0;
+      duration<double, std::micro> offset_us = steady_clock::now() - start;
+
+      start = steady_clock::now();
+      auto p = pager.fetch<std::string, int64_t>(token);
+      duration<double, std::micro> keyset_us = steady_clock::now() - start;
+      token = p.next;
+
+      if (++page == next_report || token.empty()) {
+        std::cout << "page " << page << " (" << n << " rows): offset "
+                  << offset_us.count() << " us, keyset " << keyset_us.count()
+                  << " us" << std::endl;
+        next_report *= 4;
+      }
+    } while (!token.empty());
+  };
+}
+
+std::function<void()> maintenance(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing commit count");
+
+  size_t commits = strtoul(argv[index + 1], 0, 10);
+
+  return [commits]() {
+    using namespace sqlite3cpp;
+    using namespace std::chrono;
+
+    auto latencies = [commits](char const *name,
+                               std::optional<milliseconds> quiet) {
+      std::remove("maintdata.db");
+      std::remove("maintdata.db-wal");
+      std::remove("maintdata.db-shm");
+      database db("maintdata.db");
+      db.executescript(
+          "pragma auto_vacuum=incremental;"
+          "pragma journal_mode=wal;"
+          "create table M (id integer primary key, k int, body blob);"
+          "create index M_k on M(k);");
+      db.set_busy_policy(backoff_policy());
+
+      std::optional<maintenance_scheduler> upkeep;
+      if (quiet) {
+        maintenance_scheduler::params_t params;
+        params.optimize_interval = milliseconds(50);
+        params.analyze_interval = milliseconds(50);
+        params.vacuum_interval = milliseconds(10);
+        params.vacuum_min_free_pages = 1;
+        params.quiet_period = *quiet;
+        upkeep.emplace(db, params);
+      }
+
+      // Inserts and deletes keep the freelist growing
+      std::vector<double> us;
+      us.reserve(commits);
+      for (size_t i = 0; i < commits; ++i) {
+        auto start = steady_clock::now();
+        db.execute("insert into M(k, body) values(?, zeroblob(8000))",
+                   (int)(i % 100));
+        if (i % 4 == 3) db.execute("delete from M where id <= ?", (int)i - 2);
+        us.push_back(
+            duration<double, std::micro>(steady_clock::now() - start).count());
+        std::this_thread::sleep_for(microseconds(200));
+      }
+      std::sort(us.begin(), us.end());
+      std::cout << name << ": p50 " << us[us.size() / 2] << " us, p99 "
+                << us[us.size() * 99 / 100] << " us, max " << us.back()
+                << " us";
+      if (upkeep) {
+        auto m = upkeep->metrics();
+        std::cout << "; slices " << m.vacuum_slices << ", tables analyzed "
+                  << m.tables_analyzed << ", deferred " << m.deferred;
+      }
+      std::cout << std::endl;
+    };
+
+    latencies("no maintenance", std::nullopt);
+    latencies("maintenance, no pacing", milliseconds(0));
+    latencies("maintenance, quiet 5ms", milliseconds(5));
+    std::remove("maintdata.db");
+    std::remove("maintdata.db-wal");
+    std::remove("maintdata.db-shm");
+  };
+}
+
+std::function<void()> page_caches(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing connections");
+
+  size_t conns = std::max<size_t>(strtoul(argv[index + 1], 0, 10), 2);
+
+  return [conns]() {
+    using namespace sqlite3cpp;
+    using namespace std::chrono;
+
+    int const rows = 40000;
+    int64_t const budget = int64_t(8) << 20;
+    std::remove("pcachedata.db");
+    {
+      database db("pcachedata.db");
+      db.executescript(
+          "create table R (k integer primary key, v blob);"
+          "with recursive n(i) as (select 1 union all select i + 1 from n "
+          "  where i < " +
+          std::to_string(rows) +
+          ") insert into R select i, randomblob(900) from n;");
+    }
+
+    // Connection 0 reads 6000 rows, about 3/4 of |budget|; the others read
+    // 400 rows each.
+    auto run = [&](char const *name, int cache_kb) {
+      std::vector<std::unique_ptr<database>> dbs;
+      for (size_t i = 0; i < conns; ++i) {
+        dbs.push_back(std::make_unique<database>("pcachedata.db"));
+        dbs.back()->execute("pragma cache_size=" + std::to_string(-cache_kb));
+      }
+      auto start = steady_clock::now();
+      std::vector<std::thread> threads;
+      for (size_t i = 0; i < conns; ++i) {
+        threads.emplace_back([&, i] {
+          std::mt19937 rng((unsigned)i);
+          int const base = i ? 6000 + (int)i * 400 : 0;
+          int const span = i ? 400 : 6000;
+          std::uniform_int_distribution<int> key(base + 1, base + span);
+          auto c = dbs[i]->make_cursor();
+          for (int n = i ? 20000 : 200000; n > 0; --n)
+            c.execute("select length(v) from R where k = ?", key(rng));
+        });
+      }
+      for (auto &t : threads) t.join();
+      duration<double, std::milli> elapsed = steady_clock::now() - start;
+
+      int64_t hits = 0, misses = 0;
+      for (auto const &db : dbs) {
+        auto s = db->db_statistics();
+        hits += s.cache_hit;
+        misses += s.cache_miss;
+      }
+      std::cout << name << ": " << elapsed.count() << " ms, cache hits "
+                << hits << ", misses " << misses << std::endl;
+    };
+
+    run("default, cache_size budget/connections",
+        (int)(budget >> 10) / (int)conns);
+    {
+      shared_page_cache::params_t params;
+      params.capacity = budget;
+      params.honor_cache_size = false;
+      shared_page_cache cache(params);
+      run("shared_page_cache, capacity budget", (int)(budget >> 10));
+      auto s = cache.stats();
+      std::cout << "  evictions " << s.evictions << ", reserved "
+                << (s.bytes_reserved >> 10) << " KiB" << std::endl;
+    }
+    std::remove("pcachedata.db");
+  };
+}
+
+std::function<void()> rtrees(int index, int argc, char **argv) {
+  if (index + 1 >= argc) throw std::invalid_argument("missing row count");
+
+  size_t rows = strtoul(argv[index + 1], 0, 10);
+
+  return [rows]() {
+    using namespace sqlite3cpp;
+
+    database db(":memory:");
+    db.executescript("create table P (id integer primary key, x real, y real)");
+    create_rtree(db, "R", {"x", "y"});
+    {
+      std::mt19937 rng(7);
+      std::uniform_real_distribution<double> coord(0, 1000);
+      transaction trns(db);
+      auto c = db.make_cursor();
+      for (size_t i = 0; i < rows; ++i) {
+        double x = coord(rng), y = coord(rng);
+        c.execute("insert into P values(?, ?, ?)", (int64_t)i, x, y);
+        c.execute("insert into R values(?, ?, ?, ?, ?)", (int64_t)i, x, x, y,
+                  y);
+      }
+      trns.commit();
+    }
+
+    db.create_scalar("in_circle",
+                     [](double x, double y, double cx, double cy, double r) {
+                       return (x - cx) * (x - cx) + (y - cy) * (y - cy) <=
+                              r * r;
+                     });
+    create_rtree_query(db, "circle", [](rtree_query_info &q) {
+      double const cx = q.param(0), cy = q.param(1), r = q.param(2);
+      double dx = std::max({q.min(0) - cx, cx - q.max(0), 0.});
+      double dy = std::max({q.min(1) - cy, cy - q.max(1), 0.});
+      return dx * dx + dy * dy <= r * r ? rtree_partly_within
+                                        : rtree_not_within;
+    });
+
+    int const queries = 200;
+    auto run = [&](char const *sql) {
+      std::mt19937 rng(11);
+      std::uniform_real_distribution<double> coord(0, 1000);
+      auto c = db.make_cursor();
+      size_t cnt = 0;
+      for (int i = 0; i < queries; ++i) {
+        double cx = coord(rng), cy = coord(rng);
+        auto [n] = c.execute(sql, cx, cy, 20.0).begin()->to<int>();
+        cnt += n;
+      }
+      return cnt;
+    };
+    time_it("scalar UDF, full scan", [&] {
+      return run("select count(*) from P where in_circle(x, y, ?1, ?2, ?3)");
+    });
+    time_it("rtree query callback", [&] {
+      return run("select count(*) from R where id match circle(?1, ?2, ?3)");
+    });
+  };
+}
+
 int main(int argc, char **argv) {
   using std::function;
   using opt_act_t = function<function<void()>(int idx, int argc, char **argv)>;
@@ -126,6 +900,62 @@ int main(int argc, char **argv) {
        "-rr <seq|rand>\tScan testdata with specified pattern (sequential or "
        "random) in ref semantic.",
        scan<std::string_view>()},
+      {"-vec",
+       "-vec <dims>\tCompare vec_dot() kernels and a naive loop over "
+       "float32 vectors of specified dimensions.",
+       vector_similarity},
+      {"-coll",
+       "-coll <rows>\tSort and index specified number of strings with "
+       "prebuilt and builtin collations.",
+       collations},
+      {"-fts",
+       "-fts <rows>\tBuild and query FTS5 index of specified number of "
+       "code-like documents with unicode61 and identifier tokenizers.",
+       full_text},
+      {"-script",
+       "-script <runs>\tRun a multi-statement job specified times via "
+       "executescript() and script.",
+       scripts},
+      {"-err",
+       "-err <n>\tInsert specified number of rows half of which violate a "
+       "constraint, via execute() and the non-throwing API.",
+       errors},
+      {"-pscan",
+       "-pscan <rows>\tAggregate a table of specified number of rows by "
+       "parallel_scan with 1 to 8 threads.",
+       parallel_scans},
+      {"-iovfs",
+       "-iovfs <rows>\tInsert and sort specified number of rows with the "
+       "default VFS and io_stats_vfs, then print I/O statistics.",
+       io_stats_overhead},
+      {"-image",
+       "-image <rows>\tLook up specified number of keys on an opened "
+       "file and on a mapped image, then time image swaps.",
+       images},
+      {"-slow",
+       "-slow <n>\tRun specified number of point queries with and without "
+       "slow_query_log attached.",
+       slow_queries},
+      {"-prefetch",
+       "-prefetch <rows>\tIterate specified number of rows with per-row "
+       "work via row_iter and prefetch.",
+       prefetches},
+      {"-pager",
+       "-pager <rows>\tPage through specified number of rows by "
+       "LIMIT/OFFSET and keyset_pager.",
+       pagers},
+      {"-maint",
+       "-maint <commits>\tTime specified number of commits without and "
+       "with maintenance_scheduler.",
+       maintenance},
+      {"-pcache",
+       "-pcache <connections>\tRun skewed point queries on specified number "
+       "of connections with the default page cache and shared_page_cache.",
+       page_caches},
+      {"-rtree",
+       "-rtree <rows>\tRun radius queries over specified number of points "
+       "by a scalar UDF full scan and an R*Tree query callback.",
+       rtrees},
       {"-h", "-h\tPrint usage.", {}}};
 
   opt_act_t help = [&options](int, int, char **) {
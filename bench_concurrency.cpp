@@ -0,0 +1,294 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sqlite3cpp.h"
+
+// Run mixes of concurrent readers and writers and report scaling curves in
+// JSON. A mix is a combination of connection mode, journal mode, synchronous
+// level, and read ratio; each is run with every thread count given.
+
+using namespace std::chrono;
+
+struct config_t {
+  std::vector<int> threads = {1, 2, 4, 8};
+  std::vector<int> read_percents = {90, 50};
+  std::vector<std::string> connections = {"shared", "per_thread"};
+  std::vector<std::string> journals = {"wal", "delete"};
+  std::vector<std::string> synchronous = {"off", "normal", "full"};
+  int rows = 100000;
+  milliseconds duration{500};
+  std::string out;
+};
+
+struct mix_t {
+  std::string connection;
+  std::string journal;
+  std::string synchronous;
+  int read_percent;
+};
+
+struct latencies_t {
+  std::vector<uint32_t> us;
+
+  std::string to_json() {
+    std::sort(us.begin(), us.end());
+    auto at = [this](double q) {
+      if (us.empty()) return (uint32_t)0;
+      return us[std::min(us.size() - 1, (size_t)(q * (double)us.size()))];
+    };
+    std::ostringstream os;
+    os << "{\"count\":" << us.size() << ",\"p50_us\":" << at(0.5)
+       << ",\"p90_us\":" << at(0.9) << ",\"p99_us\":" << at(0.99)
+       << ",\"max_us\":" << (us.empty() ? 0 : us.back()) << "}";
+    return os.str();
+  }
+};
+
+struct thread_result_t {
+  latencies_t reads;
+  latencies_t writes;
+  uint64_t errors = 0;
+};
+
+std::string db_name(std::string const &journal) {
+  return "concurrency_" + journal + ".db";
+}
+
+void generate(std::string const &journal, int rows) {
+  auto name = db_name(journal);
+  for (char const *suffix : {"", "-wal", "-shm", "-journal"})
+    std::remove((name + suffix).c_str());
+
+  sqlite3cpp::database db(name);
+  db.executescript("pragma journal_mode=" + journal +
+                   ";"
+                   "create table KV (k integer primary key, v int, pad text);");
+  sqlite3cpp::transaction trns(db);
+  auto c = db.make_cursor();
+  std::string pad(64, 'x');
+  for (int i = 0; i < rows; ++i)
+    c.execute("insert into KV values(?, ?, ?)", i, i, pad);
+  trns.commit();
+}
+
+std::unique_ptr<sqlite3cpp::database> open(mix_t const &mix) {
+  auto db = std::make_unique<sqlite3cpp::database>(db_name(mix.journal));
+  db->executescript("pragma synchronous=" + mix.synchronous);
+
+  sqlite3cpp::backoff_policy::params_t params;
+  params.deadline = milliseconds(1000);
+  db->set_busy_policy(sqlite3cpp::backoff_policy(params));
+  return db;
+}
+
+void worker(sqlite3cpp::database &db, mix_t const &mix, int rows,
+            steady_clock::time_point deadline, unsigned seed,
+            thread_result_t &result) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> key(0, rows - 1);
+  std::uniform_int_distribution<int> percent(0, 99);
+  auto c = db.make_cursor();
+
+  while (steady_clock::now() < deadline) {
+    bool const read = percent(rng) < mix.read_percent;
+    auto start = steady_clock::now();
+    try {
+      if (read) {
+        for (auto const &r : c.execute("select v, pad from KV where k = ?",
+                                       key(rng))) {
+          (void)r.to<int, std::string_view>();
+        }
+      } else {
+        c.execute("update KV set v = v + 1 where k = ?", key(rng));
+      }
+    } catch (sqlite3cpp::error const &) {
+      result.errors += 1;
+      continue;
+    }
+    auto us = duration_cast<microseconds>(steady_clock::now() - start);
+    (read ? result.reads : result.writes).us.push_back((uint32_t)us.count());
+  }
+}
+
+std::string run(mix_t const &mix, int threads, config_t const &cfg) {
+  std::vector<std::unique_ptr<sqlite3cpp::database>> dbs;
+  dbs.push_back(open(mix));
+  if (mix.connection == "per_thread") {
+    for (int i = 1; i < threads; ++i) dbs.push_back(open(mix));
+  }
+
+  std::vector<thread_result_t> results(threads);
+  std::vector<std::thread> pool;
+  auto const start = steady_clock::now();
+  auto const deadline = start + cfg.duration;
+  for (int i = 0; i < threads; ++i) {
+    auto &db = *dbs[dbs.size() == 1 ? 0 : i];
+    pool.emplace_back([&, i] {
+      worker(db, mix, cfg.rows, deadline, (unsigned)i + 1, results[i]);
+    });
+  }
+  for (auto &t : pool) t.join();
+  duration<double> elapsed = steady_clock::now() - start;
+
+  thread_result_t all;
+  for (auto &r : results) {
+    all.reads.us.insert(all.reads.us.end(), r.reads.us.begin(),
+                        r.reads.us.end());
+    all.writes.us.insert(all.writes.us.end(), r.writes.us.begin(),
+                         r.writes.us.end());
+    all.errors += r.errors;
+  }
+  sqlite3cpp::busy_stats busy;
+  for (auto &db : dbs) {
+    auto st = db->busy_statistics();
+    busy.episodes += st.episodes;
+    busy.retries += st.retries;
+    busy.timeouts += st.timeouts;
+  }
+
+  size_t ops = all.reads.us.size() + all.writes.us.size();
+  std::ostringstream os;
+  os << "{\"threads\":" << threads
+     << ",\"ops_per_sec\":" << (uint64_t)(ops / elapsed.count())
+     << ",\"reads\":" << all.reads.to_json()
+     << ",\"writes\":" << all.writes.to_json()
+     << ",\"busy\":{\"episodes\":" << busy.episodes
+     << ",\"retries\":" << busy.retries << ",\"timeouts\":" << busy.timeouts
+     << "},\"errors\":" << all.errors << "}";
+  return os.str();
+}
+
+template <typename T, typename F>
+std::vector<T> split(char const *arg, F &&conv) {
+  std::vector<T> out;
+  std::stringstream ss(arg);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (!item.empty()) out.push_back(conv(item));
+  return out;
+}
+
+int main(int argc, char **argv) {
+  config_t cfg;
+  auto to_int = [](std::string const &s) { return std::stoi(s); };
+  auto to_str = [](std::string const &s) { return s; };
+
+  struct option {
+    char const *opt;
+    char const *cmt;
+    std::function<void(char const *)> act;
+  } options[] = {
+      {"-threads", "-threads <n,...>\tThread counts of scaling curves.",
+       [&](char const *v) { cfg.threads = split<int>(v, to_int); }},
+      {"-reads", "-reads <pct,...>\tPercentages of reads in mixes.",
+       [&](char const *v) { cfg.read_percents = split<int>(v, to_int); }},
+      {"-conn", "-conn <shared|per_thread,...>\tConnection modes.",
+       [&](char const *v) { cfg.connections = split<std::string>(v, to_str); }},
+      {"-journal", "-journal <wal|delete,...>\tJournal modes.",
+       [&](char const *v) { cfg.journals = split<std::string>(v, to_str); }},
+      {"-sync", "-sync <off|normal|full,...>\tSynchronous levels.",
+       [&](char const *v) {
+         cfg.synchronous = split<std::string>(v, to_str);
+       }},
+      {"-rows", "-rows <n>\tRows of the generated dataset.",
+       [&](char const *v) { cfg.rows = std::max(1, std::stoi(v)); }},
+      {"-ms", "-ms <n>\tDuration of each run in milliseconds.",
+       [&](char const *v) { cfg.duration = milliseconds(std::stoi(v)); }},
+      {"-o", "-o <file>\tWrite JSON to file instead of stdout.",
+       [&](char const *v) { cfg.out = v; }},
+  };
+
+  for (int i = 1; i < argc; ++i) {
+    bool known = false;
+    for (auto const &op : options) {
+      if (strcmp(argv[i], op.opt)) continue;
+      if (i + 1 >= argc) {
+        std::cerr << "missing value of " << op.opt << std::endl;
+        return 1;
+      }
+      op.act(argv[++i]);
+      known = true;
+    }
+    if (!known) {
+      std::cout << "Usage:" << std::endl;
+      for (auto const &op : options) std::cout << "\t" << op.cmt << std::endl;
+      return strcmp(argv[i], "-h") ? 1 : 0;
+    }
+  }
+
+  std::ostringstream os;
+  os << "{\"rows\":" << cfg.rows << ",\"duration_ms\":" << cfg.duration.count()
+     << ",\"mixes\":[";
+  bool first = true;
+  for (auto const &journal : cfg.journals) {
+    generate(journal, cfg.rows);
+    for (auto const &conn : cfg.connections) {
+      for (auto const &sync : cfg.synchronous) {
+        for (int reads : cfg.read_percents) {
+          mix_t mix{conn, journal, sync, reads};
+          os << (first ? "" : ",") << "\n{\"connection\":\"" << conn
+             << "\",\"journal\":\"" << journal << "\",\"synchronous\":\""
+             << sync << "\",\"read_percent\":" << reads << ",\"points\":[";
+          first = false;
+          for (size_t t = 0; t < cfg.threads.size(); ++t) {
+            os << (t ? "," : "") << run(mix, cfg.threads[t], cfg);
+          }
+          os << "]}";
+          std::cerr << "done " << conn << " " << journal << " " << sync << " "
+                    << reads << "%" << std::endl;
+        }
+      }
+    }
+    for (char const *suffix : {"", "-wal", "-shm", "-journal"})
+      std::remove((db_name(journal) + suffix).c_str());
+  }
+  os << "\n]}\n";
+
+  if (cfg.out.empty()) {
+    std::cout << os.str();
+  } else {
+    std::ofstream(cfg.out) << os.str();
+  }
+  return 0;
+}
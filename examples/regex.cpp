@@ -11,17 +11,17 @@ int main() {
 
     database db(":memory:");
 
-    auto re_replace = [](std::string pattern,
+    auto re_replace = [](aux<std::regex> const &re,
                          std::string value,
-                         std::string text)
+                         std::string_view text)
     {
-        // Replace regex |pattern| found in |text| with |value|
+        // Replace regex |re| found in |text| with |value|. |re| is compiled
+        // once per statement as long as the pattern is a constant.
         std::stringstream out;
-        std::regex re(pattern);
 
         std::regex_replace(std::ostreambuf_iterator<char>(out),
                            text.begin(), text.end(),
-                           re, value);
+                           *re, value);
         return out.str();
     };
 
@@ -40,8 +40,8 @@ int main() {
 
     // Execute the query and print out replaced results
     for(auto const &row : csr.execute(query)) {
-        string_ref result;
-        std::tie(result) = row.to<string_ref>();
+        std::string_view result;
+        std::tie(result) = row.to<std::string_view>();
         std::cout << result << std::endl;
     }
 
@@ -33,11 +33,32 @@
 #pragma clang diagnostic ignored "-Wdeprecated-declarations"
 #endif
 #include "gtest/gtest.h"
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <mutex>
 #include "sqlite3cpp.h"
+#include "sqlite3cpp_change_stream.h"
+#include "sqlite3cpp_checkpoint.h"
+#include "sqlite3cpp_collation.h"
+#include "sqlite3cpp_fts5.h"
+#include "sqlite3cpp_io_stats.h"
+#include "sqlite3cpp_maintenance.h"
+#include "sqlite3cpp_memory.h"
+#include "sqlite3cpp_pager.h"
+#include "sqlite3cpp_parallel_scan.h"
+#include "sqlite3cpp_pcache.h"
+#include "sqlite3cpp_prefetch.h"
+#include "sqlite3cpp_query_cache.h"
+#include "sqlite3cpp_rtree.h"
+#include "sqlite3cpp_script.h"
+#include "sqlite3cpp_session.h"
+#include "sqlite3cpp_slow_query.h"
+#include "sqlite3cpp_vector.h"
+#include "sqlite3cpp_write_queue.h"
 
 [[maybe_unused]]
 static void trace_print(void *ctx, char const *stmt) { printf("%s\n", stmt); }
@@ -356,6 +377,157 @@ TEST_F(DBTest, max_int64) {
   }
 }
 
+namespace {
+enum class color : uint8_t { red = 1, green = 2 };
+
+struct point {
+  int32_t x, y;
+};
+}  // namespace
+
+namespace sqlite3cpp {
+template <>
+struct type_traits<point> {
+  static sqlite3_int64 pack(point p) noexcept {
+    return ((sqlite3_int64)p.x << 32) | (uint32_t)p.y;
+  }
+  static point unpack(sqlite3_int64 v) noexcept {
+    return {(int32_t)(v >> 32), (int32_t)v};
+  }
+  static int bind(sqlite3_stmt *stmt, int index, point p) noexcept {
+    return sqlite3_bind_int64(stmt, index, pack(p));
+  }
+  static point column(sqlite3_stmt *stmt, int index) {
+    return unpack(sqlite3_column_int64(stmt, index));
+  }
+  static point value(sqlite3_value *v) {
+    return unpack(sqlite3_value_int64(v));
+  }
+  static void result(sqlite3_context *ctx, point p) {
+    sqlite3_result_int64(ctx, pack(p));
+  }
+};
+}  // namespace sqlite3cpp
+
+TEST_F(DBTest, type_traits) {
+  using namespace std::chrono;
+  using clock_ms = time_point<system_clock, milliseconds>;
+
+  auto c = basic_dataset().make_cursor();
+  c.executescript("create table Types (i, b, f, o, t, e, p);");
+
+  int64_t const big = std::numeric_limits<int64_t>::max();
+  auto const now = time_point_cast<milliseconds>(system_clock::now());
+  c.execute("insert into Types values(?, ?, ?, ?, ?, ?, ?)", big, true, 0.5f,
+            std::optional<int>(), now, color::green, point{-3, 4});
+  c.execute("insert into Types values(?, ?, ?, ?, ?, ?, ?)", uint32_t(1) << 31,
+            false, 1.0, std::optional<std::string>("x"), seconds(90),
+            color::red, point{1, -2});
+
+  // Values are stored by native types without conversions
+  c.execute("select typeof(i), typeof(b), typeof(f), typeof(o), typeof(t) "
+            "from Types where rowid = 1");
+  auto [ti, tb, tf, to, tt] = c.begin()->to<std::string, std::string,
+                                            std::string, std::string,
+                                            std::string>();
+  EXPECT_EQ("integer", ti);
+  EXPECT_EQ("integer", tb);
+  EXPECT_EQ("real", tf);
+  EXPECT_EQ("null", to);
+  EXPECT_EQ("integer", tt);
+
+  c.execute("select * from Types where rowid = 1");
+  auto [i, b, f, o, t, e, p] =
+      c.begin()->to<int64_t, bool, float, std::optional<int>, clock_ms, color,
+                    point>();
+  EXPECT_EQ(big, i);
+  EXPECT_TRUE(b);
+  EXPECT_EQ(0.5f, f);
+  EXPECT_FALSE(o.has_value());
+  EXPECT_EQ(now, t);
+  EXPECT_EQ(color::green, e);
+  EXPECT_EQ(-3, p.x);
+  EXPECT_EQ(4, p.y);
+
+  c.execute("select i, b, o, t, e, p from Types where rowid = 2");
+  auto [u, b2, os, d, e2, p2] =
+      c.begin()->to<uint32_t, bool, std::optional<std::string>, seconds,
+                    color, point>();
+  EXPECT_EQ(uint32_t(1) << 31, u);
+  EXPECT_FALSE(b2);
+  EXPECT_EQ("x", os.value());
+  EXPECT_EQ(seconds(90), d);
+  EXPECT_EQ(color::red, e2);
+  EXPECT_EQ(1, p2.x);
+  EXPECT_EQ(-2, p2.y);
+
+  // Null text no longer stops reading the following columns
+  c.execute("select NULL, 7");
+  auto [null_s, seven] = c.begin()->to<std::string, int>();
+  EXPECT_EQ("", null_s);
+  EXPECT_EQ(7, seven);
+
+  auto &db = basic_dataset();
+  db.create_scalar("or_default", [](std::optional<double> v, float def) {
+    return v ? *v : def;
+  });
+  db.create_scalar("flip", [](bool v) { return !v; });
+  db.create_scalar("maybe", [](int64_t v) {
+    return v ? std::optional<int64_t>(v) : std::nullopt;
+  });
+  db.create_scalar("mirror", [](point p) { return point{p.y, p.x}; });
+
+  c.execute("select or_default(NULL, 1.5), or_default(2, 1.5), flip(0), "
+            "maybe(0) is NULL, maybe(?), mirror(p) from Types where rowid = 1",
+            big);
+  auto [d1, d2, fl, is_null, m, mp] =
+      c.begin()->to<double, double, bool, bool, int64_t, point>();
+  EXPECT_EQ(1.5, d1);
+  EXPECT_EQ(2.0, d2);
+  EXPECT_TRUE(fl);
+  EXPECT_TRUE(is_null);
+  EXPECT_EQ(big, m);
+  EXPECT_EQ(4, mp.x);
+  EXPECT_EQ(-3, mp.y);
+}
+
+namespace {
+struct pattern {
+  pattern(std::string_view s) : m_s(s) { ++constructed; }
+  std::string m_s;
+  static inline int constructed = 0;
+};
+}  // namespace
+
+TEST_F(DBTest, create_scalar_aux) {
+  using namespace sqlite3cpp;
+  auto c = basic_dataset().make_cursor();
+
+  basic_dataset().create_scalar(
+      "has", [](aux<pattern> const &p, std::string_view s) {
+        return (int)(s.find(p->m_s) != std::string_view::npos);
+      });
+
+  pattern::constructed = 0;
+
+  // Constant argument: constructed once per run of the statement. NOTE that
+  // |execute().begin()| runs the first step twice, and auxdata is released
+  // on reset.
+  int matched = 0;
+  for (auto const &row : c.execute("select has('test', b) from T")) {
+    matched += std::get<0>(row.to<int>());
+  }
+  EXPECT_EQ(2, pattern::constructed);
+  EXPECT_EQ(3, matched);
+
+  // Variable argument: constructed per row (and per first step)
+  pattern::constructed = 0;
+  for (auto const &row : c.execute("select has(b, b) from T")) {
+    EXPECT_EQ(1, std::get<0>(row.to<int>()));
+  }
+  EXPECT_EQ(5, pattern::constructed);
+}
+
 TEST_F(DBTest, create_aggregate) {
   using namespace sqlite3cpp;
 
@@ -439,6 +611,48 @@ TEST_F(DBTest, error_handle) {
   }
 }
 
+TEST_F(DBTest, nothrow_api) {
+  using namespace sqlite3cpp;
+
+  auto c = basic_dataset().make_cursor();
+  c.executescript("create table U (k integer primary key)");
+
+  auto r = c.try_execute("insert into U values(?)", 1);
+  ASSERT_TRUE(r);
+  EXPECT_FALSE(*r);
+
+  r = c.try_execute("insert into U values(?)", 1);
+  EXPECT_FALSE(r);
+  EXPECT_EQ(SQLITE_CONSTRAINT, r.code() & 0xff);
+  EXPECT_STREQ("UNIQUE constraint failed: U.k", r.message());
+  EXPECT_THROW(r.value(), error);
+
+  // Prepared once and bound again
+  ASSERT_TRUE(c.try_bind(2));
+  EXPECT_TRUE(c.try_step());
+  ASSERT_TRUE(c.try_bind(2));
+  EXPECT_EQ(SQLITE_CONSTRAINT, c.try_step().code() & 0xff);
+  EXPECT_EQ(SQLITE_RANGE, c.try_bind(3, 4).code());
+
+  int sum = 0;
+  for (r = c.try_execute("select k from U where k > ?", 0); r && *r;
+       r = c.try_step()) {
+    auto cols = c.try_to<int>();
+    ASSERT_TRUE(cols);
+    sum += std::get<0>(*cols);
+  }
+  EXPECT_TRUE(r);
+  EXPECT_EQ(3, sum);
+
+  r = c.try_execute("invalid sql");
+  EXPECT_EQ(SQLITE_ERROR, r.code());
+  EXPECT_STREQ("near \"invalid\": syntax error", r.message());
+
+  cursor empty = basic_dataset().make_cursor();
+  EXPECT_EQ(SQLITE_MISUSE, empty.try_step().code());
+  EXPECT_EQ(SQLITE_MISUSE, empty.try_to<int>().code());
+}
+
 TEST_F(DBTest, throw_in_custom_function) {
   auto c = basic_dataset().make_cursor();
 
@@ -544,8 +758,1632 @@ TEST_F(DBTest, bad_alloc_in_aggregate) {
   }
 }
 
+TEST(checkpoint, background_checkpoint) {
+  using namespace sqlite3cpp;
+  std::remove("ckpt_test.db");
+  std::remove("ckpt_test.db-wal");
+  std::remove("ckpt_test.db-shm");
+  {
+    database db("ckpt_test.db");
+    db.executescript(
+        "pragma journal_mode=wal;"
+        "create table T (a INTEGER, b TEXT);");
+    sqlite3_busy_timeout(db.get(), 5000);
+
+    checkpoint_manager::params_t params;
+    params.wal_frames = 8;
+    params.interval = std::chrono::milliseconds(10);
+    checkpoint_manager ckpt(db, params);
+
+    for (int i = 0; i < 64; ++i)
+      db.execute("insert into T values(?, ?)", i, std::string(512, 'x'));
+
+    ckpt.checkpoint_now();
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (ckpt.metrics().frames_checkpointed == 0 &&
+           std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    auto m = ckpt.metrics();
+    EXPECT_LT(0u, m.checkpoints);
+    EXPECT_LT(0u, m.frames_checkpointed);
+    EXPECT_EQ(m.checkpoints, m.passive + m.restart + m.truncate);
+    EXPECT_LE(m.last_duration, m.max_duration);
+
+    auto [ac] = db.execute("pragma wal_autocheckpoint").begin()->to<int>();
+    EXPECT_EQ(0, ac) << "auto-checkpoint should be disabled";
+  }
+  std::remove("ckpt_test.db");
+}
+
+TEST(checkpoint, reject_memory_db) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  try {
+    checkpoint_manager ckpt(db);
+    FAIL() << "Expect throw";
+  } catch (error const &e) {
+    EXPECT_EQ(SQLITE_MISUSE, e.code);
+  }
+}
+
+TEST(busy, backoff_policy) {
+  using namespace sqlite3cpp;
+  using namespace std::chrono;
+  std::remove("busy_test.db");
+  {
+    database locker("busy_test.db");
+    database db("busy_test.db");
+    locker.executescript("create table T (a INTEGER);");
+
+    backoff_policy::params_t params;
+    params.deadline = milliseconds(30);
+    db.set_busy_policy(backoff_policy(params));
+
+    locker.executescript("begin immediate;");
+    try {
+      db.execute("insert into T values(1)");
+      FAIL() << "Expect throw";
+    } catch (error const &e) {
+      EXPECT_EQ(SQLITE_BUSY, e.code);
+    }
+
+    auto stats = db.busy_statistics();
+    EXPECT_EQ(1u, stats.episodes);
+    EXPECT_EQ(1u, stats.timeouts);
+    EXPECT_LT(0u, stats.retries);
+    EXPECT_LE(milliseconds(30), stats.max_wait);
+
+    // |db| holds a shared lock for a moment while it tries to
+    // write, which the commit of |locker| has to wait for.
+    sqlite3_busy_timeout(locker.get(), 5000);
+    params.deadline = seconds(5);
+    db.set_busy_policy(backoff_policy(params));
+    std::thread release([&locker] {
+      std::this_thread::sleep_for(milliseconds(20));
+      locker.executescript("commit;");
+    });
+    db.execute("insert into T values(1)");
+    release.join();
+
+    stats = db.busy_statistics();
+    EXPECT_EQ(2u, stats.episodes);
+    EXPECT_EQ(1u, stats.timeouts);
+    uint64_t waits = 0;
+    for (auto n : stats.wait_histogram) waits += n;
+    EXPECT_EQ(2u, waits);
+  }
+  std::remove("busy_test.db");
+}
+
+TEST(write_queue, group_commit) {
+  using namespace sqlite3cpp;
+  std::remove("wq_test.db");
+  {
+    write_queue::params_t params;
+    params.max_batch = 64;
+    params.max_latency = std::chrono::milliseconds(5);
+    params.init = [](database &db) {
+      db.executescript("create table T (a INTEGER, b TEXT);");
+    };
+    write_queue wq("wq_test.db", params);
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t) {
+      producers.emplace_back([&wq, t] {
+        std::vector<std::future<void>> done;
+        for (int i = 0; i < 50; ++i)
+          done.push_back(wq.execute("insert into T values(?, ?)", t, "text"));
+        for (auto &f : done) f.get();
+      });
+    }
+    for (auto &p : producers) p.join();
+
+    auto bad = wq.submit([](database &db) {
+      db.execute("insert into T values(?, ?)", -1, "rollback");
+      db.execute("invalid sql");
+    });
+    auto good = wq.execute("insert into T values(?, ?)", -2, std::string("ok"));
+    EXPECT_THROW(bad.get(), error);
+    EXPECT_NO_THROW(good.get());
+
+    auto s = wq.stats();
+    EXPECT_EQ(202u, s.jobs);
+    EXPECT_EQ(1u, s.failed_jobs);
+    EXPECT_GE(s.jobs, s.batches);
+    EXPECT_LE(s.max_batch, 64u);
+  }
+
+  database db("wq_test.db");
+  auto [cnt] = db.execute("select count(*) from T").begin()->to<int>();
+  EXPECT_EQ(201, cnt);
+  auto [neg] = db.execute("select count(*) from T where a = -1")
+                   .begin()
+                   ->to<int>();
+  EXPECT_EQ(0, neg);
+  std::remove("wq_test.db");
+}
+
+TEST_F(DBTest, change_listener) {
+  using namespace sqlite3cpp;
+  std::vector<std::string> log;
+  change_listener l;
+  l.update = [&log](int op, char const *, char const *table,
+                    sqlite3_int64 rowid) {
+    log.push_back(std::string(table) + ":" + std::to_string(op) + ":" +
+                  std::to_string(rowid));
+  };
+  l.commit = [&log] { log.push_back("commit"); };
+  int id = basic_dataset().add_change_listener(l);
+  int id2 = basic_dataset().add_change_listener(l);
+
+  basic_dataset().execute("insert into InsTest values(1, 'x')");
+  basic_dataset().remove_change_listener(id2);
+  basic_dataset().execute("delete from InsTest where a = 1");
+  basic_dataset().remove_change_listener(id);
+  basic_dataset().execute("insert into InsTest values(1, 'x')");
+
+  std::vector<std::string> expected = {
+      "InsTest:18:1", "InsTest:18:1", "commit", "commit",
+      "InsTest:9:1",  "commit"};
+  EXPECT_EQ(expected, log);
+}
+
+TEST_F(DBTest, change_stream) {
+  using namespace sqlite3cpp;
+  change_stream cs(basic_dataset());
+  std::vector<change_event> events;
+  cs.subscribe([&events](change_event const &e) { events.push_back(e); });
+
+  basic_dataset().executescript(
+      "begin;"
+      "insert into InsTest values(1, 'a');"
+      "insert into InsTest values(2, 'b');"
+      "update InsTest set b = 'c' where a = 1;");
+  EXPECT_EQ(0u, cs.poll()) << "uncommitted changes must not be published";
+  basic_dataset().executescript("commit;");
+
+  basic_dataset().executescript(
+      "begin;"
+      "delete from InsTest;"
+      "rollback;");
+
+  EXPECT_EQ(3u, cs.poll());
+  ASSERT_EQ(3u, events.size());
+  EXPECT_EQ(change_event::insert, events[0].op);
+  EXPECT_EQ(change_event::insert, events[1].op);
+  EXPECT_EQ(change_event::update, events[2].op);
+  EXPECT_EQ("InsTest", events[2].table);
+  EXPECT_EQ(1, events[2].rowid);
+  EXPECT_EQ(events[0].txn, events[2].txn);
+  EXPECT_EQ(0u, cs.poll());
+}
+
+TEST_F(DBTest, change_stream_overflow) {
+  using namespace sqlite3cpp;
+  change_stream::params_t params;
+  params.capacity = 2;
+  change_stream cs(basic_dataset(), params);
+  std::vector<change_event::op_t> ops;
+  cs.subscribe([&ops](change_event const &e) { ops.push_back(e.op); });
+
+  basic_dataset().executescript(
+      "begin;"
+      "insert into InsTest values(1, 'a');"
+      "insert into InsTest values(2, 'b');"
+      "insert into InsTest values(3, 'c');"
+      "commit;");
+  EXPECT_EQ(1u, cs.dropped());
+  EXPECT_EQ(2u, cs.poll());
+
+  basic_dataset().execute("delete from InsTest where a = 1");
+  EXPECT_EQ(2u, cs.poll());
+  std::vector<change_event::op_t> expected = {
+      change_event::insert, change_event::insert, change_event::overflow,
+      change_event::remove};
+  EXPECT_EQ(expected, ops);
+}
+
+TEST(change_stream, failed_commit) {
+  using namespace sqlite3cpp;
+  std::remove("cs_test.db");
+  {
+    database db("cs_test.db");
+    database reader("cs_test.db");
+    db.executescript("create table T (a INTEGER)");
+    change_stream cs(db);
+    size_t delivered = 0;
+    cs.subscribe([&](change_event const &) {
+      // Subscribing from a subscriber must not deadlock
+      if (!delivered++) cs.subscribe([](change_event const &) {});
+    });
+
+    // A shared lock of |reader| fails the COMMIT after the commit hook
+    std::optional<cursor> csr(reader.make_cursor());
+    csr->execute("select 1 from sqlite_master").begin();
+    db.executescript("begin; insert into T values(1);");
+    EXPECT_THROW(db.executescript("commit"), error);
+    EXPECT_EQ(0u, cs.poll());
+    db.executescript("rollback");
+    EXPECT_EQ(0u, cs.poll());
+
+    // Retried COMMIT publishes changes once
+    db.executescript("begin; insert into T values(2);");
+    EXPECT_THROW(db.executescript("commit"), error);
+    db.execute("insert into T values(3)");
+    csr.reset();
+    db.executescript("commit");
+    EXPECT_EQ(2u, cs.poll());
+    EXPECT_EQ(2u, delivered);
+
+    db.execute("insert into T values(4)");
+    EXPECT_EQ(1u, cs.poll());
+    auto [n] = db.execute("select count(*) from T").begin()->to<int>();
+    EXPECT_EQ(3, n);
+  }
+  std::remove("cs_test.db");
+}
+
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+TEST_F(DBTest, change_stream_values) {
+  using namespace sqlite3cpp;
+  change_stream::params_t params;
+  params.capture_values = true;
+  change_stream cs(basic_dataset(), params);
+  std::vector<change_event> events;
+  cs.subscribe([&events](change_event const &e) { events.push_back(e); });
+
+  basic_dataset().execute("update T set b = 'new' where b = 'abc'");
+  ASSERT_EQ(1u, cs.poll());
+  auto const &e = events[0];
+  EXPECT_EQ(change_event::update, e.op);
+  EXPECT_EQ(3, e.rowid);
+  ASSERT_EQ(2u, e.old_values.size());
+  ASSERT_EQ(2u, e.new_values.size());
+  EXPECT_EQ(change_value(int64_t(2)), e.old_values[0]);
+  EXPECT_EQ(change_value(std::string("abc")), e.old_values[1]);
+  EXPECT_EQ(change_value(std::string("new")), e.new_values[1]);
+}
+#endif
+
+TEST_F(DBTest, query_cache) {
+  using namespace sqlite3cpp;
+  query_cache cache(basic_dataset());
+  char const *query = "select a, b from T where a > ? order by a";
+
+  auto r1 = cache.query(query, 1);
+  auto r2 = cache.query(query, 1);
+  EXPECT_EQ(r1, r2);
+  ASSERT_EQ(3u, r1->size());
+  auto [a, b] = r1->at(0).to<int, std::string_view>();
+  EXPECT_EQ(2, a);
+  EXPECT_EQ("test2", b);
+
+  auto r3 = cache.query(query, 2);
+  EXPECT_NE(r1, r3);
+  EXPECT_EQ(1u, r3->size());
+
+  // Changes of an unrelated table keep results
+  basic_dataset().execute("insert into InsTest values(1, 'x')");
+  EXPECT_EQ(r1, cache.query(query, 1));
+
+  // Changes of a dependent table invalidate results
+  basic_dataset().execute("insert into T values(4, null)");
+  auto r4 = cache.query(query, 1);
+  EXPECT_NE(r1, r4);
+  ASSERT_EQ(4u, r4->size());
+  auto [d, c] = r4->at(3).to<int, std::optional<std::string>>();
+  EXPECT_EQ(4, d);
+  EXPECT_FALSE(c.has_value());
+  EXPECT_TRUE(r4->at(3).is_null(1));
+
+  auto s = cache.stats();
+  EXPECT_EQ(2u, s.hits);
+  EXPECT_EQ(3u, s.misses);
+  EXPECT_EQ(1u, s.invalidations);
+  EXPECT_DOUBLE_EQ(0.4, s.hit_rate());
+
+  EXPECT_THROW(cache.query("delete from T"), error);
+}
+
+TEST(query_cache, external_change_and_budget) {
+  using namespace sqlite3cpp;
+  std::remove("qc_test.db");
+  {
+    database db("qc_test.db");
+    database other("qc_test.db");
+    db.executescript(
+        "create table T (a INTEGER);"
+        "insert into T values(1);");
+
+    query_cache::params_t params;
+    params.memory_budget = 1024;
+    query_cache cache(db, params);
+
+    auto r1 = cache.query("select a from T");
+    EXPECT_EQ(r1, cache.query("select a from T"));
+    other.execute("insert into T values(2)");
+    auto r2 = cache.query("select a from T");
+    EXPECT_NE(r1, r2);
+    EXPECT_EQ(2u, r2->size());
+
+    for (int i = 0; i < 32; ++i) cache.query("select a + ? from T", i);
+    auto s = cache.stats();
+    EXPECT_LE(s.memory, params.memory_budget);
+    EXPECT_LT(0u, s.evictions);
+  }
+  std::remove("qc_test.db");
+}
+
+TEST_F(DBTest, query_cache_rollback) {
+  using namespace sqlite3cpp;
+  query_cache cache(basic_dataset());
+  char const *query = "select count(*) from T";
+  auto count = [&] {
+    auto [n] = cache.query(query)->at(0).to<int>();
+    return n;
+  };
+
+  EXPECT_EQ(4, count());
+  basic_dataset().executescript("begin; insert into T values(4, 'x');");
+  EXPECT_EQ(5, count());
+  EXPECT_EQ(5, count());
+  basic_dataset().executescript(
+      "savepoint s; insert into T values(5, 'y'); rollback to s;");
+  EXPECT_EQ(5, count());
+  basic_dataset().executescript("rollback");
+  EXPECT_EQ(4, count());
+  EXPECT_EQ(4, count());
+  EXPECT_EQ(1u, cache.stats().hits);
+}
+
+TEST_F(DBTest, query_cache_authorizer) {
+  using namespace sqlite3cpp;
+  int id = basic_dataset().add_authorizer(
+      [](int action, char const *table, char const *, char const *,
+         char const *) {
+        bool secret = action == SQLITE_READ && table &&
+                      std::string_view(table) == "AllTypes";
+        return secret ? SQLITE_DENY : SQLITE_OK;
+      });
+
+  query_cache cache(basic_dataset());
+  EXPECT_THROW(cache.query("select * from AllTypes"), error);
+  auto r1 = cache.query("select count(*) from T");
+  EXPECT_EQ(r1, cache.query("select count(*) from T"));
+  basic_dataset().execute("insert into T values(9, 'x')");
+  EXPECT_NE(r1, cache.query("select count(*) from T"));
+
+  // The authorizer of the application outlives queries of the cache
+  EXPECT_THROW(basic_dataset().execute("select * from AllTypes"), error);
+  basic_dataset().remove_authorizer(id);
+  basic_dataset().execute("select * from AllTypes");
+}
+
+TEST_F(DBTest, query_cache_keeps_statements) {
+  using namespace sqlite3cpp;
+  auto &db = basic_dataset();
+  query_cache cache(db);
+
+  sqlite3_stmt *raw = nullptr;
+  ASSERT_EQ(SQLITE_OK,
+            sqlite3_prepare_v2(db.get(), "select count(*) from T", -1, &raw,
+                               nullptr));
+  std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> stmt(raw);
+  auto run = [&] {
+    EXPECT_EQ(SQLITE_ROW, sqlite3_step(raw));
+    sqlite3_reset(raw);
+  };
+
+  run();
+  // Misses of the cache do not expire statements of the application
+  for (int i = 0; i < 5; ++i) cache.query("select a from T where a > ?", i);
+  run();
+  EXPECT_EQ(0, sqlite3_stmt_status(raw, SQLITE_STMTSTATUS_REPREPARE, 0));
+  EXPECT_EQ(5u, cache.stats().misses);
+}
+
+TEST_F(DBTest, query_cache_type_traits) {
+  using namespace sqlite3cpp;
+  using namespace std::chrono;
+  auto &db = basic_dataset();
+  db.executescript("create table Shapes (p, c, d);");
+  db.execute("insert into Shapes values(?, ?, ?)", point{-3, 4}, color::green,
+             seconds(90));
+  db.execute("insert into Shapes values(?, ?, ?)", point{1, -2}, color::red,
+             seconds(5));
+
+  query_cache::result_ptr res;
+  {
+    query_cache cache(db);
+    char const *query = "select p, c, d from Shapes where p = ?";
+    res = cache.query(query, point{1, -2});
+    EXPECT_EQ(res, cache.query(query, point{1, -2}));
+    EXPECT_NE(res, cache.query(query, point{-3, 4}));
+    EXPECT_EQ(1u, cache.stats().hits);
+
+    // Keyed by the bound value, e.g. enums as their underlying type
+    auto r1 = cache.query("select count(*) from Shapes where c = ?",
+                          color::red);
+    EXPECT_EQ(r1, cache.query("select count(*) from Shapes where c = ?",
+                              (int)color::red));
+    auto r2 = cache.query("select p from Shapes where d > ?", seconds(10));
+    EXPECT_EQ(r2, cache.query("select p from Shapes where d > ?", 10));
+    auto [p2] = r2->at(0).to<std::optional<point>>();
+    EXPECT_EQ(-3, p2->x);
+    EXPECT_EQ(4, p2->y);
+  }
+
+  // Results outlive the cache
+  ASSERT_EQ(1u, res->size());
+  auto [p, c, d] = res->at(0).to<point, color, seconds>();
+  EXPECT_EQ(1, p.x);
+  EXPECT_EQ(-2, p.y);
+  EXPECT_EQ(color::red, c);
+  EXPECT_EQ(seconds(5), d);
+}
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+TEST(session, replicate_changesets) {
+  using namespace sqlite3cpp;
+  char const *schema = "create table T (id INTEGER PRIMARY KEY, v TEXT);";
+  database edge(":memory:");
+  database central(":memory:");
+  edge.executescript(schema);
+  central.executescript(schema);
+  central.execute("insert into T values(5, 'central')");
+
+  session s(edge);
+  EXPECT_TRUE(s.empty());
+  std::vector<changeset> batch;
+
+  edge.executescript(
+      "begin;"
+      "insert into T values(1, 'a');"
+      "insert into T values(2, 'b');"
+      "commit;");
+  batch.push_back(s.take_changeset());
+  EXPECT_TRUE(s.empty());
+
+  edge.executescript(
+      "begin;"
+      "update T set v = 'c' where id = 1;"
+      "delete from T where id = 2;"
+      "insert into T values(5, 'edge');"
+      "commit;");
+  batch.push_back(s.take_changeset());
+
+  int conflicts = 0;
+  apply_changesets(central, batch,
+                   [&conflicts](changeset_conflict const &c) {
+                     ++conflicts;
+                     EXPECT_EQ(SQLITE_CHANGESET_CONFLICT, c.type);
+                     EXPECT_EQ(SQLITE_INSERT, c.op);
+                     EXPECT_STREQ("T", c.table);
+                     return conflict_action::replace;
+                   });
+  EXPECT_EQ(1, conflicts);
+
+  std::vector<std::pair<int, std::string>> rows;
+  for (auto const &row : central.execute("select id, v from T order by id")) {
+    auto [id, v] = row.to<int, std::string>();
+    rows.emplace_back(id, v);
+  }
+  std::vector<std::pair<int, std::string>> expected = {{1, "c"}, {5, "edge"}};
+  EXPECT_EQ(expected, rows);
+
+  // An aborted batch leaves the target untouched
+  edge.execute("insert into T values(7, 'x')");
+  central.execute("insert into T values(7, 'y')");
+  EXPECT_THROW(apply_changesets(central, {s.take_changeset()},
+                                [](changeset_conflict const &) {
+                                  return conflict_action::abort;
+                                }),
+               error);
+  auto [v] = central.execute("select v from T where id = 7")
+                 .begin()
+                 ->to<std::string>();
+  EXPECT_EQ("y", v);
+}
+
+TEST(session, change_stream) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  db.executescript("create table T (id INTEGER PRIMARY KEY, v TEXT);");
+  change_stream::params_t params;
+  params.capture_values = true;
+
+  // Sessions and streams capturing values share the pre-update hook
+  {
+    change_stream cs(db, params);
+    EXPECT_THROW(session s(db), error);
+  }
+  {
+    session s(db);
+    EXPECT_THROW(change_stream cs(db, params), error);
+    s.take_changeset();
+    EXPECT_THROW(change_stream cs(db, params), error);
+  }
+
+  // Streams without values do not
+  {
+    session s(db);
+    change_stream cs(db);
+    db.executescript(
+        "begin;"
+        "insert into T values(1, 'a');"
+        "insert into T values(2, 'b');"
+        "commit;");
+    EXPECT_EQ(2u, cs.poll());
+    EXPECT_FALSE(s.empty());
+  }
+
+  // Streams capturing values share the hook with each other
+  change_stream cs1(db, params);
+  change_stream cs2(db, params);
+  std::vector<change_event> events;
+  cs2.subscribe([&events](change_event const &e) { events.push_back(e); });
+  db.execute("update T set v = 'c' where id = 1");
+  EXPECT_EQ(1u, cs1.poll());
+  ASSERT_EQ(1u, cs2.poll());
+  ASSERT_EQ(2u, events[0].new_values.size());
+  EXPECT_EQ(change_value(std::string("c")), events[0].new_values[1]);
+}
+#endif
+
+TEST_F(DBTest, query_limits) {
+  using namespace sqlite3cpp;
+  using namespace std::chrono;
+  char const *endless =
+      "with recursive C(x) as (select 1 union all select x + 1 from C) "
+      "select count(*) from C";
+
+  auto c = basic_dataset().make_cursor();
+  cursor::limits_t limits;
+  limits.deadline = steady_clock::now() + milliseconds(20);
+  c.set_limits(limits);
+  try {
+    c.execute(endless);
+    FAIL() << "Expect throw";
+  } catch (interrupted const &e) {
+    EXPECT_EQ(interrupted::deadline, e.reason);
+    EXPECT_EQ(SQLITE_INTERRUPT, e.code);
+  }
+
+  cancellation_token token;
+  limits = {};
+  limits.token = token;
+  c.set_limits(limits);
+  std::thread canceller([token] {
+    std::this_thread::sleep_for(milliseconds(20));
+    token.cancel();
+  });
+  try {
+    c.execute(endless);
+    FAIL() << "Expect throw";
+  } catch (interrupted const &e) {
+    EXPECT_EQ(interrupted::cancelled, e.reason);
+  }
+  canceller.join();
+
+  // Cancelled token stops iteration before stepping
+  int rows = 0;
+  try {
+    for (auto const &row : c.execute("select 1")) {
+      (void)row;
+      ++rows;
+    }
+    FAIL() << "Expect throw";
+  } catch (interrupted const &e) {
+    EXPECT_EQ(interrupted::cancelled, e.reason);
+  }
+  EXPECT_EQ(0, rows);
+
+  c.clear_limits();
+  auto [cnt] = c.execute("select count(*) from T").begin()->to<int>();
+  EXPECT_EQ(4, cnt);
+
+  std::thread interrupter([this] {
+    std::this_thread::sleep_for(milliseconds(20));
+    basic_dataset().interrupt();
+  });
+  try {
+    c.execute(endless);
+    FAIL() << "Expect throw";
+  } catch (interrupted const &e) {
+    EXPECT_EQ(interrupted::interrupt, e.reason);
+  }
+  interrupter.join();
+}
+
+TEST_F(DBTest, create_collation) {
+  using namespace sqlite3cpp;
+  auto c = basic_dataset().make_cursor();
+
+  basic_dataset().create_collation(
+      "reverse",
+      [](std::string_view l, std::string_view r) { return r.compare(l); });
+
+  std::vector<std::string> names;
+  for (auto const &row : c.execute("select b from T order by b collate "
+                                   "reverse")) {
+    names.push_back(std::get<0>(row.to<std::string>()));
+  }
+  std::vector<std::string> expected = {"test3", "test2", "test1", "abc"};
+  EXPECT_EQ(expected, names);
+
+  // Empty comparator removes the collation
+  basic_dataset().create_collation("reverse", {});
+  EXPECT_THROW(c.execute("select b from T order by b collate reverse"), error);
+}
+
+TEST(script, run) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+
+  // Statements 1 and 2 can not be prepared before statement 0 runs
+  script job(db,
+             "create table if not exists Log (ts int, msg text);\n"
+             "insert into Log values(?, ?);\n"
+             "delete from Log where ts < ?;\n"
+             "select * from Log;\n"
+             "-- trailing comment");
+  ASSERT_EQ(4, job.size());
+  EXPECT_NE(nullptr, job.get(0));
+  EXPECT_EQ(nullptr, job.get(1));
+
+  job.bind(1, 10, std::string("first")).bind(2, 0);
+  job.run();
+  EXPECT_NE(nullptr, job.get(1));
+
+  // Bindings stay for later runs until bound again
+  job.run();
+  job.bind(1, 20, "second").bind(2, 15);
+  job.run();
+
+  auto c = db.make_cursor();
+  std::vector<std::tuple<int, std::string>> rows;
+  for (auto const &row : c.execute("select ts, msg from Log")) {
+    rows.push_back(row.to<int, std::string>());
+  }
+  std::vector<std::tuple<int, std::string>> expected = {{20, "second"}};
+  EXPECT_EQ(expected, rows);
+
+  auto stats = job.stats();
+  ASSERT_EQ(4, stats.size());
+  EXPECT_EQ("delete from Log where ts < ?;", stats[2].sql);
+  for (auto const &s : stats) {
+    EXPECT_EQ(3, s.runs);
+    EXPECT_LE(s.last, s.max);
+    EXPECT_LE(s.max, s.total);
+  }
+
+  EXPECT_THROW(job.bind(4, 1), error);
+
+  // Failing statement stops the script
+  script bad(db,
+             "insert into Log values(1, 'x'); insert into Nowhere values(1);");
+  EXPECT_THROW(bad.run(), error);
+  EXPECT_EQ(1, bad.stats()[0].runs);
+}
+
+TEST(pager, keyset_pages) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  db.executescript(
+      "create table U (id integer primary key, name text, org int);"
+      "create index U_name on U(name, id);"
+      "with recursive n(i) as (select 1 union all select i + 1 from n "
+      "  where i < 250) "
+      "insert into U select i, 'n' || (i % 7), i % 2 from n;");
+
+  keyset_pager::params_t params;
+  params.page_size = 20;
+  keyset_pager pager(db, "select name, id from U where org = ?",
+                     {"name", "id"}, params);
+
+  // Pages cover all rows once and in order of the keys
+  std::vector<std::tuple<std::string, int64_t>> all;
+  std::string token;
+  size_t pages = 0;
+  do {
+    auto page = pager.fetch<std::string, int64_t>(token, 1);
+    EXPECT_FALSE(page.rows.empty());
+    all.insert(all.end(), page.rows.begin(), page.rows.end());
+    token = page.next;
+    ++pages;
+  } while (!token.empty());
+  EXPECT_EQ(125u, all.size());
+  EXPECT_EQ(7u, pages);
+  EXPECT_TRUE(std::is_sorted(all.begin(), all.end()));
+  EXPECT_EQ(all.end(), std::adjacent_find(all.begin(), all.end()));
+
+  // Rows inserted before the token do not shift the next page
+  auto first = pager.fetch<std::string, int64_t>("", 1);
+  auto second = pager.fetch<std::string, int64_t>(first.next, 1);
+  db.execute("insert into U values(1000, 'a', 1)");
+  auto again = pager.fetch<std::string, int64_t>(first.next, 1);
+  EXPECT_EQ(second.rows, again.rows);
+
+  // Descending order
+  params.descending = true;
+  keyset_pager desc(db, "select id from U", {"id"}, params);
+  auto d1 = desc.fetch<int64_t>("");
+  auto d2 = desc.fetch<int64_t>(d1.next);
+  EXPECT_EQ(1000, std::get<0>(d1.rows.front()));
+  EXPECT_EQ(231, std::get<0>(d2.rows.front()));
+
+  // Tokens of other pagers and malformed ones are rejected
+  try {
+    desc.fetch<int64_t>(first.next);
+    ADD_FAILURE();
+  } catch (error const &e) {
+    EXPECT_EQ(SQLITE_MISMATCH, e.code);
+  }
+  EXPECT_THROW(pager.fetch<std::string>("!!"), error);
+  EXPECT_THROW(keyset_pager(db, "select id from U", {"nope"}), error);
+}
+
+TEST(prefetch, batches_and_errors) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  db.executescript(
+      "create table T (a INTEGER, b TEXT);"
+      "with recursive n(i) as (select 0 union all select i + 1 from n "
+      "  where i < 999) "
+      "insert into T select i, 'v' || i from n;");
+
+  prefetch<int, std::string>::params_t params;
+  params.batch_rows = 16;
+  params.batches = 2;
+
+  auto c = db.make_cursor();
+  c.execute("select a, b from T order by a");
+  {
+    // Rows come in order, and from the first one
+    prefetch<int, std::string> rows(c, params);
+    int expected = 0;
+    for (auto const &[a, b] : rows) {
+      EXPECT_EQ(expected, a);
+      EXPECT_EQ("v" + std::to_string(a), b);
+      ++expected;
+    }
+    EXPECT_EQ(1000, expected);
+    EXPECT_EQ(1000u, rows.stats().rows);
+    EXPECT_EQ(63u, rows.stats().batches);
+  }
+
+  // Stopping early releases the statement
+  {
+    prefetch<int, std::string> rows(c, params);
+    auto i = rows.begin();
+    EXPECT_EQ(0, std::get<0>(*i));
+  }
+  EXPECT_EQ(0, sqlite3_stmt_busy(c.get()));
+  db.execute("drop table T");
+
+  // Errors are raised after preceding rows are consumed
+  db.create_scalar("fail_at", [](int i, int at) {
+    if (i == at) throw std::runtime_error("fail");
+    return i;
+  });
+  c.execute(
+      "with recursive n(i) as (select 0 union all select i + 1 from n "
+      "  where i < 99) "
+      "select fail_at(i, 50) from n");
+  prefetch<int64_t> rows(c, prefetch<int64_t>::params_t{8, 2});
+  int64_t sum = 0;
+  EXPECT_THROW(
+      {
+        for (auto const &[v] : rows) sum += v;
+      },
+      error);
+  EXPECT_EQ(49 * 50 / 2, sum);
+}
+
+TEST(parallel_scan, reduce) {
+  using namespace sqlite3cpp;
+  std::remove("scan_test.db");
+  std::remove("scan_test.db-wal");
+  std::remove("scan_test.db-shm");
+  {
+    database db("scan_test.db");
+    db.executescript(
+        "pragma journal_mode=wal;"
+        "create table T (id integer primary key, v int);");
+    {
+      transaction trns(db);
+      for (int i = 0; i < 10000; ++i)
+        db.execute("insert into T values(? * 7 - 3500, ?)", i, i % 100);
+      db.executescript(
+          "insert into T values(9223372036854775807, 1);"
+          "insert into T values(-9223372036854775807 - 1, 1);");
+      trns.commit();
+    }
+
+    parallel_scan::params_t params;
+    params.threads = 4;
+    parallel_scan scan(db, "T", params);
+    EXPECT_LE(1u, scan.concurrency());
+
+    // Commits after the scan started are not seen
+    database writer("scan_test.db");
+    std::once_flag write_once;
+
+    using acc_t = std::pair<int64_t, int64_t>;
+    auto [cnt, sum] = scan.reduce(
+        "select v from T where id between ?1 and ?2", acc_t{0, 0},
+        [&](acc_t &acc, row const &r) {
+          std::call_once(write_once, [&writer] {
+            writer.execute("insert into T values(null, 1000)");
+          });
+          auto [v] = r.to<int>();
+          acc.first += 1;
+          acc.second += v;
+        },
+        [](acc_t &acc, acc_t partial) {
+          acc.first += partial.first;
+          acc.second += partial.second;
+        });
+    EXPECT_EQ(10002, cnt);
+    EXPECT_EQ(495002, sum);
+
+    auto [now] = db.execute("select count(*) from T").begin()->to<int>();
+    EXPECT_EQ(10003, now);
+
+    // Errors of the query are raised
+    EXPECT_THROW(scan.reduce(
+                     "select nope from T where id between ?1 and ?2", 0,
+                     [](int &, row const &) {}, [](int &, int) {}),
+                 error);
+
+    // Table names are quoted
+    db.executescript(
+        "create table \"order a\"\"b\" (v int);"
+        "insert into \"order a\"\"b\" values(1), (2), (3);");
+    parallel_scan odd(db, "order a\"b", params);
+    auto n = odd.reduce(
+        "select v from \"order a\"\"b\" where rowid between ?1 and ?2", 0,
+        [](int &acc, row const &r) { acc += std::get<0>(r.to<int>()); },
+        [](int &acc, int partial) { acc += partial; });
+    EXPECT_EQ(6, n);
+  }
+  std::remove("scan_test.db");
+  std::remove("scan_test.db-wal");
+  std::remove("scan_test.db-shm");
+}
+
+TEST(io_stats, vfs_shim) {
+  using namespace sqlite3cpp;
+  std::remove("io_test.db");
+  std::remove("io_test.db-wal");
+  std::remove("io_test.db-shm");
+  {
+    io_stats_vfs vfs("iostats_test");
+    EXPECT_THROW(io_stats_vfs("iostats_test"), error);
+    EXPECT_THROW(io_stats_vfs("x", "no such vfs"), error);
+
+    database db("io_test.db", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                vfs.name());
+    db.executescript(
+        "pragma journal_mode=wal;"
+        "create table T (a int);"
+        "insert into T values(1);");
+    auto [cnt] = db.execute("select count(*) from T").begin()->to<int>();
+    EXPECT_EQ(1, cnt);
+
+    auto stats = vfs.stats();
+    auto const &wal_write = stats.get(io_file_type::wal, io_op::write);
+    EXPECT_LT(0u, wal_write.count);
+    EXPECT_LT(0u, wal_write.bytes);
+    EXPECT_LE(wal_write.percentile(0.5), wal_write.max);
+    EXPECT_LT(0u, stats.get(io_file_type::wal, io_op::sync).count);
+    EXPECT_LT(0u, stats.get(io_file_type::main_db, io_op::read).count);
+    EXPECT_LT(0u, stats.get(io_file_type::main_db, io_op::lock).count);
+    EXPECT_LT(0u, stats.get(io_file_type::main_db, io_op::shm_lock).count);
+
+    auto json = stats.to_json();
+    EXPECT_NE(std::string::npos, json.find("\"wal\":{"));
+    EXPECT_NE(std::string::npos, json.find("\"sync\":{\"count\":"));
+
+    vfs.reset();
+    EXPECT_EQ("{}", vfs.stats().to_json());
+
+    EXPECT_THROW(database("io_test.db", SQLITE_OPEN_READWRITE, "no such vfs"),
+                 error);
+  }
+  std::remove("io_test.db");
+  std::remove("io_test.db-wal");
+  std::remove("io_test.db-shm");
+}
+
+TEST(slow_query, plans_and_hints) {
+  using namespace sqlite3cpp;
+  std::remove("slow_test.jsonl");
+  std::remove("slow_test.jsonl.1");
+
+  database db(":memory:");
+  db.executescript(
+      "create table A (x int, y int);"
+      "create table B (x int, z int);"
+      "with recursive n(i) as (select 1 union all select i + 1 from n "
+      "  where i < 500) "
+      "insert into A select i, i % 7 from n;"
+      "insert into B select x, y from A;");
+
+  std::vector<slow_query> seen;
+  slow_query_log::params_t params;
+  params.threshold = std::chrono::nanoseconds(0);
+  params.path = "slow_test.jsonl";
+  params.max_bytes = 1024;
+  params.max_files = 1;
+  params.on_slow = [&seen](slow_query const &q) { seen.push_back(q); };
+  {
+    slow_query_log log(db, params);
+
+    db.execute("select count(*) from A join B on A.x = B.x");
+    ASSERT_EQ(1u, seen.size());
+    EXPECT_EQ("select count(*) from A join B on A.x = B.x", seen[0].sql);
+    EXPECT_LT(0, seen[0].autoindex_rows);
+    EXPECT_FALSE(seen[0].plan.empty());
+    EXPECT_NE(seen[0].hints.end(),
+              std::find(seen[0].hints.begin(), seen[0].hints.end(),
+                        "create index on B(x)"));
+
+    db.execute("select y from A where x > ? order by y", 10);
+    ASSERT_EQ(2u, seen.size());
+    EXPECT_LT(0, seen[1].fullscan_steps);
+    EXPECT_LT(0, seen[1].sorts);
+    ASSERT_EQ(2u, seen[1].hints.size());
+    EXPECT_EQ(0u, seen[1].hints[0].find("full scan of A"));
+    EXPECT_EQ(0u, seen[1].hints[1].find("sort by temp b-tree for ORDER BY"));
+    EXPECT_EQ(2u, log.offenders());
+
+    // Counters are of the latest run only
+    auto c = db.make_cursor();
+    for (int i = 0; i < 3; ++i) c.execute("select sum(x) from A");
+    EXPECT_EQ(499, seen.back().fullscan_steps);
+  }
+
+  // Offenders are logged as JSON lines and the log is rotated
+  std::ifstream rotated("slow_test.jsonl.1");
+  std::string line;
+  ASSERT_TRUE(std::getline(rotated, line));
+  EXPECT_EQ(0u, line.find("{\"ts_ms\":"));
+  EXPECT_NE(std::string::npos, line.find("\"create index on B(x)\""));
+
+  // Removed with the log
+  size_t n = seen.size();
+  db.execute("select count(*) from A");
+  EXPECT_EQ(n, seen.size());
+
+  // Plans of statements with inlined literals are bounded
+  params.path.clear();
+  params.max_plans = 2;
+  {
+    slow_query_log log(db, params);
+    for (int i = 0; i < 5; ++i)
+      db.execute("select y from A where x = " + std::to_string(i));
+    EXPECT_EQ(2u, log.plans());
+    EXPECT_FALSE(seen.back().plan.empty());
+  }
+
+  std::remove("slow_test.jsonl");
+  std::remove("slow_test.jsonl.1");
+}
+
+TEST_F(DBTest, db_statistics) {
+  using namespace sqlite3cpp;
+
+  auto c = basic_dataset().make_cursor();
+  c.execute("select * from T");
+  auto st = basic_dataset().db_statistics();
+  EXPECT_LT(0, st.cache_used);
+  EXPECT_LT(0, st.schema_used);
+  EXPECT_LT(0, st.stmt_used);
+  EXPECT_LE(st.lookaside_used.current, st.lookaside_used.peak);
+
+  auto heap = heap_statistics();
+  EXPECT_LT(0, heap.memory_used.current);
+  EXPECT_LE(heap.memory_used.current, heap.memory_used.peak);
+  EXPECT_LT(0, heap.malloc_count.current);
+}
+
+TEST(maintenance, optimize_analyze_vacuum) {
+  using namespace sqlite3cpp;
+  std::remove("maint_test.db");
+  {
+    database db("maint_test.db");
+    db.executescript(
+        "pragma auto_vacuum=incremental;"
+        "create table T (a INTEGER, b BLOB);"
+        "create index T_a on T(a);"
+        "create table U (c TEXT);"
+        "create index U_c on U(c);");
+    {
+      transaction trns(db);
+      for (int i = 0; i < 200; ++i)
+        db.execute("insert into T values(?, zeroblob(4000))", i % 10);
+      db.execute("insert into U values('x')");
+      trns.commit();
+    }
+    db.execute("delete from T where a > 0");
+    auto [before] = db.execute("pragma freelist_count").begin()->to<int>();
+    EXPECT_LT(100, before);
+
+    maintenance_scheduler::params_t params;
+    params.optimize_interval = std::chrono::milliseconds(0);
+    params.vacuum_min_free_pages = 8;
+    params.vacuum_pages = 16;
+    params.quiet_period = std::chrono::milliseconds(10);
+    maintenance_scheduler upkeep(db, params);
+    upkeep.run_now();
+
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    auto m = upkeep.metrics();
+    while ((m.tables_analyzed < 2 || m.vacuum_slices == 0 ||
+            m.freelist_count >= 8) &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      m = upkeep.metrics();
+    }
+
+    EXPECT_EQ(1u, m.optimize_runs);
+    EXPECT_EQ(2u, m.tables_analyzed);
+    EXPECT_LE(5u, m.vacuum_slices);
+    EXPECT_LT(0u, m.pages_vacuumed);
+    EXPECT_EQ(SQLITE_OK, m.last_error);
+
+    auto [after] = db.execute("pragma freelist_count").begin()->to<int>();
+    EXPECT_GT(8, after);
+    auto [stats] =
+        db.execute("select count(*) from sqlite_stat1").begin()->to<int>();
+    EXPECT_LE(2, stats);
+  }
+  std::remove("maint_test.db");
+}
+
+TEST(pcache, shared_arena) {
+  using namespace sqlite3cpp;
+  std::remove("pcache_test.db");
+  {
+    database db("pcache_test.db");
+    db.executescript(
+        "create table B (i INTEGER PRIMARY KEY, b BLOB);"
+        "with recursive n(i) as (select 1 union all select i + 1 from n "
+        "  where i < 1000) "
+        "insert into B select i, randomblob(1000) from n;");
+  }
+
+  shared_page_cache::params_t params;
+  params.capacity = 256 << 10;
+  params.slab_bytes = 64 << 10;
+  params.huge_pages = false;
+  {
+    shared_page_cache cache(params);
+    EXPECT_THROW(shared_page_cache{params}, error);
+
+    database a("pcache_test.db");
+    database b("pcache_test.db");
+    char const *sum = "select sum(length(b)), count(*) from B";
+    for (int round = 0; round < 3; ++round) {
+      for (auto *db : {&a, &b}) {
+        auto [bytes, rows] = db->execute(sum).begin()->to<int64_t, int>();
+        EXPECT_EQ(1000000, bytes);
+        EXPECT_EQ(1000, rows);
+      }
+    }
+
+    auto s = cache.stats();
+    EXPECT_EQ(params.capacity, s.capacity);
+    EXPECT_EQ(params.capacity, s.bytes_reserved);
+    EXPECT_LT(0u, s.hits);
+    EXPECT_LT(0u, s.misses);
+    // The table is about 4 times the cap
+    EXPECT_LT(0u, s.evictions);
+    EXPECT_EQ(0u, s.failures);
+    EXPECT_LE(2, s.caches);
+    EXPECT_EQ(0, s.pinned);
+
+    {
+      // Pages of in-memory databases stay pinned and go past the cap
+      database mem(":memory:");
+      mem.executescript(
+          "create table M (b BLOB);"
+          "with recursive n(i) as (select 1 union all select i + 1 from n "
+          "  where i < 200) "
+          "insert into M select randomblob(1000) from n;");
+      auto [rows] = mem.execute("select count(*) from M").begin()->to<int>();
+      EXPECT_EQ(200, rows);
+
+      s = cache.stats();
+      EXPECT_LT(0u, s.overcommits);
+      EXPECT_LT(params.capacity, s.bytes_reserved);
+      EXPECT_LT(50, s.pinned);
+    }
+    EXPECT_GT(s.pages, cache.stats().pages);
+    EXPECT_EQ(0, cache.stats().pinned);
+  }
+
+  // Default page cache is back
+  {
+    database db("pcache_test.db");
+    auto [rows] = db.execute("select count(*) from B").begin()->to<int>();
+    EXPECT_EQ(1000, rows);
+  }
+  std::remove("pcache_test.db");
+}
+
+TEST(rtree, query_callbacks) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  EXPECT_THROW(create_rtree(db, "Bad", {}), error);
+  create_rtree(db, "Place", {"x", "y"}, {"name"});
+  {
+    transaction trns(db);
+    for (int x = 0; x < 40; ++x) {
+      for (int y = 0; y < 40; ++y) {
+        db.execute("insert into Place values(?, ?, ?, ?, ?, ?)", x * 40 + y,
+                   x, x, y, y, std::to_string(x) + "," + std::to_string(y));
+      }
+    }
+    trns.commit();
+  }
+
+  int calls = 0;
+  create_rtree_query(db, "circle", [&calls](rtree_query_info &q) {
+    if (q.param_count() != 3) throw error(SQLITE_RANGE);
+    calls += 1;
+    double const cx = q.param(0), cy = q.param(1), r = q.param(2);
+    double dx = std::max({q.min(0) - cx, cx - q.max(0), 0.});
+    double dy = std::max({q.min(1) - cy, cy - q.max(1), 0.});
+    if (dx * dx + dy * dy > r * r) return rtree_not_within;
+    q.set_score(q.level());
+    return rtree_partly_within;
+  });
+
+  auto [n] = db.execute(
+                   "select count(*) from Place where id match "
+                   "circle(10, 10, 3)")
+                 .begin()
+                 ->to<int>();
+  // Points in x^2 + y^2 <= 9
+  EXPECT_EQ(29, n);
+  // Entries of nodes out of the circle are never visited
+  EXPECT_GT(1600, calls);
+
+  auto [name] = db.execute(
+                      "select name from Place where id match "
+                      "circle(5.2, 7.1, 0.5)")
+                    .begin()
+                    ->to<std::string>();
+  EXPECT_EQ("5,7", name);
+  EXPECT_THROW(
+      db.execute("select count(*) from Place where id match circle(1, 2)"),
+      error);
+
+  // Polygon by its bounding box for nodes and by ray casting for points
+  using polygon_t = std::vector<std::pair<double, double>>;
+  create_rtree_geometry(db, "polygon", [](rtree_query_info const &q) {
+    auto &poly = q.state<polygon_t>();
+    if (poly.empty()) {
+      for (int i = 0; i + 1 < q.param_count(); i += 2)
+        poly.emplace_back(q.param(i), q.param(i + 1));
+    }
+    if (!q.is_entry()) {
+      auto [x0, x1] = std::minmax_element(
+          poly.begin(), poly.end(),
+          [](auto const &l, auto const &r) { return l.first < r.first; });
+      auto [y0, y1] = std::minmax_element(
+          poly.begin(), poly.end(),
+          [](auto const &l, auto const &r) { return l.second < r.second; });
+      return x0->first <= q.max(0) && q.min(0) <= x1->first &&
+             y0->second <= q.max(1) && q.min(1) <= y1->second;
+    }
+    double const x = q.min(0) + 0.01, y = q.min(1) + 0.01;
+    bool in = false;
+    for (size_t i = 0, j = poly.size() - 1; i < poly.size(); j = i++) {
+      auto [xi, yi] = poly[i];
+      auto [xj, yj] = poly[j];
+      if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi)
+        in = !in;
+    }
+    return in;
+  });
+  auto [t] = db.execute(
+                   "select count(*) from Place where id match "
+                   "polygon(0, 0, 6.5, 0, 0, 6.5)")
+                 .begin()
+                 ->to<int>();
+  EXPECT_EQ(28, t);
+}
+
+TEST(memory, governor_restores_limits) {
+  using namespace sqlite3cpp;
+  int64_t const soft = sqlite3_soft_heap_limit64(int64_t(100) << 20);
+  int64_t const hard = sqlite3_hard_heap_limit64(-1);
+  {
+    memory_governor::params_t params;
+    params.soft_limit = int64_t(256) << 20;
+    params.hard_limit = int64_t(512) << 20;
+    params.interval = std::chrono::hours(1);
+    memory_governor gov(params);
+    EXPECT_EQ(params.hard_limit, sqlite3_hard_heap_limit64(-1));
+    EXPECT_EQ(params.soft_limit, sqlite3_soft_heap_limit64(-1));
+  }
+  EXPECT_EQ(int64_t(100) << 20, sqlite3_soft_heap_limit64(-1));
+  EXPECT_EQ(hard, sqlite3_hard_heap_limit64(-1));
+  sqlite3_soft_heap_limit64(soft);
+}
+
+TEST(memory, governor) {
+  using namespace sqlite3cpp;
+  std::remove("mem_test.db");
+  {
+    database db("mem_test.db");
+    db.executescript(
+        "create table B (b blob);"
+        "with recursive n(i) as (select 1 union all select i + 1 from n "
+        "  where i < 2000) "
+        "insert into B select randomblob(1000) from n;"
+        "select count(length(b)) from B;");
+    database idle(":memory:");
+    EXPECT_LT(1 << 20, db.db_statistics().cache_used);
+
+    std::vector<memory_governor::report_t> soft_reports;
+    int hard_calls = 0;
+    memory_governor::params_t params;
+    params.soft_limit = 1;
+    params.hard_limit = (int64_t)1 << 40;
+    params.hard_warning = 0;
+    params.interval = std::chrono::hours(1);
+    params.on_soft_limit = [&](memory_governor::report_t const &r) {
+      soft_reports.push_back(r);
+    };
+    params.on_hard_limit = [&](memory_governor::report_t const &) {
+      hard_calls += 1;
+    };
+    {
+      memory_governor gov(params);
+      EXPECT_EQ(params.soft_limit, sqlite3_soft_heap_limit64(-1));
+
+      // A budget shrinks the cache right away
+      gov.attach(db, "big", 256 << 10);
+      EXPECT_GT(512 << 10, db.db_statistics().cache_used);
+      db.executescript("select count(length(b)) from B;");
+      EXPECT_GT(512 << 10, db.db_statistics().cache_used);
+      gov.attach(idle, "idle");
+
+      gov.poll_now();
+      ASSERT_EQ(1u, soft_reports.size());
+      ASSERT_EQ(2u, soft_reports[0].connections.size());
+      EXPECT_EQ("big", soft_reports[0].connections[0].name);
+      EXPECT_EQ(256 << 10, soft_reports[0].connections[0].cache_budget);
+      EXPECT_EQ(1, hard_calls);
+      EXPECT_EQ(1u, gov.soft_limit_hits());
+
+      // Called once per crossing
+      gov.poll_now();
+      EXPECT_EQ(1u, soft_reports.size());
+      EXPECT_EQ(2u, gov.soft_limit_hits());
+
+      gov.detach(idle);
+      EXPECT_EQ(1u, gov.report().connections.size());
+      gov.detach(db);
+    }
+    EXPECT_NE(params.soft_limit, sqlite3_soft_heap_limit64(-1));
+  }
+  std::remove("mem_test.db");
+}
+
+TEST(collation, ascii_nocase) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  create_collations(db);
+  auto c = db.make_cursor();
+
+  uint32_t seed = 1;
+  auto rand = [&seed] { return (seed = seed * 1103515245 + 12345) >> 16; };
+  std::string_view const alphabet = "aAbBzZ@[`{09\x80\xff";
+  auto pick = [&] { return alphabet[rand() % alphabet.size()]; };
+
+  for (int i = 0; i < 2000; ++i) {
+    std::string l(rand() % 40, 'a'), r;
+    for (auto &ch : l) ch = pick();
+    r = l;
+    if (!r.empty() && rand() % 2) r[rand() % r.size()] = pick();
+    if (rand() % 4 == 0) r.resize(rand() % (r.size() + 1));
+
+    auto [expected, actual] =
+        c.execute("select (? collate nocase) > ?2, (?1 collate ascii_nocase) "
+                  "> ?2",
+                  l, r)
+            .begin()
+            ->to<int, int>();
+    EXPECT_EQ(expected, actual) << l << " vs " << r;
+
+    int sign_nocase = ascii_nocase_compare(l, r);
+    int sign_reverse = ascii_nocase_compare(r, l);
+    EXPECT_EQ(sign_nocase > 0, sign_reverse < 0);
+  }
+}
+
+TEST(collation, natural) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  create_collations(db);
+  auto c = db.make_cursor();
+
+  c.executescript(
+      "create table F (name text);"
+      "insert into F values('file10'), ('file2'), ('file02'), ('file1b'),"
+      "('file1'), ('file'), ('file1a'), ('a100'), ('a99x');");
+
+  std::vector<std::string> names;
+  for (auto const &row :
+       c.execute("select name from F order by name collate natural_order")) {
+    names.push_back(std::get<0>(row.to<std::string>()));
+  }
+  std::vector<std::string> expected = {"a99x",   "a100",   "file",
+                                       "file1",  "file1a", "file1b",
+                                       "file2",  "file02", "file10"};
+  EXPECT_EQ(expected, names);
+  EXPECT_EQ(0, natural_compare("x007y", "x007y"));
+}
+
+TEST(fts5, tokenizer_and_function) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  auto c = db.make_cursor();
+
+  // Tokenizer with arguments: split on a given delimiter
+  struct split_tokenizer {
+    split_tokenizer(std::vector<std::string_view> const &args)
+        : m_delim(args.empty() ? ',' : args[0][0]) {}
+    void tokenize(std::string_view text, int, fts5_token_sink &sink) {
+      size_t pos = 0;
+      while (pos <= text.size()) {
+        size_t end = std::min(text.find(m_delim, pos), text.size());
+        if (end > pos && !sink(text.substr(pos, end - pos))) return;
+        pos = end + 1;
+      }
+    }
+    char m_delim;
+  };
+  create_fts5_tokenizer<split_tokenizer>(db, "split");
+  create_fts5_tokenizer<identifier_tokenizer>(db, "identifier");
+  create_fts5_function(db, "hits", [](fts5_context const &ctx) {
+    return ctx.inst_count() * 10 + ctx.arg_count();
+  });
+
+  c.executescript(
+      "create virtual table Tag using fts5(tags, tokenize=\"split ';'\");"
+      "insert into Tag values('red;big apple;green');"
+      "create virtual table Doc using fts5(body, tokenize='identifier');"
+      "insert into Doc values('getUserName(userId)');"
+      "insert into Doc values('parseHTTPResponse_v2');"
+      "insert into Doc values('user_name = USER_NAME');");
+
+  auto [tag_rows] = c.execute("select count(*) from Tag('\"big apple\"')")
+                        .begin()
+                        ->to<int>();
+  EXPECT_EQ(1, tag_rows);
+
+  std::vector<std::tuple<int, int>> matches;
+  for (auto const &row :
+       c.execute("select rowid, hits(Doc, 1) from Doc('user') "
+                 "order by hits(Doc, 1) desc, rowid")) {
+    matches.push_back(row.to<int, int>());
+  }
+  std::vector<std::tuple<int, int>> expected = {{1, 21}, {3, 21}};
+  EXPECT_EQ(expected, matches);
+
+  auto [marked] =
+      c.execute("select highlight(Doc, 0, '[', ']') from Doc('http response')")
+          .begin()
+          ->to<std::string>();
+  EXPECT_EQ("parse[HTTP][Response]_v2", marked);
+
+  auto [v2] = c.execute("select count(*) from Doc('v + 2')").begin()->to<int>();
+  EXPECT_EQ(1, v2);
+}
+
+TEST(vector, kernels) {
+  using namespace sqlite3cpp;
+
+  for (size_t n : {0, 1, 7, 16, 33, 100, 1031}) {
+    std::vector<float> a(n), b(n);
+    std::vector<int8_t> ia(n), ib(n);
+    double dot = 0, l2 = 0;
+    int64_t idot = 0, il2 = 0;
+    for (size_t i = 0; i < n; ++i) {
+      a[i] = (float)std::sin(i * 0.1);
+      b[i] = (float)std::cos(i * 0.3);
+      ia[i] = (int8_t)(i * 37 % 256 - 128);
+      ib[i] = (int8_t)(i * 91 % 256 - 128);
+      dot += (double)a[i] * b[i];
+      l2 += ((double)a[i] - b[i]) * ((double)a[i] - b[i]);
+      idot += ia[i] * ib[i];
+      il2 += (ia[i] - ib[i]) * (ia[i] - ib[i]);
+    }
+
+    for (auto level :
+         {simd_level::scalar, simd_level::avx2, simd_level::avx512}) {
+      auto const &k = get_vector_kernels(level);
+      EXPECT_LE(k.level, level);
+      EXPECT_NEAR(dot, k.dot_f32(a.data(), b.data(), n), 1e-3);
+      EXPECT_NEAR(l2, k.l2sq_f32(a.data(), b.data(), n), 1e-3);
+      EXPECT_EQ(idot, k.dot_i8(ia.data(), ib.data(), n));
+      EXPECT_EQ(il2, k.l2sq_i8(ia.data(), ib.data(), n));
+
+      float d = 0, na = 0, nb = 0;
+      k.cosine_f32(a.data(), b.data(), n, &d, &na, &nb);
+      EXPECT_NEAR(dot, d, 1e-3);
+      int64_t id = 0, ina = 0, inb = 0;
+      k.cosine_i8(ia.data(), ib.data(), n, &id, &ina, &inb);
+      EXPECT_EQ(idot, id);
+      EXPECT_EQ(k.dot_i8(ia.data(), ia.data(), n), ina);
+    }
+  }
+}
+
+TEST(vector, kernels_extreme_values) {
+  using namespace sqlite3cpp;
+
+  // Sums over a chunk of the int8 kernels exceed int32
+  for (size_t n : {40000, 65536, 65536 * 2 + 47}) {
+    for (auto [x, y] : {std::pair<int8_t, int8_t>{127, -128}, {-128, -128}}) {
+      std::vector<int8_t> a(n, x), b(n, y);
+      int64_t const dot = (int64_t)n * x * y;
+      int64_t const l2 = (int64_t)n * (x - y) * (x - y);
+      for (auto level :
+           {simd_level::scalar, simd_level::avx2, simd_level::avx512}) {
+        auto const &k = get_vector_kernels(level);
+        EXPECT_EQ(dot, k.dot_i8(a.data(), b.data(), n));
+        EXPECT_EQ(l2, k.l2sq_i8(a.data(), b.data(), n));
+        int64_t d = 0, na = 0, nb = 0;
+        k.cosine_i8(a.data(), b.data(), n, &d, &na, &nb);
+        EXPECT_EQ(dot, d);
+        EXPECT_EQ((int64_t)n * x * x, na);
+        EXPECT_EQ((int64_t)n * y * y, nb);
+      }
+    }
+  }
+}
+
+TEST(vector, sql_functions) {
+  using namespace sqlite3cpp;
+  database db(":memory:");
+  create_vector_functions(db);
+
+  auto c = db.make_cursor();
+  c.executescript(
+      "create table E (id integer primary key, v blob, q blob);"
+      "insert into E values(1, vec_f32('[1, 0, 0]'), vec_i8('[1, 2, 3]'));"
+      "insert into E values(2, vec_f32('[0, 1, 0]'), vec_i8('[-1, 0, 1]'));"
+      "insert into E values(3, vec_f32('[1, 1, 0]'), vec_i8('[300, 0, 0]'));"
+      "insert into E values(4, null, null);");
+
+  double score[4] = {};
+  for (auto const &row : c.execute(
+           "select id, vec_dot(v, vec_f32('[2, 1, 0]')), "
+           "vec_l2(v, vec_f32('[1, 0, 0]')), "
+           "vec_cosine(v, vec_f32('[1, 1, 0]')) from E where v is not null")) {
+    auto [id, dot, l2, cosine] = row.to<int, double, double, double>();
+    score[id] = dot;
+    if (id == 1) {
+      EXPECT_DOUBLE_EQ(0.0, l2);
+      EXPECT_NEAR(std::sqrt(0.5), cosine, 1e-6);
+    }
+    if (id == 3) {
+      EXPECT_NEAR(1.0, cosine, 1e-6);
+    }
+  }
+  EXPECT_DOUBLE_EQ(2.0, score[1]);
+  EXPECT_DOUBLE_EQ(1.0, score[2]);
+  EXPECT_DOUBLE_EQ(3.0, score[3]);
+
+  auto [idot, il2, icos] =
+      c.execute("select vec_dot_i8(q, vec_i8('[1, 1, 1]')), "
+                "vec_l2_i8(q, q), vec_cosine_i8(q, q) from E where id = 1")
+          .begin()
+          ->to<int, double, double>();
+  EXPECT_EQ(6, idot);
+  EXPECT_DOUBLE_EQ(0.0, il2);
+  EXPECT_NEAR(1.0, icos, 1e-9);
+
+  // Values out of int8 range are clamped
+  auto [clamped] = c.execute("select vec_dot_i8(q, vec_i8('[1, 0, 0]')) "
+                             "from E where id = 3")
+                       .begin()
+                       ->to<int>();
+  EXPECT_EQ(127, clamped);
+
+  auto [is_null] =
+      c.execute("select vec_dot(v, v) is null from E where id = 4")
+          .begin()
+          ->to<int>();
+  EXPECT_EQ(1, is_null);
+
+  auto [topk] = c.execute("select vec_topk(id, vec_dot(v, vec_f32('[2, 1, "
+                          "0]')), 2) from E")
+                    .begin()
+                    ->to<std::string>();
+  EXPECT_EQ("[3,1]", topk);
+
+  EXPECT_THROW(c.execute("select vec_dot(vec_f32('[1]'), vec_f32('[1, 2]'))"),
+               error);
+  EXPECT_THROW(c.execute("select vec_f32('[1, x]')"), error);
+}
+
 #include "version.h"
 
+TEST_F(DBTest, serialize_deserialize) {
+  using namespace sqlite3cpp;
+
+  auto bytes = basic_dataset().serialize();
+  ASSERT_LT(0u, bytes.size());
+
+  // Caller-owned buffer is neither copied nor freed by sqlite3
+  bool released = false;
+  {
+    database db(database_image::wrap(bytes.data(), bytes.size(),
+                                     [&released] { released = true; }));
+    auto [cnt] = db.execute("select count(*) from T").begin()->to<int>();
+    EXPECT_EQ(4, cnt);
+    EXPECT_THROW(db.execute("insert into T values(5, 'x')"), error);
+    EXPECT_FALSE(released);
+  }
+  EXPECT_TRUE(released);
+
+  database db(":memory:");
+  EXPECT_THROW(db.deserialize(database_image::from_bytes("not a database")),
+               error);
+}
+
+TEST(image, map_file_and_swap) {
+  using namespace sqlite3cpp;
+  std::remove("image_v1.db");
+  std::remove("image_v2.db");
+  {
+    database db("image_v1.db");
+    db.executescript(
+        "create table K (k int primary key, v text);"
+        "insert into K values(1, 'one');"
+        "vacuum into 'image_v2.db';"
+        "update K set v = 'uno';");
+  }
+  // v2 is the older content; the order does not matter for swaps
+  image_reader reader(database_image::map_file("image_v1.db"));
+  auto lookup = [](database &db) {
+    return std::get<0>(db.execute("select v from K where k = 1")
+                           .begin()
+                           ->to<std::string>());
+  };
+
+  auto pinned = reader.acquire();
+  EXPECT_EQ("uno", lookup(*pinned));
+
+  reader.swap(database_image::map_file("image_v2.db"));
+  EXPECT_EQ(1u, reader.version());
+  EXPECT_EQ("one", lookup(*reader.acquire()));
+  // Readers holding the previous connection still see the previous image
+  EXPECT_EQ("uno", lookup(*pinned));
+
+  EXPECT_THROW(reader.swap(database_image::map_file("no_such_image.db")),
+               error);
+  EXPECT_EQ("one", lookup(*reader.acquire()));
+
+  pinned.reset();
+  reader.swap(database_image::from_bytes(reader.acquire()->serialize()));
+  EXPECT_EQ("one", lookup(*reader.acquire()));
+
+  std::remove("image_v1.db");
+  std::remove("image_v2.db");
+}
+
 TEST_F(DBTest, version) {
   EXPECT_STREQ(SQLITE3CPP_VERSION_STRING, basic_dataset().version().c_str());
 }
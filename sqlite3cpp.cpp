@@ -31,9 +31,23 @@
  *
  ******************************************************************************/
 #include "sqlite3cpp.h"
+#include <algorithm>
+#include <mutex>
+#include <random>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 #include "version.h"
 
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if !defined(NDEBUG)
 #include <cstdio>
 #define DBG(...) printf(__VA_ARGS__)
@@ -44,8 +58,176 @@ namespace sqlite3cpp {
 namespace detail {
 // An tag type for row iter session
 struct session {};
+
+// Busy policy and wait accounting of a database
+struct busy_state {
+  using clock = std::chrono::steady_clock;
+
+  // Account current episode into histogram. Caller must hold |mutex|.
+  void close_episode() {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    if (!open) return;
+    open = false;
+
+    auto us = duration_cast<microseconds>(waited);
+    size_t bucket = 0;
+    for (auto v = us.count(); v > 1; v >>= 1) ++bucket;
+    bucket = std::min(bucket, stats.wait_histogram.size() - 1);
+    stats.wait_histogram[bucket] += 1;
+    stats.total_wait += us;
+    stats.max_wait = std::max(stats.max_wait, us);
+  }
+
+  busy_policy policy;
+  std::mutex mutex;
+  busy_stats stats;
+  bool open = false;
+  clock::time_point start;
+  clock::duration waited{0};
+};
+
+// Listeners of update/commit/rollback hooks of a database
+struct change_hub {
+  static void on_update(void *hub, int op, char const *db, char const *table,
+                        sqlite3_int64 rowid) {
+    // NOTE(acer): A change in autocommit mode starts a new transaction, so a
+    // staged one has committed even if nobody flushed it.
+    auto *h = (change_hub *)hub;
+    if (h->staged && sqlite3_get_autocommit(h->db)) h->flush();
+    for (auto &entry : h->listeners) {
+      if (!entry.second.update) continue;
+      try {
+        entry.second.update(op, db, table, rowid);
+      } catch (...) {
+      }
+    }
+  }
+
+  static int on_commit(void *hub) {
+    auto *h = (change_hub *)hub;
+    for (auto &entry : h->listeners) {
+      if (!entry.second.commit) continue;
+      try {
+        entry.second.commit();
+      } catch (...) {
+      }
+    }
+    // Staged until the commit is seen to succeed; see |flush()|.
+    h->staged = true;
+    return 0;
+  }
+
+  static void on_rollback(void *hub) {
+    ((change_hub *)hub)->staged = false;
+    for (auto &entry : ((change_hub *)hub)->listeners) {
+      if (!entry.second.rollback) continue;
+      try {
+        entry.second.rollback();
+      } catch (...) {
+      }
+    }
+  }
+
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+  static void on_preupdate(void *hub, sqlite3 *db, int op, char const *name,
+                           char const *table, sqlite3_int64 key1,
+                           sqlite3_int64 key2) {
+    auto *h = (change_hub *)hub;
+    if (h->staged && sqlite3_get_autocommit(h->db)) h->flush();
+    for (auto &entry : h->listeners) {
+      if (!entry.second.preupdate) continue;
+      try {
+        entry.second.preupdate(db, op, name, table, key1, key2);
+      } catch (...) {
+      }
+    }
+  }
+#endif
+
+  // NOTE(acer): The commit hook runs before the commit is durable. A failed
+  // COMMIT, e.g. SQLITE_BUSY, leaves the transaction open and a rolled back
+  // one calls the rollback hook, so the commit is known to have succeeded
+  // once the connection is back in autocommit mode without a rollback.
+  void flush() noexcept {
+    staged = false;
+    for (auto &entry : listeners) {
+      if (!entry.second.committed) continue;
+      try {
+        entry.second.committed();
+      } catch (...) {
+      }
+    }
+  }
+
+  sqlite3 *db = nullptr;
+  std::vector<std::pair<int, change_listener>> listeners;
+  int next_id = 0;
+  bool staged = false;
+  // Listeners of the pre-update hook and sqlite3 sessions, which install
+  // the hook themselves; only one kind at a time.
+  int preupdates = 0;
+  int sessions = 0;
+};
+
+// Authorizers of a database, consulted in order
+struct auth_hub {
+  static int on_auth(void *hub, int action, char const *arg1,
+                     char const *arg2, char const *db, char const *trigger) {
+    int result = SQLITE_OK;
+    for (auto &entry : ((auth_hub *)hub)->authorizers) {
+      int rc = SQLITE_DENY;
+      try {
+        rc = entry.second(action, arg1, arg2, db, trigger);
+      } catch (...) {
+      }
+      // Deny beats ignore, which beats ok
+      if (rc == SQLITE_DENY || (rc == SQLITE_IGNORE && result == SQLITE_OK))
+        result = rc;
+      else if (rc != SQLITE_OK && rc != SQLITE_IGNORE)
+        result = SQLITE_DENY;
+    }
+    return result;
+  }
+
+  std::vector<std::pair<int, authorizer>> authorizers;
+  int next_id = 0;
+};
 }  // namespace detail
 
+/**
+ * backoff_policy impl
+ */
+bool backoff_policy::operator()(
+    int attempt, std::chrono::steady_clock::duration waited) const {
+  using namespace std::chrono;
+
+  if (waited >= m_params.deadline) return false;
+
+  if (attempt < m_params.spins) {
+    std::this_thread::yield();
+    return true;
+  }
+
+  double const max_us = (double)m_params.max_sleep.count();
+  double sleep_us = (double)m_params.initial_sleep.count();
+  for (int i = m_params.spins; i < attempt && sleep_us < max_us; ++i)
+    sleep_us *= m_params.multiplier;
+  sleep_us = std::min(sleep_us, max_us);
+
+  // Randomize the sleep so that blocked connections do not retry in lockstep
+  thread_local std::minstd_rand rng(std::random_device{}());
+  double jitter = std::clamp(m_params.jitter, 0.0, 1.0);
+  std::uniform_real_distribution<double> dist(1.0 - jitter, 1.0);
+  sleep_us *= dist(rng);
+
+  auto remain = duration_cast<microseconds>(m_params.deadline - waited);
+  std::this_thread::sleep_for(
+      std::min(microseconds((int64_t)sleep_us), remain));
+  return true;
+}
+
+
 /**
  * row_iter impl
  */
@@ -87,31 +269,85 @@ bool row_iter::is_valid() const noexcept { return !m_session.expired(); }
 /**
  * cursor impl
  */
-cursor::cursor(database const &db) noexcept : m_db(db.get()) {}
+cursor::cursor(database const &db) noexcept
+    : m_owner(&db), m_db(db.get()) {}
 
 cursor &cursor::executescript(std::string const &sql) {
   int ec = 0;
-  if (0 != (ec = sqlite3_exec(m_db, sql.c_str(), 0, 0, 0))) throw error(ec);
+  ec = sqlite3_exec(m_db, sql.c_str(), 0, 0, 0);
+  m_owner->flush_changes();
+  if (ec) throw error(ec);
   return *this;
 }
 
-void cursor::step() {
-  assert(m_stmt && "null cursor");
+cursor &cursor::set_limits(limits_t const &limits) {
+  m_limits = std::make_unique<limits_t>(limits);
+  return *this;
+}
 
-  int ec = sqlite3_step(m_stmt.get());
+cursor &cursor::clear_limits() noexcept {
+  m_limits.reset();
+  return *this;
+}
+
+int cursor::on_progress(void *csr) {
+  auto *c = (cursor *)csr;
+  auto const &limits = *c->m_limits;
+
+  if (limits.token && limits.token->cancelled()) {
+    c->m_interrupted = interrupted::cancelled;
+  } else if (limits.deadline &&
+             std::chrono::steady_clock::now() >= *limits.deadline) {
+    c->m_interrupted = interrupted::deadline;
+  }
+  return c->m_interrupted ? 1 : 0;
+}
 
+void cursor::step() {
+  int ec = step_noexcept();
   switch (ec) {
     case SQLITE_DONE:
-      m_session.reset();
-      break;
     case SQLITE_ROW:
       break;
+    case SQLITE_INTERRUPT:
+      throw interrupted(m_interrupted ? *m_interrupted
+                                      : interrupted::interrupt);
     default:
       throw error(ec);
   }
 }
 
-row_iter cursor::begin() noexcept {
+int cursor::step_noexcept() noexcept {
+  assert(m_stmt && "null cursor");
+
+  int ec = 0;
+  m_interrupted.reset();
+  if (m_limits) {
+    if (on_progress(this)) {
+      m_session.reset();
+      return SQLITE_INTERRUPT;
+    }
+    sqlite3_progress_handler(m_db, m_limits->granularity, &cursor::on_progress,
+                             this);
+    ec = sqlite3_step(m_stmt.get());
+    sqlite3_progress_handler(m_db, 0, nullptr, nullptr);
+  } else {
+    ec = sqlite3_step(m_stmt.get());
+  }
+
+  if (ec == SQLITE_DONE || ec == SQLITE_INTERRUPT) m_session.reset();
+  m_owner->flush_changes();
+  return ec;
+}
+
+result<bool> cursor::try_step() noexcept {
+  if (!m_stmt) return {SQLITE_MISUSE, nullptr};
+  int ec = step_noexcept();
+  if (ec == SQLITE_ROW || ec == SQLITE_DONE) return ec == SQLITE_ROW;
+  return {ec, m_db};
+}
+
+row_iter cursor::begin() {
   if (!m_stmt) return {};
   // NOTE(acer): There is actually a redundant reset as we invoke
   // |execute().begin()|. It's possible to be eliminated, though I keep it for
@@ -158,14 +394,134 @@ database::database(std::string const &urn) {
   m_db.reset(i);
 }
 
+database::database(std::string const &urn, int flags, char const *vfs) {
+  sqlite3 *i = 0;
+  int ec = sqlite3_open_v2(urn.c_str(), &i, flags, vfs);
+  // NOTE(acer): A handle is returned for most errors and must be closed
+  m_db.reset(i);
+  if (ec) throw error(ec);
+}
+
+database::database(std::shared_ptr<database_image const> image)
+    : database(":memory:") {
+  deserialize(std::move(image));
+}
+
 database::database(sqlite3 *db) : m_owned(false), m_db(db) {}
 
 database::~database() {
-  if (!m_owned) m_db.release();
+  if (!m_owned) {
+    if (m_busy) sqlite3_busy_handler(m_db.get(), 0, 0);
+    if (m_changes) install_change_hooks(false);
+    m_db.release();
+  }
 }
 
 cursor database::make_cursor() const noexcept { return cursor(*this); }
 
+std::string database::serialize(char const *schema) const {
+  sqlite3_int64 size = 0;
+  // NOTE(acer): In-memory databases can be viewed without a copy
+  if (auto *p = sqlite3_serialize(m_db.get(), schema, &size,
+                                  SQLITE_SERIALIZE_NOCOPY)) {
+    return std::string((char const *)p, (size_t)size);
+  }
+
+  std::unique_ptr<unsigned char, void (*)(void *)> p(
+      sqlite3_serialize(m_db.get(), schema, &size, 0), &sqlite3_free);
+  if (!p) {
+    // An empty database serializes to nothing
+    if (size == 0) return {};
+    throw error(SQLITE_NOMEM);
+  }
+  return std::string((char const *)p.get(), (size_t)size);
+}
+
+void database::deserialize(std::shared_ptr<database_image const> image) {
+  if (!image) throw error(SQLITE_MISUSE);
+
+  auto size = (sqlite3_int64)image->size();
+  int ec = sqlite3_deserialize(m_db.get(), "main",
+                               (unsigned char *)image->data(), size, size,
+                               SQLITE_DESERIALIZE_READONLY);
+  if (ec) throw error(ec);
+  m_image = std::move(image);
+
+  // Read schema now s.t. a broken image fails here rather than later
+  executescript("select count(*) from sqlite_master");
+}
+
+/**
+ * database_image impl
+ */
+database_image::~database_image() {
+  if (m_release) m_release();
+}
+
+std::shared_ptr<database_image const> database_image::map_file(
+    std::string const &path) {
+#ifdef _WIN32
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw error(SQLITE_CANTOPEN);
+  std::string bytes((std::istreambuf_iterator<char>(in)),
+                    std::istreambuf_iterator<char>());
+  return from_bytes(std::move(bytes));
+#else
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) throw error(SQLITE_CANTOPEN);
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw error(SQLITE_IOERR);
+  }
+  auto size = (size_t)st.st_size;
+  // NOTE(acer): mmap() rejects zero length; an empty file is an empty database
+  void *p = size ? ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                 : nullptr;
+  ::close(fd);
+  if (p == MAP_FAILED) throw error(SQLITE_IOERR);
+
+  try {
+    return std::shared_ptr<database_image const>(new database_image(
+        p, size, [p, size] {
+          if (p) ::munmap(p, size);
+        }));
+  } catch (...) {
+    if (p) ::munmap(p, size);
+    throw;
+  }
+#endif
+}
+
+std::shared_ptr<database_image const> database_image::wrap(
+    void const *data, size_t size, std::function<void()> release) {
+  return std::shared_ptr<database_image const>(
+      new database_image(data, size, std::move(release)));
+}
+
+std::shared_ptr<database_image const> database_image::from_bytes(
+    std::string bytes) {
+  auto owned = std::make_shared<std::string>(std::move(bytes));
+  return wrap(owned->data(), owned->size(), [owned] {});
+}
+
+/**
+ * image_reader impl
+ */
+image_reader::image_reader(std::shared_ptr<database_image const> image)
+    : m_current(std::make_shared<database>(std::move(image))) {}
+
+std::shared_ptr<database> image_reader::acquire() const noexcept {
+  return std::atomic_load(&m_current);
+}
+
+void image_reader::swap(std::shared_ptr<database_image const> image) {
+  auto next = std::make_shared<database>(std::move(image));
+  std::atomic_store(&m_current, std::move(next));
+  m_version += 1;
+}
+
 std::string database::version() const { return SQLITE3CPP_VERSION_STRING; }
 
 cursor database::executescript(std::string const &sql) {
@@ -174,6 +530,234 @@ cursor database::executescript(std::string const &sql) {
   return c;
 }
 
+void database::create_collation(std::string const &name,
+                                collation comparator) {
+  int ec = 0;
+  if (!comparator) {
+    ec = sqlite3_create_collation_v2(m_db.get(), name.c_str(), SQLITE_UTF8,
+                                     nullptr, nullptr, nullptr);
+    if (ec) throw error(ec);
+    return;
+  }
+
+  auto cmp = std::make_unique<collation>(std::move(comparator));
+  ec = sqlite3_create_collation_v2(
+      m_db.get(), name.c_str(), SQLITE_UTF8, (void *)cmp.get(),
+      &database::compare, [](void *p) { delete (collation *)p; });
+  if (ec) throw error(ec);
+  cmp.release();
+}
+
+int database::compare(void *comparator, int lsize, void const *lhs,
+                      int rsize, void const *rhs) {
+  try {
+    return (*(collation *)comparator)(
+        std::string_view((char const *)lhs, (size_t)lsize),
+        std::string_view((char const *)rhs, (size_t)rsize));
+  } catch (...) {
+    return 0;
+  }
+}
+
+void database::set_busy_policy(busy_policy policy) {
+  int ec = 0;
+  if (!policy) {
+    if (0 != (ec = sqlite3_busy_handler(m_db.get(), 0, 0))) throw error(ec);
+    return;
+  }
+
+  if (!m_busy) m_busy = std::make_unique<detail::busy_state>();
+  {
+    std::lock_guard<std::mutex> lk(m_busy->mutex);
+    m_busy->policy = std::move(policy);
+  }
+  if (0 != (ec = sqlite3_busy_handler(m_db.get(), &database::on_busy,
+                                      m_busy.get())))
+    throw error(ec);
+}
+
+busy_stats database::busy_statistics() const {
+  if (!m_busy) return {};
+  std::lock_guard<std::mutex> lk(m_busy->mutex);
+  m_busy->close_episode();
+  return m_busy->stats;
+}
+
+db_stats database::db_statistics(bool reset) const {
+  db_stats st;
+  auto get = [this, reset](int op, bool peak = false) {
+    int cur = 0, hi = 0;
+    sqlite3_db_status(m_db.get(), op, &cur, &hi, reset);
+    return (int64_t)(peak ? hi : cur);
+  };
+
+  st.cache_used = get(SQLITE_DBSTATUS_CACHE_USED);
+  st.cache_used_shared = get(SQLITE_DBSTATUS_CACHE_USED_SHARED);
+  st.schema_used = get(SQLITE_DBSTATUS_SCHEMA_USED);
+  st.stmt_used = get(SQLITE_DBSTATUS_STMT_USED);
+  // NOTE(acer): Counters below are reported as highwater marks
+  st.lookaside_hit = get(SQLITE_DBSTATUS_LOOKASIDE_HIT, true);
+  st.lookaside_miss_size = get(SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, true);
+  st.lookaside_miss_full = get(SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, true);
+  st.cache_hit = get(SQLITE_DBSTATUS_CACHE_HIT);
+  st.cache_miss = get(SQLITE_DBSTATUS_CACHE_MISS);
+  st.cache_write = get(SQLITE_DBSTATUS_CACHE_WRITE);
+  st.cache_spill = get(SQLITE_DBSTATUS_CACHE_SPILL);
+
+  int cur = 0, hi = 0;
+  sqlite3_db_status(m_db.get(), SQLITE_DBSTATUS_LOOKASIDE_USED, &cur, &hi,
+                    reset);
+  st.lookaside_used = {cur, hi};
+  return st;
+}
+
+heap_stats heap_statistics(bool reset_peaks) {
+  heap_stats st;
+  auto get = [reset_peaks](int op) {
+    sqlite3_int64 cur = 0, hi = 0;
+    sqlite3_status64(op, &cur, &hi, reset_peaks);
+    return db_stats::value_t{cur, hi};
+  };
+
+  st.memory_used = get(SQLITE_STATUS_MEMORY_USED);
+  st.malloc_count = get(SQLITE_STATUS_MALLOC_COUNT);
+  st.malloc_size_peak = get(SQLITE_STATUS_MALLOC_SIZE).peak;
+  st.pagecache_used = get(SQLITE_STATUS_PAGECACHE_USED);
+  st.pagecache_overflow = get(SQLITE_STATUS_PAGECACHE_OVERFLOW);
+  st.pagecache_size_peak = get(SQLITE_STATUS_PAGECACHE_SIZE).peak;
+  return st;
+}
+
+std::string detail::quote_identifier(std::string_view name) {
+  std::string out = "\"";
+  for (char c : name) {
+    out += c;
+    if (c == '"') out += '"';
+  }
+  return out + "\"";
+}
+
+int database::on_busy(void *state, int attempt) {
+  using clock = detail::busy_state::clock;
+  auto *st = (detail::busy_state *)state;
+  busy_policy policy;
+  clock::duration waited;
+
+  {
+    std::lock_guard<std::mutex> lk(st->mutex);
+    auto now = clock::now();
+    if (attempt == 0) {
+      st->close_episode();
+      st->open = true;
+      st->start = now;
+      st->stats.episodes += 1;
+    }
+    waited = now - st->start;
+    policy = st->policy;
+  }
+
+  // NOTE(acer): The policy may sleep; do not hold the lock meanwhile.
+  bool retry = false;
+  try {
+    retry = policy && policy(attempt, waited);
+  } catch (...) {
+  }
+
+  std::lock_guard<std::mutex> lk(st->mutex);
+  if (retry) {
+    st->stats.retries += 1;
+    if (st->open) st->waited = clock::now() - st->start;
+  } else {
+    st->stats.timeouts += 1;
+    st->waited = clock::now() - st->start;
+    st->close_episode();
+  }
+  return retry ? 1 : 0;
+}
+
+int database::add_change_listener(change_listener listener) {
+  if (!m_changes) {
+    m_changes = std::make_unique<detail::change_hub>();
+    m_changes->db = m_db.get();
+  }
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+  bool const preupdate = (bool)listener.preupdate;
+  if (preupdate && m_changes->sessions) throw error(SQLITE_MISUSE);
+#endif
+  int id = m_changes->next_id++;
+  m_changes->listeners.emplace_back(id, std::move(listener));
+  if (m_changes->listeners.size() == 1) install_change_hooks(true);
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+  if (preupdate && m_changes->preupdates++ == 0)
+    sqlite3_preupdate_hook(m_db.get(), &detail::change_hub::on_preupdate,
+                           m_changes.get());
+#endif
+  return id;
+}
+
+void database::acquire_session_hook() {
+  if (!m_changes) {
+    m_changes = std::make_unique<detail::change_hub>();
+    m_changes->db = m_db.get();
+  }
+  if (m_changes->preupdates) throw error(SQLITE_MISUSE);
+  m_changes->sessions += 1;
+}
+
+void database::release_session_hook() noexcept {
+  if (m_changes && m_changes->sessions) m_changes->sessions -= 1;
+}
+
+int database::add_authorizer(authorizer auth) {
+  if (!m_auth) m_auth = std::make_unique<detail::auth_hub>();
+  int id = m_auth->next_id++;
+  m_auth->authorizers.emplace_back(id, std::move(auth));
+  if (m_auth->authorizers.size() == 1)
+    sqlite3_set_authorizer(m_db.get(), &detail::auth_hub::on_auth,
+                           m_auth.get());
+  return id;
+}
+
+void database::remove_authorizer(int id) {
+  if (!m_auth) return;
+  auto &as = m_auth->authorizers;
+  as.erase(std::remove_if(as.begin(), as.end(),
+                          [id](auto const &e) { return e.first == id; }),
+           as.end());
+  if (as.empty()) sqlite3_set_authorizer(m_db.get(), nullptr, nullptr);
+}
+
+void database::flush_changes() const noexcept {
+  if (m_changes && m_changes->staged && sqlite3_get_autocommit(m_db.get()))
+    m_changes->flush();
+}
+
+void database::remove_change_listener(int id) {
+  if (!m_changes) return;
+  auto &ls = m_changes->listeners;
+  auto it = std::find_if(ls.begin(), ls.end(),
+                         [id](auto const &e) { return e.first == id; });
+  if (it == ls.end()) return;
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+  if (it->second.preupdate && --m_changes->preupdates == 0)
+    sqlite3_preupdate_hook(m_db.get(), nullptr, nullptr);
+#endif
+  ls.erase(it);
+  if (ls.empty()) {
+    install_change_hooks(false);
+    m_changes->staged = false;
+  }
+}
+
+void database::install_change_hooks(bool on) noexcept {
+  using detail::change_hub;
+  void *hub = on ? m_changes.get() : nullptr;
+  sqlite3_update_hook(m_db.get(), on ? &change_hub::on_update : nullptr, hub);
+  sqlite3_commit_hook(m_db.get(), on ? &change_hub::on_commit : nullptr, hub);
+  sqlite3_rollback_hook(m_db.get(), on ? &change_hub::on_rollback : nullptr,
+                        hub);
+}
+
 void database::forward(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
   auto *cb = (xfunc_t *)sqlite3_user_data(ctx);
   assert(cb != 0);
@@ -32,6 +32,9 @@
  ******************************************************************************/
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <exception>
 #include <functional>
@@ -68,6 +71,13 @@ struct cursor;
 struct row_iter;
 struct row;
 
+namespace detail {
+struct busy_state;
+struct change_hub;
+struct auth_hub;
+struct aux_factory;
+}  // namespace detail
+
 C_STYLE_DELETER(sqlite3, sqlite3_close);
 C_STYLE_DELETER(sqlite3_stmt, sqlite3_finalize);
 
@@ -77,6 +87,157 @@ struct error : std::exception {
   int code;
 };
 
+// Raised when a statement is interrupted (SQLITE_INTERRUPT). |reason| tells
+// whether it was due to a deadline, a cancellation_token, or an explicit
+// |database::interrupt()|.
+struct interrupted : error {
+  enum reason_t { deadline, cancelled, interrupt };
+  interrupted(reason_t reason) noexcept
+      : error(SQLITE_INTERRUPT), reason(reason) {}
+  reason_t reason;
+};
+
+struct cancellation_token {
+  // A shared cancellation flag. Copies of a token refer to the same flag so a
+  // token can be cancelled from any thread.
+  cancellation_token() : m_flag(std::make_shared<std::atomic<bool>>(false)) {}
+  void cancel() const noexcept { m_flag->store(true); }
+  bool cancelled() const noexcept { return m_flag->load(); }
+
+ private:
+  std::shared_ptr<std::atomic<bool>> m_flag;
+};
+
+template <typename T = void>
+struct result;
+
+template <>
+struct result<void> {
+  // Outcome of a noexcept call; either OK or a sqlite3 error code. e.g.
+  //
+  // auto r = csr.try_execute("insert into T values(?)", 1);
+  // if (!r && r.code() == SQLITE_CONSTRAINT) { ... }
+  //
+  // Unlike sqlite3cpp::error, nothing but the code is kept; see |message()|.
+  result() noexcept = default;
+  result(int code, sqlite3 *db) noexcept : m_code(code), m_db(db) {}
+
+  bool ok() const noexcept { return m_code == SQLITE_OK; }
+  explicit operator bool() const noexcept { return ok(); }
+  int code() const noexcept { return m_code; }
+
+  // Error message of the connection, read on call. Falls back to the generic
+  // message of |code()| if the connection has failed differently since.
+  char const *message() const noexcept {
+    if (m_db && (sqlite3_errcode(m_db) & 0xff) == (m_code & 0xff))
+      return sqlite3_errmsg(m_db);
+    return sqlite3_errstr(m_code);
+  }
+
+  // Raise sqlite3cpp::error if not OK.
+  void value() const {
+    if (!ok()) throw error(m_code);
+  }
+
+ protected:
+  int m_code = SQLITE_OK;
+  sqlite3 *m_db = nullptr;
+};
+
+template <typename T>
+struct result : result<void> {
+  // Outcome of a noexcept call; either a value of T or an error code.
+  result(T val) noexcept : m_val(std::move(val)) {}
+  result(int code, sqlite3 *db) noexcept : result<void>(code, db) {}
+
+  // Get the value or raise sqlite3cpp::error if not OK.
+  T &value() {
+    result<void>::value();
+    return *m_val;
+  }
+  T const &value() const {
+    result<void>::value();
+    return *m_val;
+  }
+
+  // Get the value without checking; undefined if not OK.
+  T &operator*() noexcept { return *m_val; }
+  T const &operator*() const noexcept { return *m_val; }
+  T *operator->() noexcept { return &*m_val; }
+  T const *operator->() const noexcept { return &*m_val; }
+
+ private:
+  std::optional<T> m_val;
+};
+
+// Mapping between C++ type T and sqlite3 values, used to bind parameters,
+// read columns by |row::to()|, and convert arguments and results of
+// functions created by |database::create_scalar()| and
+// |database::create_aggregate()|. Built-in mappings are
+//
+//   integral types, bool         INTEGER (uint64_t is stored as int64_t)
+//   enums                        as their underlying type
+//   float, double                REAL
+//   std::chrono::duration        count of its ticks
+//   std::chrono::time_point      duration since epoch of its clock
+//   std::string, std::string_view, char const *   TEXT (char const * is
+//                                bind and result only)
+//   std::nullptr_t               NULL (bind and result only)
+//   std::optional<T>             NULL or T
+//
+// Each mapping calls sqlite3 with its native type, e.g. int64_t binds by
+// `sqlite3_bind_int64`, so values are not converted on the way. User types
+// are mapped by specializations. e.g.
+//
+// namespace sqlite3cpp {
+// template <>
+// struct type_traits<point> {
+//   static int bind(sqlite3_stmt *stmt, int index, point const &p) noexcept {
+//     return sqlite3_bind_int64(stmt, index, p.pack());
+//   }
+//   static point column(sqlite3_stmt *stmt, int index) {
+//     return point::unpack(sqlite3_column_int64(stmt, index));
+//   }
+//   static point value(sqlite3_value *v) {
+//     return point::unpack(sqlite3_value_int64(v));
+//   }
+//   static void result(sqlite3_context *ctx, point const &p) {
+//     sqlite3_result_int64(ctx, p.pack());
+//   }
+// };
+// }  // namespace sqlite3cpp
+//
+// Only the functions in use are required. |bind()| returns an sqlite3 error
+// code and must not throw; others raise sqlite3cpp::error on failures.
+// |Enable| is for partial specializations by std::enable_if_t.
+template <typename T, typename Enable = void>
+struct type_traits;
+
+template <typename T>
+struct aux {
+  // Parameter type of scalar functions that caches a value derived from an
+  // argument for the life of a statement (via `sqlite3_set_auxdata`). e.g.
+  //
+  // db.create_scalar("regexp", [](aux<std::regex> re, std::string_view s) {
+  //   return std::regex_search(s.begin(), s.end(), *re);
+  // });
+  //
+  // The value T is constructed from the argument text (std::string_view if
+  // T is constructible from that, std::string otherwise). As long as the
+  // argument is constant in a statement, e.g. `regexp('a|b', col)`, T is
+  // constructed once per statement instead of once per row.
+  T const &operator*() const noexcept { return *m_val; }
+  T const *operator->() const noexcept { return m_val; }
+
+ private:
+  friend struct detail::aux_factory;
+  aux(T const *val, std::shared_ptr<T> owned) noexcept
+      : m_val(val), m_owned(std::move(owned)) {}
+  T const *m_val;
+  // Holds the value if sqlite3 discarded it right away.
+  std::shared_ptr<T> m_owned;
+};
+
 struct SQLITE3CPP_EXPORT row {
   // Retrieve tuple of row values from this row e.g.
   //
@@ -101,8 +262,10 @@ struct SQLITE3CPP_EXPORT row {
   // std::string_view could introduce allocation if conversion was needed. When
   // OOM occurs, sqlite3cpp will raise exceptions of type sqlite3cpp::error.
   // If exceptions are not preferred, one can use std::optional<std::string> or
-  // std::optional<std::stirng_view> as type parameters such that no exceptions
-  // shall be raised as of OOM.
+  // std::optional<std::string_view> as type parameters such that no exceptions
+  // shall be raised as of OOM; NULL values are std::nullopt as well.
+  //
+  // Supported types are those of |type_traits|.
   template <typename... Cols>
   std::tuple<Cols...> to() const;
 
@@ -153,25 +316,86 @@ struct SQLITE3CPP_EXPORT cursor {
   // Execute multiple SQL statements.
   cursor &executescript(std::string const &sql);
 
+  struct limits_t {
+    // Interrupt statements still running after |deadline|.
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    // Interrupt statements once |token| is cancelled.
+    std::optional<cancellation_token> token;
+    // Number of VM steps between checks of |deadline| and |token|.
+    int granularity = 1000;
+  };
+
+  // Limit subsequent |execute()| calls and iteration of this cursor. e.g.
+  //
+  // cancellation_token token;
+  // cursor::limits_t limits;
+  // limits.deadline = std::chrono::steady_clock::now() + 100ms;
+  // limits.token = token;
+  // csr.set_limits(limits);
+  //
+  // try {
+  //   for (auto const &row : csr.execute(query)) { ... }
+  // } catch (interrupted const &e) {
+  //   // e.reason is interrupted::deadline or interrupted::cancelled
+  // }
+  //
+  // Limits are checked via `sqlite3_progress_handler` installed while this
+  // cursor steps a statement, which replaces any progress handler installed
+  // on the connection meanwhile.
+  cursor &set_limits(limits_t const &limits);
+
+  // Remove limits set by |set_limits()|.
+  cursor &clear_limits() noexcept;
+
   // Row iterator to begin query results. This row_iter becomes
   // invalid after the cursor it referenced has been detroyed or another
   // |begin()| has been called.
-  row_iter begin() noexcept;
+  row_iter begin();
 
   // Row itertor to end of query results (next to the last one of result).
   row_iter end() noexcept;
 
+  // Non-throwing counterparts for hot paths where errors such as SQLITE_BUSY
+  // or SQLITE_CONSTRAINT are expected. e.g.
+  //
+  // auto r = csr.try_execute("select a from T where b > ?", 1);
+  // for (; r && *r; r = csr.try_step()) {
+  //   auto [a] = *csr.try_to<int>();
+  // }
+  // if (!r) log(r.code(), r.message());
+  //
+  // Same as |execute()|. The value tells whether a row is available.
+  template <typename... Args>
+  result<bool> try_execute(std::string const &sql, Args &&... args) noexcept;
+
+  // Reset current statement and bind |args| to it again; |try_step()| runs
+  // it. This saves preparing the same SQL again.
+  template <typename... Args>
+  result<> try_bind(Args &&... args) noexcept;
+
+  // Step current statement. The value tells whether a row is available.
+  result<bool> try_step() noexcept;
+
+  // Same as |row::to()| for current row.
+  template <typename... Cols>
+  result<std::tuple<Cols...>> try_to() const noexcept;
+
   // Get underlying sqlite3_stmt pointer.
   sqlite3_stmt *get() const noexcept { return m_stmt.get(); }
 
  private:
   void step();
+  int step_noexcept() noexcept;
+  static int on_progress(void *csr);
   friend struct row_iter;
   friend struct database;
   cursor(database const &db) noexcept;
+  database const *m_owner;
   sqlite3 *m_db;
   std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> m_stmt;
   std::shared_ptr<void> m_session;
+  std::unique_ptr<limits_t> m_limits;
+  std::optional<interrupted::reason_t> m_interrupted;
 };
 
 struct SQLITE3CPP_EXPORT transaction {
@@ -208,11 +432,184 @@ struct SQLITE3CPP_EXPORT transaction {
   params_t m_params;
 };
 
+// Decide whether a statement blocked by a lock (SQLITE_BUSY) should be retried.
+// |attempt| counts from 0 for each busy episode and |waited| is the time
+// elapsed since the first attempt. A policy blocks (spin or sleep) before
+// returning true. Returning false gives up and sqlite3cpp::error(SQLITE_BUSY)
+// is raised by the blocked call.
+using busy_policy = std::function<bool(
+    int attempt, std::chrono::steady_clock::duration waited)>;
+
+struct SQLITE3CPP_EXPORT backoff_policy {
+  // Busy policy that spins (yields) for the first |spins| attempts, then sleeps
+  // with jittered exponential backoff until |deadline| is reached.
+  struct params_t {
+    int spins = 4;
+    std::chrono::microseconds initial_sleep{50};
+    std::chrono::microseconds max_sleep{10000};
+    double multiplier = 2.0;
+    // Fraction of each sleep that is randomized, in [0, 1].
+    double jitter = 0.5;
+    std::chrono::milliseconds deadline{5000};
+  };
+
+  backoff_policy() = default;
+  backoff_policy(params_t const &params) : m_params(params) {}
+
+  bool operator()(int attempt,
+                  std::chrono::steady_clock::duration waited) const;
+
+  params_t m_params;
+};
+
+struct busy_stats {
+  // Number of times a statement got blocked by a lock.
+  uint64_t episodes = 0;
+  // Number of retries granted by the busy policy.
+  uint64_t retries = 0;
+  // Number of episodes the busy policy gave up on.
+  uint64_t timeouts = 0;
+  // Wait time per episode. Bucket i counts waits in [2^i, 2^(i+1))
+  // microseconds, bucket 0 also counts waits shorter than 1us, and the last
+  // bucket counts all longer waits.
+  std::array<uint64_t, 24> wait_histogram{};
+  std::chrono::microseconds total_wait{0};
+  std::chrono::microseconds max_wait{0};
+};
+
+struct db_stats {
+  // Per connection counters of `sqlite3_db_status`. Memory is in bytes.
+  struct value_t {
+    int64_t current = 0;
+    int64_t peak = 0;
+  };
+
+  // Page cache memory, of which |cache_used_shared| is shared cache memory
+  // divided among connections sharing it.
+  int64_t cache_used = 0;
+  int64_t cache_used_shared = 0;
+  int64_t schema_used = 0;
+  int64_t stmt_used = 0;
+  // Lookaside slots in use, and allocations served or missed by lookaside.
+  value_t lookaside_used;
+  int64_t lookaside_hit = 0;
+  int64_t lookaside_miss_size = 0;
+  int64_t lookaside_miss_full = 0;
+  // Page cache hits, misses, writes, and pages spilled mid transaction.
+  int64_t cache_hit = 0;
+  int64_t cache_miss = 0;
+  int64_t cache_write = 0;
+  int64_t cache_spill = 0;
+};
+
+struct heap_stats {
+  // Process wide counters of `sqlite3_status64`. Memory is in bytes.
+  using value_t = db_stats::value_t;
+
+  value_t memory_used;
+  value_t malloc_count;
+  // Largest allocation requested.
+  int64_t malloc_size_peak = 0;
+  // Page cache memory from the SQLITE_CONFIG_PAGECACHE pool and beyond.
+  value_t pagecache_used;
+  value_t pagecache_overflow;
+  int64_t pagecache_size_peak = 0;
+};
+
+// Get memory statistics of sqlite3 in the process. Peaks are reset after
+// being read if |reset_peaks| is true.
+SQLITE3CPP_EXPORT heap_stats heap_statistics(bool reset_peaks = false);
+
+namespace detail {
+// Quote |name| as an SQL identifier, e.g. `a"b` as `"a""b"`.
+SQLITE3CPP_EXPORT std::string quote_identifier(std::string_view name);
+}  // namespace detail
+
+struct change_listener {
+  // Called per changed row with SQLITE_INSERT, SQLITE_UPDATE, or
+  // SQLITE_DELETE as |op|. See `sqlite3_update_hook` for what is not reported.
+  std::function<void(int op, char const *db, char const *table,
+                     sqlite3_int64 rowid)>
+      update;
+  // Called when a transaction is about to commit. The commit can still
+  // fail, e.g. with SQLITE_BUSY, or be rolled back.
+  std::function<void()> commit;
+  // Called once a transaction which reached |commit| has committed. See
+  // |database::flush_changes()| for when that is observed.
+  std::function<void()> committed;
+  // Called when a transaction is rolled back.
+  std::function<void()> rollback;
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+  // Called per changed row before the change is made, with arguments of
+  // `sqlite3_preupdate_hook` callbacks. Use `sqlite3_preupdate_old/new` on
+  // |db| to read values of the row.
+  std::function<void(sqlite3 *db, int op, char const *name, char const *table,
+                     sqlite3_int64 key1, sqlite3_int64 key2)>
+      preupdate;
+#endif
+};
+
+// Decide on an action of a statement being prepared. Arguments are those of
+// `sqlite3_set_authorizer` callbacks; returns SQLITE_OK, SQLITE_DENY, or
+// SQLITE_IGNORE. See |database::add_authorizer()|.
+using authorizer =
+    std::function<int(int action, char const *arg1, char const *arg2,
+                      char const *db, char const *trigger)>;
+
+// Compare |lhs| with |rhs| and return negative, zero, or positive like
+// strcmp(). See |database::create_collation()|.
+using collation =
+    std::function<int(std::string_view lhs, std::string_view rhs)>;
+
+struct SQLITE3CPP_EXPORT database_image {
+  // Read-only bytes of a database file for |database::deserialize()|. The
+  // bytes are not copied; they must stay valid and unchanged as long as the
+  // image is alive.
+
+  // Map file at |path| read-only. Throws sqlite3cpp::error if it can not be
+  // opened or mapped. On Windows the file is read into memory instead.
+  static std::shared_ptr<database_image const> map_file(
+      std::string const &path);
+
+  // Wrap caller-owned |size| bytes at |data|. |release| is called once the
+  // image is no longer used by any database.
+  static std::shared_ptr<database_image const> wrap(
+      void const *data, size_t size, std::function<void()> release = {});
+
+  // Take over |bytes|, e.g. from |database::serialize()|.
+  static std::shared_ptr<database_image const> from_bytes(std::string bytes);
+
+  ~database_image();
+
+  database_image(database_image const &) = delete;
+  database_image &operator=(database_image const &) = delete;
+
+  void const *data() const noexcept { return m_data; }
+  size_t size() const noexcept { return m_size; }
+
+ private:
+  database_image(void const *data, size_t size, std::function<void()> release)
+      : m_data(data), m_size(size), m_release(std::move(release)) {}
+
+  void const *m_data;
+  size_t m_size;
+  std::function<void()> m_release;
+};
+
 struct SQLITE3CPP_EXPORT database {
   // Create a database connection to |urn|. |urn| could be `:memory:` or a
   // filename. |urn| should be encoded in UTF-8.
   database(std::string const &urn);
 
+  // Create a database connection to |urn| with `SQLITE_OPEN_*` |flags| and
+  // the VFS named |vfs|, e.g. one registered by io_stats_vfs. The default
+  // VFS is used if |vfs| is null.
+  database(std::string const &urn, int flags, char const *vfs = nullptr);
+
+  // Create a read-only in-memory database backed by |image|. Same as opening
+  // `:memory:` and calling |deserialize()|.
+  database(std::shared_ptr<database_image const> image);
+
   // Attach to an opened sqlite3 database. Call site is responsible to mangage
   // life time of the passed pointer |db|. sqlite3cpp does not release the
   // pointer.
@@ -226,6 +623,10 @@ struct SQLITE3CPP_EXPORT database {
   // Get underlying sqlite3 (database) pointer.
   sqlite3 *get() const noexcept { return m_db.get(); }
 
+  // Interrupt statements running on this database. Safe to be called from
+  // other threads. Interrupted statements raise sqlite3cpp::interrupted.
+  void interrupt() noexcept { sqlite3_interrupt(m_db.get()); }
+
   // Shortcut for calling |cursor::execute|.
   template <typename... Args>
   cursor execute(std::string const &sql, Args &&... args);
@@ -244,9 +645,9 @@ struct SQLITE3CPP_EXPORT database {
   //   EXPECT_EQ(2, val);
   // }
   //
-  // Arity and types of function parameters are deduced automatically. Supported
-  // parameter types are int, int64_t, double, std::string, and
-  // std::string_view.
+  // Arity and types of function parameters are deduced automatically.
+  // Supported parameter and return types are those of |type_traits|, and
+  // aux<T> for parameters.
   template <typename FUNC>
   void create_scalar(std::string const &name, FUNC func,
                      int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC);
@@ -259,12 +660,102 @@ struct SQLITE3CPP_EXPORT database {
   // void AG::step(T val)
   // R AG::finalize()
   //
-  // where T can be int, int64_t, double, std::string, or std::string_view
-  // and R can be int, int64_t, double, or std::string.
+  // where T and R are types of |type_traits|.
   template <typename AG>
   void create_aggregate(std::string const &name,
                         int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC);
 
+  // Create a collation in current database. |comparator| can be lambda or
+  // other std::function<> compatible types. e.g.
+  //
+  // db.create_collation("reverse", [](std::string_view l, std::string_view r) {
+  //   return r.compare(l);
+  // });
+  // db.execute("select a from T order by a collate reverse");
+  //
+  // |comparator| must define a total order and must not throw; exceptions
+  // are taken as equal. Passing an empty |comparator| removes the collation.
+  // See sqlite3cpp_collation.h for prebuilt ones.
+  void create_collation(std::string const &name, collation comparator);
+
+  // Install a busy policy via `sqlite3_busy_handler`. e.g.
+  //
+  // backoff_policy::params_t params;
+  // params.deadline = std::chrono::milliseconds(200);
+  // db.set_busy_policy(backoff_policy(params));
+  //
+  // Busy waits are accounted per connection regardless of the policy. See
+  // |busy_statistics()|. Passing an empty policy removes the busy handler.
+  // Note that this replaces any `sqlite3_busy_timeout` set on the connection.
+  void set_busy_policy(busy_policy policy);
+
+  // Get statistics of busy waits of this connection.
+  busy_stats busy_statistics() const;
+
+  // Get memory and cache statistics of this connection. Peaks and hit/miss
+  // counters are reset after being read if |reset| is true.
+  db_stats db_statistics(bool reset = false) const;
+
+  // Free as much page cache memory of this connection as possible, e.g.
+  // unpinned pages.
+  void release_memory() noexcept { sqlite3_db_release_memory(m_db.get()); }
+
+  // Register a listener of data changes and return an id for removal. Any of
+  // the callbacks can be empty. Callbacks are invoked on the thread executing
+  // the statement and must not use this database. Exceptions thrown by them
+  // are ignored.
+  //
+  // sqlite3 provides a single update, commit, rollback, and pre-update hook
+  // per connection; sqlite3cpp takes those hooks over and dispatches them to
+  // all listeners. Do not install the hooks via sqlite3 API directly.
+  //
+  // Sessions of the sqlite3 session extension take the pre-update hook
+  // themselves, so a listener with |change_listener::preupdate| can not be
+  // added while sessions are recording; it raises
+  // sqlite3cpp::error(SQLITE_MISUSE).
+  int add_change_listener(change_listener listener);
+
+  // Remove a listener by the id returned from |add_change_listener()|.
+  void remove_change_listener(int id);
+
+  // Claim the pre-update hook for a sqlite3 session (see |session|) before
+  // creating it; release it after the session is deleted. Raises
+  // sqlite3cpp::error(SQLITE_MISUSE) while listeners use the hook.
+  void acquire_session_hook();
+  void release_session_hook() noexcept;
+
+  // Register an authorizer of statements prepared on this connection and
+  // return an id for removal. All authorizers are consulted in order of
+  // registration; an action is denied if any of them returns SQLITE_DENY or
+  // throws, and otherwise ignored if any returns SQLITE_IGNORE.
+  //
+  // sqlite3 provides a single authorizer per connection; sqlite3cpp takes it
+  // over, e.g. for |query_cache|. Do not call `sqlite3_set_authorizer`
+  // directly.
+  int add_authorizer(authorizer auth);
+
+  // Remove an authorizer by the id returned from |add_authorizer()|.
+  void remove_authorizer(int id);
+
+  // Invoke |change_listener::committed| if a transaction reached its commit
+  // hook and the connection is back in autocommit mode. Cursors call this
+  // after every step; call it after stepping statements of |get()| via
+  // sqlite3 API directly.
+  void flush_changes() const noexcept;
+
+  // Get content of |schema| as the bytes of a database file. e.g. one can
+  // ship an in-memory database and load it by |deserialize()|.
+  std::string serialize(char const *schema = "main") const;
+
+  // Replace main database by |image| without copying it. The database turns
+  // into a read-only in-memory one and keeps |image| alive until it is
+  // closed or deserialized again. Fails with SQLITE_BUSY while statements or
+  // transactions are active.
+  //
+  // NOTE: Images of WAL mode databases can not be read; run
+  // `pragma journal_mode=delete` on a copy before shipping it.
+  void deserialize(std::shared_ptr<database_image const> image);
+
   // Get version string of sqlite3cpp (not version of sqlite3).
   std::string version() const;
 
@@ -285,11 +776,58 @@ struct SQLITE3CPP_EXPORT database {
   static void step_ag(sqlite3_context *ctx, int argc, sqlite3_value **argv);
   static void final_ag(sqlite3_context *ctx);
   static void dispose_ag(void *user_data);
+  static int on_busy(void *state, int attempt);
+  static int compare(void *comparator, int lsize, void const *lhs, int rsize,
+                     void const *rhs);
+  void install_change_hooks(bool on) noexcept;
 
   bool m_owned = true;
+  std::unique_ptr<detail::busy_state> m_busy;
+  std::unique_ptr<detail::change_hub> m_changes;
+  std::unique_ptr<detail::auth_hub> m_auth;
+  // NOTE(acer): Declared before |m_db| as the connection reads the image
+  // until it is closed.
+  std::shared_ptr<database_image const> m_image;
   std::unique_ptr<sqlite3, sqlite3_deleter> m_db;
 };
 
+struct SQLITE3CPP_EXPORT image_reader {
+  // Serve reads from a database image which can be replaced while readers
+  // are running. e.g.
+  //
+  // image_reader reader(database_image::map_file("lookup.v1.db"));
+  // ...
+  // auto db = reader.acquire();  // pinned until released
+  // db->execute("select v from Lookup where k = ?", key);
+  // ...
+  // reader.swap(database_image::map_file("lookup.v2.db"));
+  //
+  // |swap()| builds a connection on the new image aside and publishes it by
+  // an atomic pointer swap. Readers holding the previous connection finish
+  // on the previous image, which is released with its last reader. Safe to
+  // be called from multiple threads. A connection shared by threads
+  // serializes their statements; acquire per thread and keep cursors
+  // thread local.
+  image_reader(std::shared_ptr<database_image const> image);
+
+  image_reader(image_reader const &) = delete;
+  image_reader &operator=(image_reader const &) = delete;
+
+  // Get current connection.
+  std::shared_ptr<database> acquire() const noexcept;
+
+  // Replace current image by |image|. Throws sqlite3cpp::error if the image
+  // can not be opened, in which case current one is kept.
+  void swap(std::shared_ptr<database_image const> image);
+
+  // Number of swaps so far.
+  uint64_t version() const noexcept { return m_version.load(); }
+
+ private:
+  std::shared_ptr<database> m_current;
+  std::atomic<uint64_t> m_version{0};
+};
+
 }  // namespace sqlite3cpp
 #ifdef _WIN32
 #pragma warning(pop)
@@ -29,6 +29,8 @@
  *
  ******************************************************************************/
 #include <cassert>
+#include <chrono>
+#include <optional>
 #include <type_traits>
 #include <utility>
 
@@ -82,163 +84,336 @@ constexpr decltype(auto) enumerate(F &&f, Tuple &&t) {
           int, std::tuple_size_v<std::remove_reference_t<Tuple>>>{});
 }
 
-/**
- * Helpers for retrieve column values.
- */
-inline bool get_col_val_aux(sqlite3_stmt *stmt, sqlite3 *, int index,
-                            int &val) {
-  val = sqlite3_column_int(stmt, index);
-  return true;
-}
+template <typename T>
+struct is_optional : std::false_type {};
 
-inline bool get_col_val_aux(sqlite3_stmt *stmt, sqlite3 *, int index,
-                            int64_t &val) {
-  val = sqlite3_column_int64(stmt, index);
-  return true;
-}
+template <typename T>
+struct is_optional<std::optional<T>> : std::true_type {};
 
-inline bool get_col_val_aux(sqlite3_stmt *stmt, sqlite3 *, int index,
-                            double &val) {
-  val = sqlite3_column_double(stmt, index);
-  return true;
-}
+template <typename T>
+struct int_traits {
+  // NOTE(acer): Types which may not fit in int go through the int64 API;
+  // unsigned int, uint64_t and alike
+  static constexpr bool fits_int =
+      sizeof(T) < sizeof(int) ||
+      (sizeof(T) == sizeof(int) && std::is_signed_v<T>);
+
+  static int bind(sqlite3_stmt *stmt, int index, T val) noexcept {
+    if constexpr (fits_int)
+      return sqlite3_bind_int(stmt, index, (int)val);
+    else
+      return sqlite3_bind_int64(stmt, index, (sqlite3_int64)val);
+  }
 
-inline bool get_col_val_aux(sqlite3_stmt *stmt, sqlite3 *db, int index,
-                            std::string &val) {
-  char const *res = (char const *)sqlite3_column_text(stmt, index);
-  if (!res) {
-    return false;
+  static T column(sqlite3_stmt *stmt, int index) noexcept {
+    if constexpr (fits_int)
+      return (T)sqlite3_column_int(stmt, index);
+    else
+      return (T)sqlite3_column_int64(stmt, index);
   }
-  val.assign(res, sqlite3_column_bytes(stmt, index));
-  return true;
-}
 
-inline bool get_col_val_aux(sqlite3_stmt *stmt, sqlite3 *db, int index,
-                            std::string_view &val) {
-  char const *res = (char const *)sqlite3_column_text(stmt, index);
-  if (!res) {
-    return false;
+  static T value(sqlite3_value *v) noexcept {
+    if constexpr (fits_int)
+      return (T)sqlite3_value_int(v);
+    else
+      return (T)sqlite3_value_int64(v);
   }
-  val = std::string_view{
-      (char const *)sqlite3_column_text(stmt, index),
-      (std::string_view::size_type)sqlite3_column_bytes(stmt, index)};
-  return true;
-}
 
-inline bool get_col_val_aux(sqlite3_stmt *stmt, sqlite3 *db, int index,
-                            std::optional<std::string> &val) {
-  char const *res = (char const *)sqlite3_column_text(stmt, index);
-  if (!res) {
-    int ec = sqlite3_errcode(db);
-    if (ec != SQLITE_OK) val.reset();
+  static void result(sqlite3_context *ctx, T val) noexcept {
+    if constexpr (fits_int)
+      sqlite3_result_int(ctx, (int)val);
+    else
+      sqlite3_result_int64(ctx, (sqlite3_int64)val);
   }
-  val = std::string{res,
-                    (std::string::size_type)sqlite3_column_bytes(stmt, index)};
-  return true;
+};
+
+// Text of a column or value; null text of a non-NULL value is OOM.
+inline std::string_view column_text(sqlite3_stmt *stmt, int index) {
+  auto *p = (char const *)sqlite3_column_text(stmt, index);
+  if (!p) {
+    if (sqlite3_errcode(sqlite3_db_handle(stmt)) == SQLITE_NOMEM)
+      throw error(SQLITE_NOMEM);
+    return {};
+  }
+  return {p, (size_t)sqlite3_column_bytes(stmt, index)};
 }
 
-inline bool get_col_val_aux(sqlite3_stmt *stmt, sqlite3 *db, int index,
-                            std::optional<std::string_view> &val) {
-  char const *res = (char const *)sqlite3_column_text(stmt, index);
-  if (!res) {
-    int ec = sqlite3_errcode(db);
-    if (ec != SQLITE_OK) val.reset();
+inline std::string_view value_text(sqlite3_value *v) {
+  auto *p = (char const *)sqlite3_value_text(v);
+  if (!p) {
+    if (sqlite3_value_type(v) != SQLITE_NULL) throw error(SQLITE_NOMEM);
+    return {};
   }
-  val = std::string_view{
-      res, (std::string_view::size_type)sqlite3_column_bytes(stmt, index)};
-  return true;
+  return {p, (size_t)sqlite3_value_bytes(v)};
 }
 
-/*
- * Helpers for binding values to sqlite3_stmt.
+}  // namespace detail
+
+/**
+ * Built-in type_traits
  */
-inline void bind_to_stmt(sqlite3_stmt *stmt, int i) {}
+template <typename T>
+struct type_traits<T, std::enable_if_t<std::is_integral_v<T>>>
+    : detail::int_traits<T> {};
 
-inline int bind_val(sqlite3_stmt *stmt, int index, int val) {
-  return sqlite3_bind_int(stmt, index, val);
-}
+template <typename T>
+struct type_traits<T, std::enable_if_t<std::is_enum_v<T>>> {
+  using base = type_traits<std::underlying_type_t<T>>;
 
-inline int bind_val(sqlite3_stmt *stmt, int index, double val) {
-  return sqlite3_bind_double(stmt, index, val);
-}
+  static int bind(sqlite3_stmt *stmt, int index, T val) noexcept {
+    return base::bind(stmt, index, (std::underlying_type_t<T>)val);
+  }
+  static T column(sqlite3_stmt *stmt, int index) noexcept {
+    return (T)base::column(stmt, index);
+  }
+  static T value(sqlite3_value *v) noexcept { return (T)base::value(v); }
+  static void result(sqlite3_context *ctx, T val) noexcept {
+    base::result(ctx, (std::underlying_type_t<T>)val);
+  }
+};
 
-inline int bind_val(sqlite3_stmt *stmt, int index, std::string const &val) {
-  return sqlite3_bind_text(stmt, index, val.c_str(), val.size(), SQLITE_STATIC);
-}
+template <typename T>
+struct type_traits<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+  static int bind(sqlite3_stmt *stmt, int index, T val) noexcept {
+    return sqlite3_bind_double(stmt, index, (double)val);
+  }
+  static T column(sqlite3_stmt *stmt, int index) noexcept {
+    return (T)sqlite3_column_double(stmt, index);
+  }
+  static T value(sqlite3_value *v) noexcept {
+    return (T)sqlite3_value_double(v);
+  }
+  static void result(sqlite3_context *ctx, T val) noexcept {
+    sqlite3_result_double(ctx, (double)val);
+  }
+};
+
+template <typename Rep, typename Period>
+struct type_traits<std::chrono::duration<Rep, Period>> {
+  using T = std::chrono::duration<Rep, Period>;
+  using base = type_traits<Rep>;
+
+  static int bind(sqlite3_stmt *stmt, int index, T val) noexcept {
+    return base::bind(stmt, index, val.count());
+  }
+  static T column(sqlite3_stmt *stmt, int index) noexcept {
+    return T(base::column(stmt, index));
+  }
+  static T value(sqlite3_value *v) noexcept { return T(base::value(v)); }
+  static void result(sqlite3_context *ctx, T val) noexcept {
+    base::result(ctx, val.count());
+  }
+};
+
+template <typename Clock, typename Duration>
+struct type_traits<std::chrono::time_point<Clock, Duration>> {
+  using T = std::chrono::time_point<Clock, Duration>;
+  using base = type_traits<Duration>;
+
+  static int bind(sqlite3_stmt *stmt, int index, T val) noexcept {
+    return base::bind(stmt, index, val.time_since_epoch());
+  }
+  static T column(sqlite3_stmt *stmt, int index) noexcept {
+    return T(base::column(stmt, index));
+  }
+  static T value(sqlite3_value *v) noexcept { return T(base::value(v)); }
+  static void result(sqlite3_context *ctx, T val) noexcept {
+    base::result(ctx, val.time_since_epoch());
+  }
+};
+
+// NOTE(acer): Bound text is not copied (SQLITE_STATIC); it must outlive the
+// statement execution. Results are copied.
+template <>
+struct type_traits<std::string_view> {
+  static int bind(sqlite3_stmt *stmt, int index,
+                  std::string_view val) noexcept {
+    return sqlite3_bind_text(stmt, index, val.data(), (int)val.size(),
+                             SQLITE_STATIC);
+  }
+  static std::string_view column(sqlite3_stmt *stmt, int index) {
+    return detail::column_text(stmt, index);
+  }
+  static std::string_view value(sqlite3_value *v) {
+    return detail::value_text(v);
+  }
+  static void result(sqlite3_context *ctx, std::string_view val) noexcept {
+    sqlite3_result_text(ctx, val.data(), (int)val.size(), SQLITE_TRANSIENT);
+  }
+};
+
+template <>
+struct type_traits<std::string> {
+  static int bind(sqlite3_stmt *stmt, int index,
+                  std::string const &val) noexcept {
+    return type_traits<std::string_view>::bind(stmt, index, val);
+  }
+  static std::string column(sqlite3_stmt *stmt, int index) {
+    return std::string(detail::column_text(stmt, index));
+  }
+  static std::string value(sqlite3_value *v) {
+    return std::string(detail::value_text(v));
+  }
+  static void result(sqlite3_context *ctx, std::string const &val) noexcept {
+    type_traits<std::string_view>::result(ctx, val);
+  }
+};
+
+template <>
+struct type_traits<char const *> {
+  static int bind(sqlite3_stmt *stmt, int index, char const *val) noexcept {
+    return sqlite3_bind_text(stmt, index, val, -1, SQLITE_STATIC);
+  }
+  static void result(sqlite3_context *ctx, char const *val) noexcept {
+    sqlite3_result_text(ctx, val, -1, SQLITE_TRANSIENT);
+  }
+};
 
-inline int bind_val(sqlite3_stmt *stmt, int index, std::string_view val) {
-  return sqlite3_bind_text(stmt, index, val.data(), val.size(), SQLITE_STATIC);
+template <>
+struct type_traits<char *> : type_traits<char const *> {};
+
+template <>
+struct type_traits<std::nullptr_t> {
+  static int bind(sqlite3_stmt *stmt, int index, std::nullptr_t) noexcept {
+    return sqlite3_bind_null(stmt, index);
+  }
+  static void result(sqlite3_context *ctx, std::nullptr_t) noexcept {
+    sqlite3_result_null(ctx);
+  }
+};
+
+// NOTE(acer): NULL maps to std::nullopt, so does OOM of reading text; the
+// latter keeps |row::to()| free of exceptions for optional text columns.
+template <typename T>
+struct type_traits<std::optional<T>> {
+  using base = type_traits<T>;
+
+  static int bind(sqlite3_stmt *stmt, int index,
+                  std::optional<T> const &val) noexcept {
+    return val ? base::bind(stmt, index, *val) : sqlite3_bind_null(stmt, index);
+  }
+  static std::optional<T> column(sqlite3_stmt *stmt, int index) {
+    if (sqlite3_column_type(stmt, index) == SQLITE_NULL) return std::nullopt;
+    try {
+      return base::column(stmt, index);
+    } catch (error const &e) {
+      if (e.code != SQLITE_NOMEM) throw;
+      return std::nullopt;
+    }
+  }
+  static std::optional<T> value(sqlite3_value *v) {
+    if (sqlite3_value_type(v) == SQLITE_NULL) return std::nullopt;
+    return base::value(v);
+  }
+  static void result(sqlite3_context *ctx, std::optional<T> const &val) {
+    if (val)
+      base::result(ctx, *val);
+    else
+      sqlite3_result_null(ctx);
+  }
+};
+
+namespace detail {
+
+/**
+ * Helpers for retrieve column values.
+ */
+template <typename T>
+inline void get_col_val(sqlite3_stmt *stmt, int index, T &val) {
+  val = type_traits<T>::column(stmt, index);
 }
 
-inline int bind_val(sqlite3_stmt *stmt, int index, char const *val) {
-  return sqlite3_bind_text(stmt, index, val, -1, SQLITE_STATIC);
+/*
+ * Helpers for binding values to sqlite3_stmt.
+ */
+template <typename T>
+inline int bind_val(sqlite3_stmt *stmt, int index, T const &val) noexcept {
+  return type_traits<std::decay_t<T>>::bind(stmt, index, val);
 }
 
-inline int bind_val(sqlite3_stmt *stmt, int index, std::nullptr_t _) {
-  return sqlite3_bind_null(stmt, index);
+inline int try_bind_to_stmt(sqlite3_stmt *stmt, int i) noexcept {
+  return SQLITE_OK;
 }
 
 template <typename T, typename... Args>
-void bind_to_stmt(sqlite3_stmt *stmt, int index, T &&val, Args &&...args) {
+int try_bind_to_stmt(sqlite3_stmt *stmt, int index, T &&val,
+                     Args &&...args) noexcept {
+  int ec = 0;
+  if (0 != (ec = bind_val(stmt, index, val))) return ec;
+  return try_bind_to_stmt(stmt, index + 1, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+void bind_to_stmt(sqlite3_stmt *stmt, int index, Args &&...args) {
   int ec = 0;
-  if (0 != (ec = bind_val(stmt, index, std::forward<T>(val)))) throw error(ec);
-  bind_to_stmt(stmt, index + 1, std::forward<Args>(args)...);
+  if (0 != (ec = try_bind_to_stmt(stmt, index, std::forward<Args>(args)...)))
+    throw error(ec);
 }
 
+// Type to keep a value to be bound later, e.g. by write_queue or script.
+// Text is stored by value.
+template <typename T>
+using stored_t = std::conditional_t<
+    std::is_convertible_v<std::decay_t<T>, std::string_view> &&
+        !std::is_same_v<std::decay_t<T>, std::nullptr_t>,
+    std::string, std::decay_t<T>>;
+
 /**
  * Helpers for converting value from sqlite3_value.
  */
 template <typename T>
 struct Type {};
 
-inline int get(Type<int>, sqlite3_value **v, int const index) {
-  return sqlite3_value_int(v[index]);
-}
+template <typename T>
+inline T get(Type<T>, sqlite3_value **v, int const index) {
+  return type_traits<T>::value(v[index]);
+}
+
+struct aux_factory {
+  template <typename T>
+  static std::unique_ptr<T> make(sqlite3_value **v, int const index) {
+    auto text = type_traits<std::string_view>::value(v[index]);
+    if constexpr (std::is_constructible_v<T, std::string_view>)
+      return std::make_unique<T>(text);
+    else
+      return std::make_unique<T>(std::string(text));
+  }
 
-inline int64_t get(Type<int64_t>, sqlite3_value **v, int const index) {
-  return sqlite3_value_int64(v[index]);
-}
+  template <typename T>
+  static aux<T> get(sqlite3_context *ctx, sqlite3_value **v, int const index) {
+    if (auto *cached = (T *)sqlite3_get_auxdata(ctx, index))
+      return aux<T>(cached, nullptr);
 
-inline double get(Type<double>, sqlite3_value **v, int const index) {
-  return sqlite3_value_double(v[index]);
-}
+    auto val = make<T>(v, index);
+    T *raw = val.release();
+    sqlite3_set_auxdata(ctx, index, raw, [](void *p) { delete (T *)p; });
+
+    // NOTE(acer): sqlite3 may discard auxdata during sqlite3_set_auxdata()
+    if (sqlite3_get_auxdata(ctx, index) == raw) return aux<T>(raw, nullptr);
+    std::shared_ptr<T> owned = make<T>(v, index);
+    return aux<T>(owned.get(), owned);
+  }
+};
 
-inline std::string get(Type<std::string>, sqlite3_value **v, int const index) {
-  return std::string((char const *)sqlite3_value_text(v[index]),
-                     (size_t)sqlite3_value_bytes(v[index]));
+// Get function argument; forwards to |get()| except for those need
+// sqlite3_context.
+template <typename T>
+inline decltype(auto) get_arg(Type<T>, sqlite3_context *, sqlite3_value **v,
+                              int const index) {
+  return get(Type<T>{}, v, index);
 }
 
-inline std::string_view get(Type<std::string_view>, sqlite3_value **v,
-                            int const index) {
-  return std::string_view((char const *)sqlite3_value_text(v[index]),
-                          (size_t)sqlite3_value_bytes(v[index]));
+template <typename T>
+inline aux<T> get_arg(Type<aux<T>>, sqlite3_context *ctx, sqlite3_value **v,
+                      int const index) {
+  return aux_factory::get<T>(ctx, v, index);
 }
 /**
  * Helpers for setting result of scalar functions.
  */
 template <typename T>
-constexpr bool can_convert_to_string_view_v =
-    std::is_convertible_v<std::decay_t<T>, std::string_view>;
-
-template <typename T,
-          std::enable_if_t<can_convert_to_string_view_v<T>, bool> = true>
 inline void result(T const &val, sqlite3_context *ctx) {
-  std::string_view sv(val);
-  sqlite3_result_text(ctx, sv.data(), sv.size(), SQLITE_TRANSIENT);
-}
-
-template <typename T,
-          std::enable_if_t<!can_convert_to_string_view_v<T>, bool> = true>
-inline void result(T val, sqlite3_context *ctx) {
-  if constexpr (std::is_same_v<T, int>) {
-    sqlite3_result_int(ctx, val);
-  } else if (std::is_same_v<T, int64_t>) {
-    sqlite3_result_int64(ctx, val);
-  } else if (std::is_same_v<T, double>) {
-    sqlite3_result_double(ctx, val);
-  } else {
-    assert(false);
-  }
+  type_traits<std::decay_t<T>>::result(ctx, val);
 }
 
 /**
@@ -246,27 +421,28 @@ inline void result(T val, sqlite3_context *ctx) {
  * (registered via sqlite3_create_function).
  */
 template <typename R, typename... Args, int... Is>
-R invoke(std::function<R(Args...)> func, int argc, sqlite3_value **argv,
-         indexes<Is...>) {
+R invoke(std::function<R(Args...)> const &func, sqlite3_context *ctx,
+         int argc, sqlite3_value **argv, indexes<Is...>) {
   // TODO Check argc
   // Expand argv per index
-  return func(get(Type<Args>{}, argv, Is)...);
+  return func(get_arg(Type<std::decay_t<Args>>{}, ctx, argv, Is)...);
 }
 
 template <typename R, typename... Args>
-R invoke(std::function<R(Args...)> func, int argc, sqlite3_value **argv) {
-  return invoke(func, argc, argv, make_indexes_t<sizeof...(Args)>{});
+R invoke(std::function<R(Args...)> const &func, sqlite3_context *ctx,
+         int argc, sqlite3_value **argv) {
+  return invoke(func, ctx, argc, argv, make_indexes_t<sizeof...(Args)>{});
 }
 
 template <typename R, typename... Args>
 auto make_invoker(std::function<R(Args...)> &&func) {
   if constexpr (std::is_void_v<R>) {
     return [func](sqlite3_context *ctx, int argc, sqlite3_value **argv) {
-      invoke(func, argc, argv);
+      invoke(func, ctx, argc, argv);
     };
   } else {
     return [func](sqlite3_context *ctx, int argc, sqlite3_value **argv) {
-      result(invoke(func, argc, argv), ctx);
+      result(invoke(func, ctx, argc, argv), ctx);
     };
   }
 }
@@ -326,7 +502,7 @@ std::tuple<Cols...> row::to() const {
   std::tuple<Cols...> result;
   detail::enumerate(
       [this](int index, auto &&tuple_value) {
-        return detail::get_col_val_aux(m_stmt, m_db, index, tuple_value);
+        detail::get_col_val(m_stmt, index, tuple_value);
       },
       result);
   return result;
@@ -350,6 +526,54 @@ cursor &cursor::execute(std::string const &sql, Args &&...args) {
   return *this;
 }
 
+template <typename... Args>
+result<bool> cursor::try_execute(std::string const &sql,
+                                 Args &&...args) noexcept {
+  sqlite3_stmt *stmt = 0;
+  int ec = 0;
+
+  if (0 != (ec = sqlite3_prepare_v2(m_db, sql.c_str(), sql.size(), &stmt, 0)))
+    return {ec, m_db};
+
+  m_stmt.reset(stmt);
+  if (0 !=
+      (ec = detail::try_bind_to_stmt(stmt, 1, std::forward<Args>(args)...)))
+    return {ec, m_db};
+  return try_step();
+}
+
+template <typename... Args>
+result<> cursor::try_bind(Args &&...args) noexcept {
+  if (!m_stmt) return {SQLITE_MISUSE, nullptr};
+
+  sqlite3_reset(m_stmt.get());
+  sqlite3_clear_bindings(m_stmt.get());
+  int ec = detail::try_bind_to_stmt(m_stmt.get(), 1,
+                                    std::forward<Args>(args)...);
+  if (ec) return {ec, m_db};
+  return {};
+}
+
+template <typename... Cols>
+result<std::tuple<Cols...>> cursor::try_to() const noexcept {
+  if (!m_stmt) return {SQLITE_MISUSE, nullptr};
+
+  // NOTE(acer): Only allocations and conversions of type_traits may throw
+  try {
+    std::tuple<Cols...> result;
+    detail::enumerate(
+        [this](int index, auto &&tuple_value) {
+          detail::get_col_val(m_stmt.get(), index, tuple_value);
+        },
+        result);
+    return result;
+  } catch (error const &e) {
+    return {e.code, m_db};
+  } catch (std::bad_alloc const &) {
+    return {SQLITE_NOMEM, nullptr};
+  }
+}
+
 /**
  * database impl
  */
@@ -0,0 +1,212 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_change_stream.h"
+#include <iterator>
+
+namespace sqlite3cpp {
+
+namespace {
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+change_value to_change_value(sqlite3_value *v) {
+  if (!v) return nullptr;
+  switch (sqlite3_value_type(v)) {
+    case SQLITE_INTEGER:
+      return (int64_t)sqlite3_value_int64(v);
+    case SQLITE_FLOAT:
+      return sqlite3_value_double(v);
+    case SQLITE_TEXT:
+      return std::string((char const *)sqlite3_value_text(v),
+                         (size_t)sqlite3_value_bytes(v));
+    case SQLITE_BLOB: {
+      auto *p = (unsigned char const *)sqlite3_value_blob(v);
+      return std::vector<unsigned char>(p, p + sqlite3_value_bytes(v));
+    }
+    default:
+      return nullptr;
+  }
+}
+#endif
+}  // namespace
+
+/**
+ * change_stream impl
+ */
+change_stream::change_stream(database &db) : change_stream(db, {}) {}
+
+change_stream::change_stream(database &db, params_t const &params)
+    : m_db(db), m_params(params), m_ring(params.capacity) {
+  change_listener listener;
+
+  // NOTE(acer): The pre-update hook reports the same changes as the update
+  // hook, so only one of them feeds |m_pending|.
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+  if (m_params.capture_values) {
+    listener.preupdate = [this](sqlite3 *db, int op, char const *name,
+                                char const *table, sqlite3_int64 key1,
+                                sqlite3_int64 key2) {
+      on_preupdate(db, op, name, table, key1, key2);
+    };
+  }
+#endif
+  if (!listener.preupdate) {
+    listener.update = [this](int op, char const *db, char const *table,
+                             sqlite3_int64 rowid) {
+      on_update(op, db, table, rowid);
+    };
+  }
+  listener.commit = [this] { on_commit(); };
+  listener.committed = [this] { on_committed(); };
+  listener.rollback = [this] { on_rollback(); };
+  m_listener = m_db.add_change_listener(std::move(listener));
+}
+
+change_stream::~change_stream() { m_db.remove_change_listener(m_listener); }
+
+void change_stream::subscribe(subscriber_t subscriber) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto subs = m_subscribers
+                  ? std::make_shared<std::vector<subscriber_t>>(*m_subscribers)
+                  : std::make_shared<std::vector<subscriber_t>>();
+  subs->push_back(std::move(subscriber));
+  m_subscribers = std::move(subs);
+}
+
+size_t change_stream::poll(size_t max) {
+  std::lock_guard<std::mutex> poll_lk(m_poll_mutex);
+  size_t cnt = 0;
+  change_event e;
+  while (cnt < max && m_ring.pop(e)) {
+    // NOTE(acer): Subscribers are called on a snapshot without |m_mutex|
+    // held; one added by a subscriber sees the next event.
+    std::shared_ptr<std::vector<subscriber_t> const> subs;
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      subs = m_subscribers;
+    }
+    if (subs) {
+      for (auto &s : *subs) s(e);
+    }
+    ++cnt;
+  }
+  return cnt;
+}
+
+void change_stream::on_update(int op, char const *db, char const *table,
+                              sqlite3_int64 rowid) {
+  change_event e;
+  e.op = (change_event::op_t)op;
+  e.db = db;
+  e.table = table;
+  e.rowid = rowid;
+  m_pending.push_back(std::move(e));
+}
+
+void change_stream::on_commit() {
+  // NOTE(acer): A COMMIT retried after SQLITE_BUSY calls the commit hook
+  // again with changes made in between.
+  if (m_staged.empty()) {
+    m_staged.swap(m_pending);
+  } else {
+    std::move(m_pending.begin(), m_pending.end(),
+              std::back_inserter(m_staged));
+    m_pending.clear();
+  }
+}
+
+void change_stream::on_committed() {
+  if (m_staged.empty()) return;
+
+  uint64_t txn = ++m_txn;
+  if (m_overflowed) {
+    change_event marker;
+    marker.txn = txn;
+    m_overflowed = !m_ring.push(std::move(marker));
+  }
+
+  size_t i = 0;
+  if (!m_overflowed) {
+    for (; i < m_staged.size(); ++i) {
+      m_staged[i].txn = txn;
+      if (!m_ring.push(std::move(m_staged[i]))) break;
+    }
+  }
+  if (i < m_staged.size()) {
+    m_dropped += m_staged.size() - i;
+    m_overflowed = true;
+  }
+  m_staged.clear();
+}
+
+void change_stream::on_rollback() {
+  m_pending.clear();
+  m_staged.clear();
+}
+
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+void change_stream::on_preupdate(sqlite3 *db, int op, char const *name,
+                                 char const *table, sqlite3_int64 key1,
+                                 sqlite3_int64 key2) {
+  change_event e;
+  e.op = (change_event::op_t)op;
+  e.db = name;
+  e.table = table;
+  e.rowid = op == SQLITE_DELETE ? key1 : key2;
+
+  try {
+    int const cols = sqlite3_preupdate_count(db);
+    sqlite3_value *v = nullptr;
+    if (op != SQLITE_INSERT) {
+      e.old_values.reserve(cols);
+      for (int i = 0; i < cols; ++i) {
+        v = nullptr;
+        sqlite3_preupdate_old(db, i, &v);
+        e.old_values.push_back(to_change_value(v));
+      }
+    }
+    if (op != SQLITE_DELETE) {
+      e.new_values.reserve(cols);
+      for (int i = 0; i < cols; ++i) {
+        v = nullptr;
+        sqlite3_preupdate_new(db, i, &v);
+        e.new_values.push_back(to_change_value(v));
+      }
+    }
+    m_pending.push_back(std::move(e));
+  } catch (...) {
+    // Out of memory; subscribers are told to resync on next commit.
+    m_overflowed = true;
+  }
+}
+#endif
+
+}  // namespace sqlite3cpp
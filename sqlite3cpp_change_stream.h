@@ -0,0 +1,152 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <variant>
+#include <vector>
+#include "sqlite3cpp.h"
+#include "sqlite3cpp_ring.h"
+
+namespace sqlite3cpp {
+
+using change_value = std::variant<std::nullptr_t, int64_t, double,
+                                  std::string, std::vector<unsigned char>>;
+
+struct change_event {
+  enum op_t {
+    // Events were dropped since the ring buffer was full. Subscribers should
+    // treat all cached data as stale.
+    overflow = 0,
+    insert = SQLITE_INSERT,
+    update = SQLITE_UPDATE,
+    remove = SQLITE_DELETE,
+  };
+
+  op_t op = overflow;
+  // Sequence number of the committed transaction the change belongs to.
+  uint64_t txn = 0;
+  std::string db;
+  std::string table;
+  sqlite3_int64 rowid = 0;
+  // Values of the row before and after the change. Available only when
+  // captured via the pre-update hook. See |change_stream::params_t|.
+  std::vector<change_value> old_values;
+  std::vector<change_value> new_values;
+};
+
+struct SQLITE3CPP_EXPORT change_stream {
+  // Stream of committed row changes of a database. e.g.
+  //
+  // change_stream changes(db);
+  // changes.subscribe([](change_event const &e) {
+  //   cache.invalidate(e.table, e.rowid);
+  // });
+  //
+  // db.execute("update T set b = 'x' where a = 1");
+  // changes.poll();  // Invoke subscribers with committed changes
+  //
+  // Changes are buffered per transaction on the writer thread and published
+  // to a lock-free ring buffer once the commit has succeeded, i.e. by the
+  // next step of a cursor on |db| (see |database::flush_changes()|).
+  // Changes of a rolled back transaction, or of a COMMIT failed with
+  // SQLITE_BUSY and then rolled back, are discarded. Subscribers are invoked
+  // by |poll()| on the calling thread, without locks held, so they may call
+  // |subscribe()|.
+  //
+  // Note that changes undone by `rollback to <savepoint>` are still reported
+  // as sqlite3 does not notify savepoint rollbacks.
+
+  struct params_t {
+    // Capacity of the ring buffer in events.
+    size_t capacity = 4096;
+    // Capture old/new values of changed rows via `sqlite3_preupdate_hook`.
+    // Requires sqlite3 built with SQLITE_ENABLE_PREUPDATE_HOOK; ignored
+    // otherwise. Can not be combined with a |session| on the same database
+    // (see |database::add_change_listener()|).
+    bool capture_values = false;
+  };
+
+  using subscriber_t = std::function<void(change_event const &)>;
+
+  change_stream(database &db);
+  change_stream(database &db, params_t const &params);
+  ~change_stream();
+
+  change_stream(change_stream const &) = delete;
+  change_stream &operator=(change_stream const &) = delete;
+
+  // Add a subscriber. Subscribers are invoked in order of subscription.
+  void subscribe(subscriber_t subscriber);
+
+  // Deliver at most |max| published events to subscribers. Returns number of
+  // delivered events. Thread-safe.
+  size_t poll(size_t max = SIZE_MAX);
+
+  // Number of events dropped due to a full ring buffer.
+  uint64_t dropped() const noexcept { return m_dropped.load(); }
+
+ private:
+  void on_update(int op, char const *db, char const *table,
+                 sqlite3_int64 rowid);
+  void on_commit();
+  void on_committed();
+  void on_rollback();
+#ifdef SQLITE_ENABLE_PREUPDATE_HOOK
+  void on_preupdate(sqlite3 *db, int op, char const *name, char const *table,
+                    sqlite3_int64 key1, sqlite3_int64 key2);
+#endif
+
+  database &m_db;
+  params_t m_params;
+  int m_listener = -1;
+
+  // Producer side, accessed by the thread executing statements
+  std::vector<change_event> m_pending;
+  // Changes of a transaction whose commit is not confirmed yet
+  std::vector<change_event> m_staged;
+  uint64_t m_txn = 0;
+  bool m_overflowed = false;
+  std::atomic<uint64_t> m_dropped{0};
+
+  detail::spsc_ring<change_event> m_ring;
+
+  // Consumer side. |m_poll_mutex| serializes consumers of |m_ring| and
+  // |m_mutex| guards |m_subscribers|, which is replaced on subscription.
+  std::mutex m_poll_mutex;
+  std::mutex m_mutex;
+  std::shared_ptr<std::vector<subscriber_t> const> m_subscribers;
+};
+
+}  // namespace sqlite3cpp
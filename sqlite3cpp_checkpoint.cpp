@@ -0,0 +1,184 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_checkpoint.h"
+#include <algorithm>
+
+namespace sqlite3cpp {
+
+namespace {
+std::string main_filename(database &db) {
+  char const *fn = sqlite3_db_filename(db.get(), "main");
+  // In-memory and temporary databases have no WAL to checkpoint
+  if (!fn || !*fn) throw error(SQLITE_MISUSE);
+  return fn;
+}
+}  // namespace
+
+/**
+ * checkpoint_manager impl
+ */
+checkpoint_manager::checkpoint_manager(database &db)
+    : checkpoint_manager(db, {}) {}
+
+checkpoint_manager::checkpoint_manager(database &db, params_t const &params)
+    : m_db(db), m_ckpt_db(main_filename(db)), m_params(params) {
+  std::tie(m_autocheckpoint) =
+      m_db.execute("pragma wal_autocheckpoint").begin()->to<int>();
+
+  // NOTE(acer): This also makes the checkpoint connection open the WAL.
+  // Otherwise checkpoints on it see an empty log.
+  auto [mode] =
+      m_ckpt_db.execute("pragma journal_mode").begin()->to<std::string>();
+  if (mode != "wal") throw error(SQLITE_MISUSE);
+  sqlite3_busy_timeout(m_ckpt_db.get(), m_params.busy_timeout_ms);
+
+  // NOTE(acer): wal_autocheckpoint is implemented atop the WAL hook, so
+  // disable it first and then take over the hook.
+  sqlite3_wal_autocheckpoint(m_db.get(), 0);
+  sqlite3_wal_hook(m_db.get(), &checkpoint_manager::on_wal_commit, this);
+
+  m_thread = std::thread([this] { run(); });
+}
+
+checkpoint_manager::~checkpoint_manager() {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_one();
+  m_thread.join();
+  sqlite3_wal_autocheckpoint(m_db.get(), m_autocheckpoint);
+}
+
+void checkpoint_manager::checkpoint_now() noexcept {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_forced = true;
+  }
+  m_cond.notify_one();
+}
+
+checkpoint_manager::metrics_t checkpoint_manager::metrics() const {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_metrics;
+}
+
+int checkpoint_manager::on_wal_commit(void *self, sqlite3 *, char const *,
+                                      int frames) {
+  auto *mgr = (checkpoint_manager *)self;
+  bool due = false;
+  {
+    std::lock_guard<std::mutex> lk(mgr->m_mutex);
+    mgr->m_frames = frames;
+    due = frames >= mgr->m_params.wal_frames;
+  }
+  if (due) mgr->m_cond.notify_one();
+  return SQLITE_OK;
+}
+
+int checkpoint_manager::checkpoint(int mode, int &frames,
+                                   int &checkpointed) noexcept {
+  frames = checkpointed = 0;
+  return sqlite3_wal_checkpoint_v2(m_ckpt_db.get(), "main", mode, &frames,
+                                   &checkpointed);
+}
+
+void checkpoint_manager::run() noexcept {
+  using namespace std::chrono;
+
+  auto last = steady_clock::now();
+  int incomplete = 0;
+  std::unique_lock<std::mutex> lk(m_mutex);
+
+  while (!m_stop) {
+    m_cond.wait_for(lk, m_params.interval, [this] {
+      return m_stop || m_forced || m_frames >= m_params.wal_frames;
+    });
+    if (m_stop) break;
+
+    auto const pending = m_frames;
+    bool const due = m_forced || pending >= m_params.wal_frames ||
+                     (pending > 0 && steady_clock::now() - last >=
+                                         m_params.interval);
+    if (!due) continue;
+    m_forced = false;
+    lk.unlock();
+
+    int mode = SQLITE_CHECKPOINT_PASSIVE;
+    if (pending >= m_params.truncate_frames)
+      mode = SQLITE_CHECKPOINT_TRUNCATE;
+    else if (pending >= m_params.restart_frames ||
+             incomplete >= m_params.restart_after_incomplete)
+      mode = SQLITE_CHECKPOINT_RESTART;
+
+    int frames = 0, checkpointed = 0;
+    auto const start = steady_clock::now();
+    int ec = checkpoint(mode, frames, checkpointed);
+    last = steady_clock::now();
+    auto const elapsed = duration_cast<microseconds>(last - start);
+
+    // A PASSIVE checkpoint may report frames that were not copied back due to
+    // concurrent readers; remember that for escalation.
+    bool const complete = ec == SQLITE_OK && checkpointed >= frames;
+    incomplete = complete ? 0 : incomplete + 1;
+
+    lk.lock();
+    auto &m = m_metrics;
+    m.checkpoints += 1;
+    switch (mode) {
+      case SQLITE_CHECKPOINT_PASSIVE:
+        m.passive += 1;
+        break;
+      case SQLITE_CHECKPOINT_RESTART:
+        m.restart += 1;
+        break;
+      default:
+        m.truncate += 1;
+        break;
+    }
+    if (ec == SQLITE_BUSY) m.busy += 1;
+    m.last_error = ec;
+    m.last_frames_logged = std::max(frames, 0);
+    m.last_frames_checkpointed = std::max(checkpointed, 0);
+    m.frames_logged += m.last_frames_logged;
+    m.frames_checkpointed += m.last_frames_checkpointed;
+    m.last_duration = elapsed;
+    m.max_duration = std::max(m.max_duration, elapsed);
+    m.total_duration += elapsed;
+
+    // Writers may have appended frames meanwhile; keep the newer count.
+    if (complete && m_frames == pending) m_frames = 0;
+  }
+}
+
+}  // namespace sqlite3cpp
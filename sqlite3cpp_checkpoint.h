@@ -0,0 +1,133 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT checkpoint_manager {
+  // Move WAL checkpoints off the commit path of a writer connection.
+  //
+  // database db("app.db");
+  // db.executescript("pragma journal_mode=wal;");
+  // checkpoint_manager ckpt(db);
+  //
+  // Auto-checkpoint of |db| is disabled while the manager is alive. WAL growth
+  // is observed via `sqlite3_wal_hook` and checkpoints are run on a dedicated
+  // connection by a background thread. A checkpoint starts as PASSIVE and is
+  // escalated to RESTART or TRUNCATE when the WAL keeps growing.
+  //
+  // Note that `sqlite3_wal_hook` is a per connection slot. Do not install
+  // another WAL hook on |db| while the manager is alive. Also, RESTART and
+  // TRUNCATE checkpoints block writers for a short while, so writers are
+  // expected to have a busy handler, e.g. `sqlite3_busy_timeout()`.
+
+  struct params_t {
+    // Run a checkpoint once the WAL holds at least this many frames.
+    int wal_frames = 1000;
+    // Run a checkpoint if the WAL is not empty and this much time has passed
+    // since the previous one.
+    std::chrono::milliseconds interval{1000};
+    // Escalate to RESTART when the WAL holds at least this many frames or
+    // after this many consecutive PASSIVE checkpoints left frames behind.
+    int restart_frames = 4000;
+    int restart_after_incomplete = 4;
+    // Escalate to TRUNCATE when the WAL holds at least this many frames.
+    int truncate_frames = 16000;
+    // Busy timeout of the checkpoint connection for RESTART/TRUNCATE.
+    int busy_timeout_ms = 100;
+  };
+
+  struct metrics_t {
+    uint64_t checkpoints = 0;
+    uint64_t passive = 0;
+    uint64_t restart = 0;
+    uint64_t truncate = 0;
+    uint64_t busy = 0;
+    // Sum of WAL frames seen and frames copied back to the database over all
+    // checkpoints.
+    uint64_t frames_logged = 0;
+    uint64_t frames_checkpointed = 0;
+    // Frames of the latest checkpoint.
+    int last_frames_logged = 0;
+    int last_frames_checkpointed = 0;
+    int last_error = SQLITE_OK;
+    std::chrono::microseconds last_duration{0};
+    std::chrono::microseconds max_duration{0};
+    std::chrono::microseconds total_duration{0};
+  };
+
+  // Attach to |db|. The database must be a file in WAL mode. Throws
+  // sqlite3cpp::error if a checkpoint connection can not be opened.
+  checkpoint_manager(database &db);
+  checkpoint_manager(database &db, params_t const &params);
+
+  // Stop the background thread and restore auto-checkpoint of |db|.
+  ~checkpoint_manager();
+
+  checkpoint_manager(checkpoint_manager const &) = delete;
+  checkpoint_manager &operator=(checkpoint_manager const &) = delete;
+
+  // Wake up the background thread to checkpoint regardless of thresholds.
+  void checkpoint_now() noexcept;
+
+  // Snapshot of metrics collected so far.
+  metrics_t metrics() const;
+
+ private:
+  static int on_wal_commit(void *self, sqlite3 *db, char const *name,
+                           int frames);
+  void run() noexcept;
+  int checkpoint(int mode, int &frames, int &checkpointed) noexcept;
+
+  database &m_db;
+  database m_ckpt_db;
+  params_t m_params;
+  int m_autocheckpoint = 0;
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cond;
+  int m_frames = 0;
+  bool m_forced = false;
+  bool m_stop = false;
+  metrics_t m_metrics;
+  std::thread m_thread;
+};
+
+}  // namespace sqlite3cpp
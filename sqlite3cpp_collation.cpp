@@ -0,0 +1,147 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_collation.h"
+#include <algorithm>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define SQLITE3CPP_COLLATION_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace sqlite3cpp {
+
+namespace {
+
+inline unsigned char fold(char c) noexcept {
+  auto u = (unsigned char)c;
+  return u >= 'A' && u <= 'Z' ? u + ('a' - 'A') : u;
+}
+
+inline bool is_digit(char c) noexcept { return c >= '0' && c <= '9'; }
+
+inline int sign(int64_t v) noexcept { return (v > 0) - (v < 0); }
+
+#ifdef SQLITE3CPP_COLLATION_SSE2
+inline __m128i fold16(__m128i v) noexcept {
+  // NOTE(acer): Signed comparison excludes bytes >= 0x80 (negative)
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+  return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+#endif
+
+int ascii_nocase(void *, int lsize, void const *lhs, int rsize,
+                 void const *rhs) {
+  return ascii_nocase_compare(
+      std::string_view((char const *)lhs, (size_t)lsize),
+      std::string_view((char const *)rhs, (size_t)rsize));
+}
+
+int natural(void *, int lsize, void const *lhs, int rsize, void const *rhs) {
+  return natural_compare(std::string_view((char const *)lhs, (size_t)lsize),
+                         std::string_view((char const *)rhs, (size_t)rsize));
+}
+
+}  // namespace
+
+int ascii_nocase_compare(std::string_view lhs, std::string_view rhs) noexcept {
+  size_t const n = std::min(lhs.size(), rhs.size());
+  char const *l = lhs.data(), *r = rhs.data();
+  size_t i = 0;
+
+#ifdef SQLITE3CPP_COLLATION_SSE2
+  for (; i + 16 <= n; i += 16) {
+    __m128i a = fold16(_mm_loadu_si128((__m128i const *)(l + i)));
+    __m128i b = fold16(_mm_loadu_si128((__m128i const *)(r + i)));
+    unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xffff;
+    if (diff) {
+      i += (size_t)__builtin_ctz(diff);
+      return (int)fold(l[i]) - (int)fold(r[i]);
+    }
+  }
+#endif
+
+  for (; i < n; ++i) {
+    int d = (int)fold(l[i]) - (int)fold(r[i]);
+    if (d) return d;
+  }
+  return sign((int64_t)lhs.size() - (int64_t)rhs.size());
+}
+
+int natural_compare(std::string_view lhs, std::string_view rhs) noexcept {
+  size_t i = 0, j = 0;
+  size_t const m = lhs.size(), n = rhs.size();
+
+  while (i < m && j < n) {
+    if (!is_digit(lhs[i]) || !is_digit(rhs[j])) {
+      if (lhs[i] != rhs[j])
+        return (int)(unsigned char)lhs[i] - (int)(unsigned char)rhs[j];
+      ++i, ++j;
+      continue;
+    }
+
+    // Compare numbers by count of significant digits then by the digits
+    size_t zi = i, zj = j;
+    while (zi < m && lhs[zi] == '0') ++zi;
+    while (zj < n && rhs[zj] == '0') ++zj;
+    size_t ei = zi, ej = zj;
+    while (ei < m && is_digit(lhs[ei])) ++ei;
+    while (ej < n && is_digit(rhs[ej])) ++ej;
+
+    if (ei - zi != ej - zj) return ei - zi < ej - zj ? -1 : 1;
+    int d = lhs.compare(zi, ei - zi, rhs.substr(zj, ej - zj));
+    if (d) return d;
+    if (zi - i != zj - j) return zi - i < zj - j ? -1 : 1;
+    i = ei, j = ej;
+  }
+  return sign((int64_t)(m - i) - (int64_t)(n - j));
+}
+
+void create_collations(database &db) {
+  struct coll {
+    char const *name;
+    int (*cmp)(void *, int, void const *, int, void const *);
+  } const colls[] = {
+      {"ascii_nocase", &ascii_nocase},
+      {"natural_order", &natural},
+  };
+
+  int ec = 0;
+  for (auto const &c : colls) {
+    if (0 != (ec = sqlite3_create_collation_v2(db.get(), c.name, SQLITE_UTF8,
+                                               nullptr, c.cmp, nullptr)))
+      throw error(ec);
+  }
+}
+
+}  // namespace sqlite3cpp
@@ -0,0 +1,65 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+// Compare ASCII case-insensitively, the same order as sqlite3 NOCASE. Bytes
+// are folded and compared 16 at a time with SSE2 where available.
+SQLITE3CPP_EXPORT int ascii_nocase_compare(std::string_view lhs,
+                                           std::string_view rhs) noexcept;
+
+// Compare runs of digits by numeric value and other bytes as they are,
+// e.g. "file2" < "file10". Numbers of the same value order by leading
+// zeros, fewer first ("1" < "01"), s.t. only equal strings compare equal.
+SQLITE3CPP_EXPORT int natural_compare(std::string_view lhs,
+                                      std::string_view rhs) noexcept;
+
+// Register prebuilt collations to |db|:
+//
+//   ascii_nocase   ascii_nocase_compare()
+//   natural_order  natural_compare()
+//
+// e.g.
+//
+// create_collations(db);
+// db.execute("create index I on T(name collate natural_order)");
+//
+// Those are registered via sqlite3 directly instead of
+// |database::create_collation()| to save the std::function call per
+// comparison.
+SQLITE3CPP_EXPORT void create_collations(database &db);
+
+}  // namespace sqlite3cpp
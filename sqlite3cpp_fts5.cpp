@@ -0,0 +1,231 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_fts5.h"
+
+#ifdef SQLITE_ENABLE_FTS5
+
+namespace sqlite3cpp {
+
+namespace {
+
+fts5_api *get_fts5_api(database &db) {
+  sqlite3_stmt *stmt = nullptr;
+  int ec = 0;
+  if (0 != (ec = sqlite3_prepare_v2(db.get(), "select fts5(?1)", -1, &stmt,
+                                    nullptr)))
+    throw error(ec);
+  std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> guard(stmt);
+
+  fts5_api *api = nullptr;
+  sqlite3_bind_pointer(stmt, 1, (void *)&api, "fts5_api_ptr", nullptr);
+  if (SQLITE_ROW != (ec = sqlite3_step(stmt))) throw error(ec);
+  if (!api) throw error(SQLITE_ERROR);
+  return api;
+}
+
+void check(int ec) {
+  if (ec) throw error(ec);
+}
+
+}  // namespace
+
+/**
+ * fts5_token_sink impl
+ */
+bool fts5_token_sink::operator()(std::string_view token, int flags) {
+  size_t start = (size_t)(token.data() - m_text);
+  return (*this)(token, start, start + token.size(), flags);
+}
+
+bool fts5_token_sink::operator()(std::string_view token, size_t start,
+                                 size_t end, int flags) {
+  if (m_rc) return false;
+  m_rc = m_xtoken(m_ctx, flags, token.data(), (int)token.size(), (int)start,
+                  (int)end);
+  return m_rc == SQLITE_OK;
+}
+
+/**
+ * fts5_context impl
+ */
+int fts5_context::column_count() const { return m_api->xColumnCount(m_fts); }
+
+int64_t fts5_context::row_count() const {
+  sqlite3_int64 n = 0;
+  check(m_api->xRowCount(m_fts, &n));
+  return n;
+}
+
+int64_t fts5_context::column_total_size(int column) const {
+  sqlite3_int64 n = 0;
+  check(m_api->xColumnTotalSize(m_fts, column, &n));
+  return n;
+}
+
+int fts5_context::column_size(int column) const {
+  int n = 0;
+  check(m_api->xColumnSize(m_fts, column, &n));
+  return n;
+}
+
+std::string_view fts5_context::column_text(int column) const {
+  char const *p = nullptr;
+  int n = 0;
+  check(m_api->xColumnText(m_fts, column, &p, &n));
+  return p ? std::string_view(p, (size_t)n) : std::string_view();
+}
+
+int64_t fts5_context::rowid() const { return m_api->xRowid(m_fts); }
+
+int fts5_context::phrase_count() const { return m_api->xPhraseCount(m_fts); }
+
+int fts5_context::phrase_size(int phrase) const {
+  return m_api->xPhraseSize(m_fts, phrase);
+}
+
+int fts5_context::inst_count() const {
+  int n = 0;
+  check(m_api->xInstCount(m_fts, &n));
+  return n;
+}
+
+fts5_context::inst_t fts5_context::inst(int index) const {
+  inst_t i{};
+  check(m_api->xInst(m_fts, index, &i.phrase, &i.column, &i.offset));
+  return i;
+}
+
+/**
+ * Registration
+ */
+struct fts5_function_access {
+  static void invoke(Fts5ExtensionApi const *api, Fts5Context *fts,
+                     sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+    auto *func = (detail::fts5_function_t *)api->xUserData(fts);
+    try {
+      (*func)(fts5_context(api, fts, argc, argv), ctx);
+    } catch (error const &e) {
+      sqlite3_result_error_code(ctx, e.code);
+    } catch (std::bad_alloc const &) {
+      sqlite3_result_error_nomem(ctx);
+    } catch (...) {
+      sqlite3_result_error_code(ctx, SQLITE_ABORT);
+    }
+  }
+};
+
+namespace detail {
+
+void create_fts5_tokenizer(database &db, std::string const &name,
+                           fts5_tokenizer *tokenizer) {
+  fts5_api *api = get_fts5_api(db);
+  check(api->xCreateTokenizer(api, name.c_str(), nullptr, tokenizer, nullptr));
+}
+
+void create_fts5_function(database &db, std::string const &name,
+                          fts5_function_t func) {
+  fts5_api *api = get_fts5_api(db);
+  auto f = std::make_unique<fts5_function_t>(std::move(func));
+  check(api->xCreateFunction(
+      api, name.c_str(), (void *)f.get(), &fts5_function_access::invoke,
+      [](void *p) { delete (fts5_function_t *)p; }));
+  f.release();
+}
+
+}  // namespace detail
+
+/**
+ * identifier_tokenizer impl
+ */
+namespace {
+enum char_class { other, lower, upper, digit };
+
+inline char_class classify(char c) noexcept {
+  auto u = (unsigned char)c;
+  if (u >= 'a' && u <= 'z') return lower;
+  if (u >= 'A' && u <= 'Z') return upper;
+  if (u >= '0' && u <= '9') return digit;
+  // Bytes of UTF-8 sequences are taken as lower case letters
+  return u >= 0x80 ? lower : other;
+}
+}  // namespace
+
+identifier_tokenizer::identifier_tokenizer(
+    std::vector<std::string_view> const &) {}
+
+void identifier_tokenizer::tokenize(std::string_view text, int,
+                                    fts5_token_sink &sink) {
+  size_t const n = text.size();
+  size_t i = 0;
+
+  while (i < n) {
+    char_class c = classify(text[i]);
+    if (c == other) {
+      ++i;
+      continue;
+    }
+
+    // Find end of the word piece started at |i|
+    size_t start = i++;
+    bool has_upper = c == upper;
+    for (; i < n; ++i) {
+      char_class next = classify(text[i]);
+      if (next == other || (next == digit) != (c == digit)) break;
+      if (next == upper && c != upper) break;  // fooBar
+      // HTTPResponse: the last upper case letter starts the next piece
+      if (next == lower && c == upper && i - start > 1) {
+        --i;
+        break;
+      }
+      has_upper |= next == upper;
+      c = next;
+    }
+
+    std::string_view piece = text.substr(start, i - start);
+    bool more = true;
+    if (!has_upper) {
+      more = sink(piece);
+    } else {
+      m_buf.assign(piece);
+      for (auto &ch : m_buf) {
+        if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+      }
+      more = sink(m_buf, start, i);
+    }
+    if (!more) return;
+  }
+}
+
+}  // namespace sqlite3cpp
+
+#endif
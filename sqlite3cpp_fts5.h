@@ -0,0 +1,233 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <vector>
+#include "sqlite3cpp.h"
+
+#ifdef SQLITE_ENABLE_FTS5
+
+namespace sqlite3cpp {
+
+namespace detail {
+template <typename T>
+struct fts5_tokenizer_impl;
+}  // namespace detail
+
+struct SQLITE3CPP_EXPORT fts5_token_sink {
+  // Receive tokens from a tokenizer and pass them to FTS5. Returns false
+  // once FTS5 asks to stop; the tokenizer should return then, though
+  // further tokens are ignored anyway.
+
+  // Emit |token| which must view into the text being tokenized; its offsets
+  // are derived from the view.
+  bool operator()(std::string_view token, int flags = 0);
+
+  // Emit |token|, e.g. a normalized copy, for bytes [start, end) of the
+  // text being tokenized. |flags| can be FTS5_TOKEN_COLOCATED.
+  bool operator()(std::string_view token, size_t start, size_t end,
+                  int flags = 0);
+
+  int rc() const noexcept { return m_rc; }
+
+ private:
+  template <typename T>
+  friend struct detail::fts5_tokenizer_impl;
+
+  using xtoken_t = int (*)(void *, int, char const *, int, int, int);
+  fts5_token_sink(void *ctx, xtoken_t xtoken, char const *text) noexcept
+      : m_ctx(ctx), m_xtoken(xtoken), m_text(text) {}
+
+  void *m_ctx;
+  xtoken_t m_xtoken;
+  char const *m_text;
+  int m_rc = SQLITE_OK;
+};
+
+// Register tokenizer class |T| as |name| to FTS5 of |db|. e.g.
+//
+// create_fts5_tokenizer<identifier_tokenizer>(db, "identifier");
+// db.executescript(
+//     "create virtual table Doc using fts5(body, tokenize='identifier')");
+//
+// T must provide
+//
+// T::T(std::vector<std::string_view> const &args)
+// void T::tokenize(std::string_view text, int flags, fts5_token_sink &sink)
+//
+// where |args| follow the tokenizer name in `tokenize=` and |flags| are
+// FTS5_TOKENIZE_* of the request. An instance is created per FTS5 table and
+// used by one thread at a time. Exceptions thrown by T fail the statement.
+template <typename T>
+void create_fts5_tokenizer(database &db, std::string const &name);
+
+struct SQLITE3CPP_EXPORT fts5_context {
+  // Matched row of an FTS5 auxiliary function. Wraps `Fts5ExtensionApi`;
+  // errors raise sqlite3cpp::error. Positions are in tokens.
+
+  struct inst_t {
+    int phrase;
+    int column;
+    int offset;
+  };
+
+  // Number of columns of the table.
+  int column_count() const;
+  // Number of rows of the table.
+  int64_t row_count() const;
+  // Number of tokens in |column| of all rows; of all columns if negative.
+  int64_t column_total_size(int column = -1) const;
+  // Number of tokens in |column| of current row; of all columns if negative.
+  int column_size(int column = -1) const;
+  std::string_view column_text(int column) const;
+  int64_t rowid() const;
+
+  // Number of phrases in the query and tokens of a phrase.
+  int phrase_count() const;
+  int phrase_size(int phrase) const;
+  // Phrase matches in current row.
+  int inst_count() const;
+  inst_t inst(int index) const;
+
+  // SQL arguments following the table name, e.g. `f(Doc, 1.5)` has one.
+  int arg_count() const noexcept { return m_argc; }
+  sqlite3_value *arg(int index) const noexcept { return m_argv[index]; }
+
+  Fts5ExtensionApi const *api() const noexcept { return m_api; }
+  Fts5Context *get() const noexcept { return m_fts; }
+
+ private:
+  friend struct fts5_function_access;
+  fts5_context(Fts5ExtensionApi const *api, Fts5Context *fts, int argc,
+               sqlite3_value **argv) noexcept
+      : m_api(api), m_fts(fts), m_argc(argc), m_argv(argv) {}
+
+  Fts5ExtensionApi const *m_api;
+  Fts5Context *m_fts;
+  int m_argc;
+  sqlite3_value **m_argv;
+};
+
+// Register an auxiliary function |name| to FTS5 of |db|. |func| takes
+// fts5_context const & and returns int, int64_t, double, or std::string.
+// e.g.
+//
+// create_fts5_function(db, "hits", [](fts5_context const &ctx) {
+//   return ctx.inst_count();
+// });
+// db.execute("select rowid from Doc(?) order by hits(Doc) desc", query);
+template <typename FUNC>
+void create_fts5_function(database &db, std::string const &name, FUNC func);
+
+struct SQLITE3CPP_EXPORT identifier_tokenizer {
+  // Tokenizer for source code and other identifier-heavy text. Words are
+  // split on bytes other than ASCII letters, digits, and UTF-8 sequences,
+  // then on camelCase and letter/digit boundaries, and folded to ASCII
+  // lower case, e.g. "parseHTTPResponse_v2" gives parse, http, response, v,
+  // and 2. Tokens without upper case letters are emitted without copies.
+  identifier_tokenizer(std::vector<std::string_view> const &args);
+  void tokenize(std::string_view text, int flags, fts5_token_sink &sink);
+
+ private:
+  std::string m_buf;
+};
+
+/**
+ * Implementations
+ */
+namespace detail {
+
+using fts5_function_t =
+    std::function<void(fts5_context const &, sqlite3_context *)>;
+
+SQLITE3CPP_EXPORT void create_fts5_tokenizer(database &db,
+                                             std::string const &name,
+                                             fts5_tokenizer *tokenizer);
+SQLITE3CPP_EXPORT void create_fts5_function(database &db,
+                                            std::string const &name,
+                                            fts5_function_t func);
+
+template <typename T>
+struct fts5_tokenizer_impl {
+  static int create(void *, char const **argv, int argc,
+                    Fts5Tokenizer **out) {
+    try {
+      std::vector<std::string_view> args(argv, argv + argc);
+      *out = (Fts5Tokenizer *)new T(args);
+      return SQLITE_OK;
+    } catch (std::bad_alloc const &) {
+      return SQLITE_NOMEM;
+    } catch (...) {
+      return SQLITE_ERROR;
+    }
+  }
+
+  static void destroy(Fts5Tokenizer *tokenizer) { delete (T *)tokenizer; }
+
+  static int tokenize(Fts5Tokenizer *tokenizer, void *ctx, int flags,
+                      char const *text, int size,
+                      fts5_token_sink::xtoken_t xtoken) {
+    fts5_token_sink sink(ctx, xtoken, text);
+    try {
+      ((T *)tokenizer)->tokenize(std::string_view(text, (size_t)size), flags,
+                                 sink);
+    } catch (std::bad_alloc const &) {
+      return SQLITE_NOMEM;
+    } catch (...) {
+      return SQLITE_ERROR;
+    }
+    return sink.rc();
+  }
+};
+
+}  // namespace detail
+
+template <typename T>
+void create_fts5_tokenizer(database &db, std::string const &name) {
+  using impl = detail::fts5_tokenizer_impl<T>;
+  fts5_tokenizer tokenizer{&impl::create, &impl::destroy, &impl::tokenize};
+  detail::create_fts5_tokenizer(db, name, &tokenizer);
+}
+
+template <typename FUNC>
+void create_fts5_function(database &db, std::string const &name, FUNC func) {
+  detail::create_fts5_function(
+      db, name,
+      [func](fts5_context const &ctx, sqlite3_context *sctx) {
+        detail::result(func(ctx), sctx);
+      });
+}
+
+}  // namespace sqlite3cpp
+
+#endif
@@ -0,0 +1,455 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_io_stats.h"
+#include <algorithm>
+#include <cmath>
+
+namespace sqlite3cpp {
+
+namespace {
+
+// A file of io_stats_vfs; the file of the parent VFS follows in memory.
+struct io_file {
+  sqlite3_file base;
+  io_stats_vfs *vfs;
+  io_file_type type;
+
+  sqlite3_file *real() noexcept { return (sqlite3_file *)(this + 1); }
+};
+
+io_file_type file_type(int flags) noexcept {
+  if (flags & SQLITE_OPEN_MAIN_DB) return io_file_type::main_db;
+  if (flags & SQLITE_OPEN_WAL) return io_file_type::wal;
+  if (flags & (SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_SUPER_JOURNAL |
+               SQLITE_OPEN_SUBJOURNAL))
+    return io_file_type::journal;
+  if (flags & (SQLITE_OPEN_TEMP_DB | SQLITE_OPEN_TEMP_JOURNAL |
+               SQLITE_OPEN_TRANSIENT_DB))
+    return io_file_type::temp;
+  return io_file_type::other;
+}
+
+inline size_t bucket_of(uint64_t ns) noexcept {
+  size_t b = 0;
+#ifdef __GNUC__
+  if (ns) b = 63 - (size_t)__builtin_clzll(ns);
+#else
+  while (ns >>= 1) ++b;
+#endif
+  return std::min(b, io_stats::buckets - 1);
+}
+
+}  // namespace
+
+char const *to_string(io_file_type type) noexcept {
+  switch (type) {
+    case io_file_type::main_db:
+      return "main_db";
+    case io_file_type::wal:
+      return "wal";
+    case io_file_type::journal:
+      return "journal";
+    case io_file_type::temp:
+      return "temp";
+    default:
+      return "other";
+  }
+}
+
+char const *to_string(io_op op) noexcept {
+  switch (op) {
+    case io_op::read:
+      return "read";
+    case io_op::write:
+      return "write";
+    case io_op::sync:
+      return "sync";
+    case io_op::truncate:
+      return "truncate";
+    case io_op::lock:
+      return "lock";
+    case io_op::unlock:
+      return "unlock";
+    default:
+      return "shm_lock";
+  }
+}
+
+/**
+ * io_stats impl
+ */
+std::chrono::nanoseconds io_stats::op_stats::percentile(
+    double q) const noexcept {
+  uint64_t total = 0;
+  for (auto n : histogram) total += n;
+  if (!total) return std::chrono::nanoseconds{0};
+
+  auto rank = (uint64_t)std::ceil(std::clamp(q, 0.0, 1.0) * (double)total);
+  rank = std::max<uint64_t>(rank, 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets; ++i) {
+    seen += histogram[i];
+    if (seen < rank) continue;
+    if (i + 1 == buckets) break;
+    return std::min(max, std::chrono::nanoseconds((int64_t)1 << (i + 1)));
+  }
+  return max;
+}
+
+std::string io_stats::to_json() const {
+  std::string out = "{";
+  for (size_t t = 0; t < (size_t)io_file_type::count; ++t) {
+    std::string ops_json;
+    for (size_t o = 0; o < (size_t)io_op::count; ++o) {
+      auto const &s = ops[t][o];
+      if (!s.count) continue;
+      if (!ops_json.empty()) ops_json += ",";
+      ops_json += "\"" + std::string(to_string((io_op)o)) + "\":{";
+      ops_json += "\"count\":" + std::to_string(s.count);
+      ops_json += ",\"bytes\":" + std::to_string(s.bytes);
+      ops_json += ",\"total_ns\":" + std::to_string(s.total.count());
+      ops_json += ",\"max_ns\":" + std::to_string(s.max.count());
+      ops_json += ",\"p50_ns\":" + std::to_string(s.percentile(0.5).count());
+      ops_json += ",\"p99_ns\":" + std::to_string(s.percentile(0.99).count());
+      ops_json += ",\"histogram\":[";
+      for (size_t i = 0; i < buckets; ++i) {
+        if (i) ops_json += ",";
+        ops_json += std::to_string(s.histogram[i]);
+      }
+      ops_json += "]}";
+    }
+    if (ops_json.empty()) continue;
+    if (out.size() > 1) out += ",";
+    out += "\"" + std::string(to_string((io_file_type)t)) + "\":{" +
+           ops_json + "}";
+  }
+  return out + "}";
+}
+
+/**
+ * VFS and file methods
+ */
+struct io_stats_access {
+  static io_stats_vfs *self(sqlite3_vfs *vfs) {
+    return (io_stats_vfs *)vfs->pAppData;
+  }
+  static sqlite3_vfs *parent(sqlite3_vfs *vfs) { return self(vfs)->m_parent; }
+
+  template <typename F>
+  static int timed(sqlite3_file *file, io_op op, uint64_t bytes, F &&call) {
+    using namespace std::chrono;
+    auto *f = (io_file *)file;
+    auto start = steady_clock::now();
+    int rc = call(f->real());
+    f->vfs->record(f->type, op, bytes,
+                   duration_cast<nanoseconds>(steady_clock::now() - start));
+    return rc;
+  }
+
+  static sqlite3_io_methods const *methods(sqlite3_file *file) {
+    return ((io_file *)file)->real()->pMethods;
+  }
+
+  static int open(sqlite3_vfs *vfs, char const *name, sqlite3_file *file,
+                  int flags, int *out_flags) {
+    auto *f = (io_file *)file;
+    auto *s = self(vfs);
+    f->vfs = s;
+    f->type = file_type(flags);
+
+    sqlite3_file *real = f->real();
+    real->pMethods = nullptr;
+    int rc = s->m_parent->xOpen(s->m_parent, name, real, flags, out_flags);
+    // NOTE(acer): sqlite3 closes the file on failure iff methods are set
+    if (real->pMethods) {
+      int version = std::clamp(real->pMethods->iVersion, 1, 3);
+      f->base.pMethods = &s->m_methods[version - 1];
+    } else {
+      f->base.pMethods = nullptr;
+    }
+    return rc;
+  }
+
+  // Timed file methods
+  static int read(sqlite3_file *file, void *buf, int amount,
+                  sqlite3_int64 offset) {
+    return timed(file, io_op::read, (uint64_t)amount, [&](sqlite3_file *f) {
+      return f->pMethods->xRead(f, buf, amount, offset);
+    });
+  }
+  static int write(sqlite3_file *file, void const *buf, int amount,
+                   sqlite3_int64 offset) {
+    return timed(file, io_op::write, (uint64_t)amount, [&](sqlite3_file *f) {
+      return f->pMethods->xWrite(f, buf, amount, offset);
+    });
+  }
+  static int truncate(sqlite3_file *file, sqlite3_int64 size) {
+    return timed(file, io_op::truncate, (uint64_t)size, [&](sqlite3_file *f) {
+      return f->pMethods->xTruncate(f, size);
+    });
+  }
+  static int sync(sqlite3_file *file, int flags) {
+    return timed(file, io_op::sync, 0, [&](sqlite3_file *f) {
+      return f->pMethods->xSync(f, flags);
+    });
+  }
+  static int lock(sqlite3_file *file, int level) {
+    return timed(file, io_op::lock, 0, [&](sqlite3_file *f) {
+      return f->pMethods->xLock(f, level);
+    });
+  }
+  static int unlock(sqlite3_file *file, int level) {
+    return timed(file, io_op::unlock, 0, [&](sqlite3_file *f) {
+      return f->pMethods->xUnlock(f, level);
+    });
+  }
+  static int shm_lock(sqlite3_file *file, int offset, int n, int flags) {
+    return timed(file, io_op::shm_lock, 0, [&](sqlite3_file *f) {
+      return f->pMethods->xShmLock(f, offset, n, flags);
+    });
+  }
+
+  // Forwarded file methods
+  static int close(sqlite3_file *file) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xClose(real);
+  }
+  static int file_size(sqlite3_file *file, sqlite3_int64 *size) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xFileSize(real, size);
+  }
+  static int check_reserved_lock(sqlite3_file *file, int *out) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xCheckReservedLock(real, out);
+  }
+  static int file_control(sqlite3_file *file, int op, void *arg) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xFileControl(real, op, arg);
+  }
+  static int sector_size(sqlite3_file *file) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xSectorSize(real);
+  }
+  static int device_characteristics(sqlite3_file *file) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xDeviceCharacteristics(real);
+  }
+  static int shm_map(sqlite3_file *file, int region, int size, int extend,
+                     void volatile **out) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xShmMap(real, region, size, extend, out);
+  }
+  static void shm_barrier(sqlite3_file *file) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    real->pMethods->xShmBarrier(real);
+  }
+  static int shm_unmap(sqlite3_file *file, int del) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xShmUnmap(real, del);
+  }
+  static int fetch(sqlite3_file *file, sqlite3_int64 offset, int amount,
+                   void **out) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xFetch(real, offset, amount, out);
+  }
+  static int unfetch(sqlite3_file *file, sqlite3_int64 offset, void *p) {
+    sqlite3_file *real = ((io_file *)file)->real();
+    return real->pMethods->xUnfetch(real, offset, p);
+  }
+
+  // Forwarded VFS methods
+  static int remove(sqlite3_vfs *vfs, char const *name, int sync_dir) {
+    return parent(vfs)->xDelete(parent(vfs), name, sync_dir);
+  }
+  static int access(sqlite3_vfs *vfs, char const *name, int flags, int *out) {
+    return parent(vfs)->xAccess(parent(vfs), name, flags, out);
+  }
+  static int full_pathname(sqlite3_vfs *vfs, char const *name, int size,
+                           char *out) {
+    return parent(vfs)->xFullPathname(parent(vfs), name, size, out);
+  }
+  static void *dl_open(sqlite3_vfs *vfs, char const *name) {
+    return parent(vfs)->xDlOpen(parent(vfs), name);
+  }
+  static void dl_error(sqlite3_vfs *vfs, int size, char *out) {
+    parent(vfs)->xDlError(parent(vfs), size, out);
+  }
+  static void (*dl_sym(sqlite3_vfs *vfs, void *lib, char const *sym))(void) {
+    return parent(vfs)->xDlSym(parent(vfs), lib, sym);
+  }
+  static void dl_close(sqlite3_vfs *vfs, void *lib) {
+    parent(vfs)->xDlClose(parent(vfs), lib);
+  }
+  static int randomness(sqlite3_vfs *vfs, int size, char *out) {
+    return parent(vfs)->xRandomness(parent(vfs), size, out);
+  }
+  static int sleep(sqlite3_vfs *vfs, int us) {
+    return parent(vfs)->xSleep(parent(vfs), us);
+  }
+  static int current_time(sqlite3_vfs *vfs, double *out) {
+    return parent(vfs)->xCurrentTime(parent(vfs), out);
+  }
+  static int get_last_error(sqlite3_vfs *vfs, int size, char *out) {
+    return parent(vfs)->xGetLastError(parent(vfs), size, out);
+  }
+  static int current_time_int64(sqlite3_vfs *vfs, sqlite3_int64 *out) {
+    return parent(vfs)->xCurrentTimeInt64(parent(vfs), out);
+  }
+  static int set_system_call(sqlite3_vfs *vfs, char const *name,
+                             sqlite3_syscall_ptr call) {
+    return parent(vfs)->xSetSystemCall(parent(vfs), name, call);
+  }
+  static sqlite3_syscall_ptr get_system_call(sqlite3_vfs *vfs,
+                                             char const *name) {
+    return parent(vfs)->xGetSystemCall(parent(vfs), name);
+  }
+  static char const *next_system_call(sqlite3_vfs *vfs, char const *name) {
+    return parent(vfs)->xNextSystemCall(parent(vfs), name);
+  }
+};
+
+/**
+ * io_stats_vfs impl
+ */
+io_stats_vfs::io_stats_vfs(std::string name, char const *parent)
+    : m_name(std::move(name)), m_parent(sqlite3_vfs_find(parent)), m_vfs{},
+      m_methods{} {
+  if (!m_parent) throw error(SQLITE_NOTFOUND);
+  if (sqlite3_vfs_find(m_name.c_str())) throw error(SQLITE_MISUSE);
+
+  using a = io_stats_access;
+  m_vfs.iVersion = std::min(m_parent->iVersion, 3);
+  m_vfs.szOsFile = (int)sizeof(io_file) + m_parent->szOsFile;
+  m_vfs.mxPathname = m_parent->mxPathname;
+  m_vfs.zName = m_name.c_str();
+  m_vfs.pAppData = this;
+  m_vfs.xOpen = &a::open;
+  m_vfs.xDelete = &a::remove;
+  m_vfs.xAccess = &a::access;
+  m_vfs.xFullPathname = &a::full_pathname;
+  m_vfs.xDlOpen = m_parent->xDlOpen ? &a::dl_open : nullptr;
+  m_vfs.xDlError = m_parent->xDlError ? &a::dl_error : nullptr;
+  m_vfs.xDlSym = m_parent->xDlSym ? &a::dl_sym : nullptr;
+  m_vfs.xDlClose = m_parent->xDlClose ? &a::dl_close : nullptr;
+  m_vfs.xRandomness = &a::randomness;
+  m_vfs.xSleep = &a::sleep;
+  m_vfs.xCurrentTime = &a::current_time;
+  m_vfs.xGetLastError = m_parent->xGetLastError ? &a::get_last_error : nullptr;
+  if (m_vfs.iVersion >= 2 && m_parent->xCurrentTimeInt64)
+    m_vfs.xCurrentTimeInt64 = &a::current_time_int64;
+  if (m_vfs.iVersion >= 3 && m_parent->xSetSystemCall) {
+    m_vfs.xSetSystemCall = &a::set_system_call;
+    m_vfs.xGetSystemCall = &a::get_system_call;
+    m_vfs.xNextSystemCall = &a::next_system_call;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    auto &m = m_methods[i];
+    m.iVersion = i + 1;
+    m.xClose = &a::close;
+    m.xRead = &a::read;
+    m.xWrite = &a::write;
+    m.xTruncate = &a::truncate;
+    m.xSync = &a::sync;
+    m.xFileSize = &a::file_size;
+    m.xLock = &a::lock;
+    m.xUnlock = &a::unlock;
+    m.xCheckReservedLock = &a::check_reserved_lock;
+    m.xFileControl = &a::file_control;
+    m.xSectorSize = &a::sector_size;
+    m.xDeviceCharacteristics = &a::device_characteristics;
+    if (i >= 1) {
+      m.xShmMap = &a::shm_map;
+      m.xShmLock = &a::shm_lock;
+      m.xShmBarrier = &a::shm_barrier;
+      m.xShmUnmap = &a::shm_unmap;
+    }
+    if (i >= 2) {
+      m.xFetch = &a::fetch;
+      m.xUnfetch = &a::unfetch;
+    }
+  }
+
+  int ec = 0;
+  if (0 != (ec = sqlite3_vfs_register(&m_vfs, 0))) throw error(ec);
+}
+
+io_stats_vfs::~io_stats_vfs() { sqlite3_vfs_unregister(&m_vfs); }
+
+void io_stats_vfs::record(io_file_type type, io_op op, uint64_t bytes,
+                          std::chrono::nanoseconds elapsed) noexcept {
+  constexpr auto relaxed = std::memory_order_relaxed;
+  auto &c = m_counters[(size_t)type][(size_t)op];
+  uint64_t ns = elapsed.count() > 0 ? (uint64_t)elapsed.count() : 0;
+
+  c.count.fetch_add(1, relaxed);
+  c.bytes.fetch_add(bytes, relaxed);
+  c.total_ns.fetch_add(ns, relaxed);
+  c.histogram[bucket_of(ns)].fetch_add(1, relaxed);
+  uint64_t prev = c.max_ns.load(relaxed);
+  while (ns > prev && !c.max_ns.compare_exchange_weak(prev, ns, relaxed))
+    ;
+}
+
+io_stats io_stats_vfs::stats() const {
+  constexpr auto relaxed = std::memory_order_relaxed;
+  io_stats result;
+  for (size_t t = 0; t < (size_t)io_file_type::count; ++t) {
+    for (size_t o = 0; o < (size_t)io_op::count; ++o) {
+      auto const &c = m_counters[t][o];
+      auto &s = result.ops[t][o];
+      s.count = c.count.load(relaxed);
+      s.bytes = c.bytes.load(relaxed);
+      s.total = std::chrono::nanoseconds(c.total_ns.load(relaxed));
+      s.max = std::chrono::nanoseconds(c.max_ns.load(relaxed));
+      for (size_t i = 0; i < io_stats::buckets; ++i)
+        s.histogram[i] = c.histogram[i].load(relaxed);
+    }
+  }
+  return result;
+}
+
+void io_stats_vfs::reset() noexcept {
+  constexpr auto relaxed = std::memory_order_relaxed;
+  for (auto &ops : m_counters) {
+    for (auto &c : ops) {
+      c.count.store(0, relaxed);
+      c.bytes.store(0, relaxed);
+      c.total_ns.store(0, relaxed);
+      c.max_ns.store(0, relaxed);
+      for (auto &h : c.histogram) h.store(0, relaxed);
+    }
+  }
+}
+
+}  // namespace sqlite3cpp
@@ -0,0 +1,144 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+enum class io_file_type { main_db, wal, journal, temp, other, count };
+enum class io_op { read, write, sync, truncate, lock, unlock, shm_lock, count };
+
+SQLITE3CPP_EXPORT char const *to_string(io_file_type type) noexcept;
+SQLITE3CPP_EXPORT char const *to_string(io_op op) noexcept;
+
+struct SQLITE3CPP_EXPORT io_stats {
+  // Snapshot of io_stats_vfs counters.
+
+  // Latency histogram buckets; bucket i counts calls taking [2^i, 2^(i+1))
+  // nanoseconds and the last bucket counts all slower calls.
+  static constexpr size_t buckets = 32;
+
+  struct op_stats {
+    uint64_t count = 0;
+    // Bytes read or written; size truncated to for truncate.
+    uint64_t bytes = 0;
+    std::chrono::nanoseconds total{0};
+    std::chrono::nanoseconds max{0};
+    std::array<uint64_t, buckets> histogram{};
+
+    // Approximate latency at quantile |q| in [0, 1]; the upper bound of the
+    // bucket the quantile falls into.
+    std::chrono::nanoseconds percentile(double q) const noexcept;
+  };
+
+  op_stats const &get(io_file_type type, io_op op) const noexcept {
+    return ops[(size_t)type][(size_t)op];
+  }
+
+  // Export as a JSON object keyed by file type then operation, e.g.
+  // {"wal":{"sync":{"count":3,"bytes":0,"total_ns":...,"max_ns":...,
+  // "p50_ns":...,"p99_ns":...,"histogram":[...]}}}. Operations never called
+  // are omitted.
+  std::string to_json() const;
+
+  std::array<std::array<op_stats, (size_t)io_op::count>,
+             (size_t)io_file_type::count>
+      ops;
+};
+
+struct SQLITE3CPP_EXPORT io_stats_vfs {
+  // A VFS shim which times I/O of files opened through it and forwards calls
+  // to another VFS. e.g.
+  //
+  // io_stats_vfs vfs("iostats");
+  // database db("app.db", SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+  //             vfs.name());
+  // ...
+  // auto const &wal_sync = vfs.stats().get(io_file_type::wal, io_op::sync);
+  // std::cout << vfs.stats().to_json();
+  //
+  // Reads, writes, syncs, truncates, and locks are counted per file type
+  // with relaxed atomics, plus a steady clock read before and after each
+  // call. Other calls are forwarded untimed.
+  //
+  // The VFS is registered with sqlite3 for the lifetime of this object;
+  // connections opened with it must be closed before it is destroyed.
+
+  // Register a VFS named |name| over the VFS named |parent|, the default VFS
+  // if null. Throws sqlite3cpp::error if the parent is not found or |name|
+  // is already registered.
+  io_stats_vfs(std::string name, char const *parent = nullptr);
+  ~io_stats_vfs();
+
+  io_stats_vfs(io_stats_vfs const &) = delete;
+  io_stats_vfs &operator=(io_stats_vfs const &) = delete;
+
+  char const *name() const noexcept { return m_name.c_str(); }
+
+  // Read counters. Counters of concurrent calls may be partially updated.
+  io_stats stats() const;
+
+  // Zero all counters.
+  void reset() noexcept;
+
+ private:
+  friend struct io_stats_access;
+
+  struct counters {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+    std::array<std::atomic<uint64_t>, io_stats::buckets> histogram{};
+  };
+
+  void record(io_file_type type, io_op op, uint64_t bytes,
+              std::chrono::nanoseconds elapsed) noexcept;
+
+  std::string m_name;
+  sqlite3_vfs *m_parent;
+  sqlite3_vfs m_vfs;
+  // Methods of wrapped files, one per `sqlite3_io_methods` version
+  std::array<sqlite3_io_methods, 3> m_methods;
+  std::array<std::array<counters, (size_t)io_op::count>,
+             (size_t)io_file_type::count>
+      m_counters;
+};
+
+}  // namespace sqlite3cpp
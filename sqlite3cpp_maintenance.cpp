@@ -0,0 +1,260 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_maintenance.h"
+#include <algorithm>
+#include <vector>
+
+namespace sqlite3cpp {
+
+namespace {
+std::string main_filename(database &db) {
+  char const *fn = sqlite3_db_filename(db.get(), "main");
+  if (!fn || !*fn) throw error(SQLITE_MISUSE);
+  return fn;
+}
+}  // namespace
+
+/**
+ * maintenance_scheduler impl
+ */
+maintenance_scheduler::maintenance_scheduler(database &db)
+    : maintenance_scheduler(db, {}) {}
+
+maintenance_scheduler::maintenance_scheduler(database &db,
+                                             params_t const &params)
+    : m_maint_db(main_filename(db)), m_params(params) {
+  sqlite3_busy_timeout(m_maint_db.get(), m_params.busy_timeout_ms);
+  m_maint_db.executescript("pragma analysis_limit=" +
+                           std::to_string(m_params.analysis_limit));
+  m_data_version = query_int("pragma data_version");
+  m_last_change = clock::now();
+
+  // NOTE(acer): The handler stays installed for the life of the connection;
+  // |m_deadline| is only set around maintenance statements.
+  sqlite3_progress_handler(m_maint_db.get(), 1000,
+                           &maintenance_scheduler::on_progress, this);
+  m_thread = std::thread([this] { run(); });
+}
+
+maintenance_scheduler::~maintenance_scheduler() {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_one();
+  m_thread.join();
+}
+
+void maintenance_scheduler::run_now() noexcept {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_forced = true;
+  }
+  m_cond.notify_one();
+}
+
+maintenance_scheduler::metrics_t maintenance_scheduler::metrics() const {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_metrics;
+}
+
+int maintenance_scheduler::on_progress(void *self) noexcept {
+  auto *s = (maintenance_scheduler *)self;
+  return s->m_stop.load(std::memory_order_relaxed) ||
+         clock::now() > s->m_deadline;
+}
+
+bool maintenance_scheduler::quiet() noexcept {
+  int64_t version = query_int("pragma data_version");
+  auto const now = clock::now();
+  if (version != m_data_version) {
+    m_data_version = version;
+    m_last_change = now;
+  }
+  return now - m_last_change >= m_params.quiet_period;
+}
+
+int64_t maintenance_scheduler::query_int(char const *sql) noexcept {
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_prepare_v2(m_maint_db.get(), sql, -1, &stmt, nullptr))
+    return -1;
+  int64_t val =
+      sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int64(stmt, 0) : -1;
+  sqlite3_finalize(stmt);
+  return val;
+}
+
+int maintenance_scheduler::exec(std::string const &sql) noexcept {
+  using namespace std::chrono;
+
+  auto const start = clock::now();
+  m_deadline = start + m_params.statement_budget;
+  int ec = sqlite3_exec(m_maint_db.get(), sql.c_str(), nullptr, nullptr,
+                        nullptr);
+  m_deadline = clock::time_point::max();
+  auto const elapsed = duration_cast<microseconds>(clock::now() - start);
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+  auto &m = m_metrics;
+  if (ec == SQLITE_INTERRUPT && !m_stop) m.interrupted += 1;
+  if (ec == SQLITE_BUSY) m.busy += 1;
+  m.last_error = ec;
+  m.max_statement = std::max(m.max_statement, elapsed);
+  m.total_duration += elapsed;
+  return ec;
+}
+
+bool maintenance_scheduler::optimize() noexcept {
+  if (!quiet()) return false;
+  int ec = exec("pragma optimize");
+  if (ec == SQLITE_BUSY) return false;
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+  if (ec == SQLITE_OK) m_metrics.optimize_runs += 1;
+  return true;
+}
+
+bool maintenance_scheduler::analyze() noexcept {
+  std::vector<std::string> tables;
+  try {
+    auto c = m_maint_db.execute(
+        "select name from sqlite_schema where type = 'table' and "
+        "name not like 'sqlite_%' and name >= ? order by name",
+        m_next_table);
+    for (auto const &r : c) tables.push_back(std::get<0>(r.to<std::string>()));
+  } catch (...) {
+    return true;
+  }
+
+  for (auto const &t : tables) {
+    if (m_stop) return true;
+    m_next_table = t;
+    if (!quiet()) return false;
+    int ec = exec("analyze " + detail::quote_identifier(t));
+    if (ec == SQLITE_BUSY) return false;
+    // NOTE(acer): A table that does not fit in the budget is skipped rather
+    // than retried forever
+    if (ec == SQLITE_OK) {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_metrics.tables_analyzed += 1;
+    }
+  }
+  m_next_table.clear();
+  return true;
+}
+
+bool maintenance_scheduler::vacuum() noexcept {
+  // 2 is INCREMENTAL
+  if (query_int("pragma auto_vacuum") != 2) return true;
+
+  std::string const slice =
+      "pragma incremental_vacuum(" + std::to_string(m_params.vacuum_pages) +
+      ")";
+  int64_t free_pages = query_int("pragma freelist_count");
+  while (!m_stop && free_pages >= m_params.vacuum_min_free_pages) {
+    if (!quiet()) return false;
+    int ec = exec(slice);
+    if (ec == SQLITE_BUSY) return false;
+    if (ec != SQLITE_OK) return true;
+
+    int64_t const left = query_int("pragma freelist_count");
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_metrics.vacuum_slices += 1;
+      m_metrics.pages_vacuumed += (uint64_t)std::max<int64_t>(
+          free_pages - left, 0);
+      m_metrics.freelist_count = left;
+    }
+    if (left >= free_pages) break;
+    free_pages = left;
+  }
+  return true;
+}
+
+void maintenance_scheduler::run() noexcept {
+  using namespace std::chrono;
+
+  auto const schedule = [](milliseconds interval) {
+    return interval.count() > 0 ? clock::now() + interval
+                                : clock::time_point::max();
+  };
+  auto next_optimize = schedule(m_params.optimize_interval);
+  auto next_analyze = schedule(m_params.analyze_interval);
+  auto next_vacuum = schedule(m_params.vacuum_interval);
+  // Poll `data_version` a few times per quiet period while deferring
+  auto const poll = std::max(m_params.quiet_period / 4, milliseconds(1));
+
+  std::unique_lock<std::mutex> lk(m_mutex);
+  while (!m_stop) {
+    auto const next = std::min({next_optimize, next_analyze, next_vacuum});
+    if (next == clock::time_point::max())
+      m_cond.wait(lk, [this] { return m_stop || m_forced; });
+    else
+      m_cond.wait_until(lk, next, [this] { return m_stop || m_forced; });
+    if (m_stop) break;
+    if (m_forced) {
+      m_forced = false;
+      next_optimize = next_analyze = next_vacuum = clock::now();
+    }
+    lk.unlock();
+
+    auto const now = clock::now();
+    bool deferred = false;
+    if (now >= next_optimize) {
+      if (optimize())
+        next_optimize = schedule(m_params.optimize_interval);
+      else
+        deferred = true;
+    }
+    if (!deferred && now >= next_analyze) {
+      if (analyze())
+        next_analyze = schedule(m_params.analyze_interval);
+      else
+        deferred = true;
+    }
+    if (!deferred && now >= next_vacuum) {
+      if (vacuum())
+        next_vacuum = schedule(m_params.vacuum_interval);
+      else
+        deferred = true;
+    }
+
+    lk.lock();
+    if (deferred) {
+      m_metrics.deferred += 1;
+      m_cond.wait_for(lk, poll, [this] { return m_stop.load(); });
+    }
+  }
+}
+
+}  // namespace sqlite3cpp
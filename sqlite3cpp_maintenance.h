@@ -0,0 +1,154 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT maintenance_scheduler {
+  // Keep a long-lived database file in shape from a background thread.
+  //
+  // database db("app.db");
+  // maintenance_scheduler upkeep(db);
+  //
+  // Three tasks run on a dedicated connection, each on its own interval:
+  //
+  //  - `pragma optimize`, which analyzes tables whose statistics went stale;
+  //  - `analyze` of each table, one statement per table, with
+  //    `pragma analysis_limit`;
+  //  - `pragma incremental_vacuum(N)` in slices of |vacuum_pages| while
+  //    `pragma freelist_count` is at least |vacuum_min_free_pages|. It only
+  //    applies to databases with `pragma auto_vacuum=incremental`.
+  //
+  // Work is paced around foreground activity: before each statement the
+  // scheduler waits until no other connection committed for |quiet_period|
+  // (as told by `pragma data_version`), and a task interrupted by activity
+  // resumes where it stopped. A statement running past |statement_budget|
+  // is interrupted and rolled back, so writers wait for one short statement
+  // at most. Writers are expected to have a busy handler (see
+  // |database::set_busy_policy()|). Under steady load tasks keep waiting;
+  // |quiet_period| should be shorter than usual gaps between commits. A
+  // zero interval disables a task.
+
+  struct params_t {
+    std::chrono::milliseconds optimize_interval{std::chrono::hours(1)};
+    std::chrono::milliseconds analyze_interval{std::chrono::hours(24)};
+    std::chrono::milliseconds vacuum_interval{std::chrono::seconds(10)};
+    // Rows examined per index by `analyze`; 0 for no limit.
+    int analysis_limit = 400;
+    int vacuum_min_free_pages = 64;
+    int vacuum_pages = 32;
+    // Time limit of each maintenance statement.
+    std::chrono::milliseconds statement_budget{50};
+    // Required idle time of other connections before a statement runs.
+    std::chrono::milliseconds quiet_period{200};
+    // Busy timeout of the maintenance connection.
+    int busy_timeout_ms = 0;
+  };
+
+  struct metrics_t {
+    uint64_t optimize_runs = 0;
+    uint64_t tables_analyzed = 0;
+    uint64_t vacuum_slices = 0;
+    uint64_t pages_vacuumed = 0;
+    // Statements stopped by |statement_budget| and rolled back.
+    uint64_t interrupted = 0;
+    // Times due tasks waited for foreground activity to settle.
+    uint64_t deferred = 0;
+    uint64_t busy = 0;
+    int last_error = SQLITE_OK;
+    // Free pages seen by the latest vacuum slice.
+    int64_t freelist_count = 0;
+    std::chrono::microseconds max_statement{0};
+    std::chrono::microseconds total_duration{0};
+  };
+
+  // Attach to |db|, which must be a database file. Throws sqlite3cpp::error
+  // if the maintenance connection can not be opened.
+  maintenance_scheduler(database &db);
+  maintenance_scheduler(database &db, params_t const &params);
+
+  // Stop the background thread; a running slice is interrupted.
+  ~maintenance_scheduler();
+
+  maintenance_scheduler(maintenance_scheduler const &) = delete;
+  maintenance_scheduler &operator=(maintenance_scheduler const &) = delete;
+
+  // Make all tasks due now, disabled ones included. They still wait for
+  // the quiet period.
+  void run_now() noexcept;
+
+  // Snapshot of metrics collected so far.
+  metrics_t metrics() const;
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  static int on_progress(void *self) noexcept;
+  void run() noexcept;
+  bool quiet() noexcept;
+  int exec(std::string const &sql) noexcept;
+  int64_t query_int(char const *sql) noexcept;
+  // Tasks return false if they stopped for foreground activity.
+  bool optimize() noexcept;
+  bool analyze() noexcept;
+  bool vacuum() noexcept;
+
+  database m_maint_db;
+  params_t m_params;
+
+  // Owned by the background thread
+  int64_t m_data_version = -1;
+  clock::time_point m_last_change;
+  // Table to resume analyze at; empty to start over.
+  std::string m_next_table;
+  // Deadline of the running statement; checked by |on_progress()|.
+  clock::time_point m_deadline = clock::time_point::max();
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cond;
+  bool m_forced = false;
+  std::atomic<bool> m_stop{false};
+  metrics_t m_metrics;
+  std::thread m_thread;
+};
+
+}  // namespace sqlite3cpp
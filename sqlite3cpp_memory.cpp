@@ -0,0 +1,183 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_memory.h"
+#include <algorithm>
+
+namespace sqlite3cpp {
+
+/**
+ * memory_governor impl
+ */
+memory_governor::memory_governor(params_t params)
+    : m_params(std::move(params)) {
+  // NOTE(acer): The soft limit can not exceed the hard one; set hard first
+  m_prev_hard = sqlite3_hard_heap_limit64(-1);
+  m_prev_soft = sqlite3_soft_heap_limit64(-1);
+  if (m_params.hard_limit) sqlite3_hard_heap_limit64(m_params.hard_limit);
+  if (m_params.soft_limit) sqlite3_soft_heap_limit64(m_params.soft_limit);
+
+  m_thread = std::thread([this] { run(); });
+}
+
+memory_governor::~memory_governor() {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_one();
+  m_thread.join();
+
+  // NOTE(acer): Setting the hard limit clamps the soft one, e.g. to 0 when
+  // the hard limit is removed; restore the hard limit first.
+  if (m_params.hard_limit) sqlite3_hard_heap_limit64(m_prev_hard);
+  if (m_params.soft_limit || m_params.hard_limit)
+    sqlite3_soft_heap_limit64(m_prev_soft);
+}
+
+void memory_governor::attach(database &db, std::string name,
+                             int64_t cache_budget) {
+  if (cache_budget > 0) {
+    // Negative cache_size is in KiB rather than pages
+    auto kib = std::max<int64_t>(1, cache_budget / 1024);
+    db.executescript("pragma cache_size = -" + std::to_string(kib));
+  }
+
+  std::lock_guard<std::mutex> lk(m_mutex);
+  for (auto &e : m_entries) {
+    if (e.db == &db) {
+      e.name = std::move(name);
+      e.cache_budget = cache_budget;
+      return;
+    }
+  }
+  m_entries.push_back({&db, std::move(name), cache_budget});
+}
+
+void memory_governor::detach(database &db) {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  m_entries.erase(
+      std::remove_if(m_entries.begin(), m_entries.end(),
+                     [&db](entry const &e) { return e.db == &db; }),
+      m_entries.end());
+}
+
+memory_governor::report_t memory_governor::report() const {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return report_locked();
+}
+
+memory_governor::report_t memory_governor::report_locked() const {
+  report_t r;
+  r.heap = heap_statistics();
+  r.connections.reserve(m_entries.size());
+  for (auto const &e : m_entries)
+    r.connections.push_back({e.name, e.db->db_statistics(), e.cache_budget});
+  std::sort(r.connections.begin(), r.connections.end(),
+            [](usage_t const &l, usage_t const &r) {
+              return l.stats.cache_used > r.stats.cache_used;
+            });
+  return r;
+}
+
+void memory_governor::poll_now() { poll(); }
+
+uint64_t memory_governor::soft_limit_hits() const {
+  std::lock_guard<std::mutex> lk(m_mutex);
+  return m_soft_hits;
+}
+
+void memory_governor::poll() {
+  std::lock_guard<std::mutex> poll_lk(m_poll_mutex);
+  report_t r;
+  bool soft_crossed = false, hard_crossed = false;
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    for (auto &e : m_entries) {
+      if (e.cache_budget > 0 &&
+          e.db->db_statistics().cache_used > e.cache_budget)
+        e.db->release_memory();
+    }
+
+    int64_t const used = sqlite3_memory_used();
+    bool const above_soft = m_params.soft_limit && used > m_params.soft_limit;
+    bool const above_hard =
+        m_params.hard_limit &&
+        used >= (int64_t)(m_params.hard_limit * m_params.hard_warning);
+    soft_crossed = above_soft && !m_above_soft;
+    hard_crossed = above_hard && !m_above_hard;
+    m_above_soft = above_soft;
+    m_above_hard = above_hard;
+
+    if (soft_crossed || hard_crossed) r = report_locked();
+
+    if (above_soft) {
+      m_soft_hits += 1;
+      // Release the largest caches first until back under the soft limit
+      std::vector<std::pair<int64_t, database *>> by_cache;
+      for (auto &e : m_entries)
+        by_cache.emplace_back(e.db->db_statistics().cache_used, e.db);
+      std::sort(by_cache.begin(), by_cache.end(),
+                [](auto const &l, auto const &r) { return l.first > r.first; });
+      for (auto &c : by_cache) {
+        if (sqlite3_memory_used() <= m_params.soft_limit) break;
+        c.second->release_memory();
+      }
+    }
+  }
+
+  try {
+    if (soft_crossed && m_params.on_soft_limit) m_params.on_soft_limit(r);
+  } catch (...) {
+  }
+  try {
+    if (hard_crossed && m_params.on_hard_limit) m_params.on_hard_limit(r);
+  } catch (...) {
+  }
+}
+
+void memory_governor::run() noexcept {
+  std::unique_lock<std::mutex> lk(m_mutex);
+  while (!m_stop) {
+    m_cond.wait_for(lk, m_params.interval, [this] { return m_stop; });
+    if (m_stop) break;
+    lk.unlock();
+    try {
+      poll();
+    } catch (...) {
+    }
+    lk.lock();
+  }
+}
+
+}  // namespace sqlite3cpp
@@ -0,0 +1,145 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT memory_governor {
+  // Keep memory of sqlite3 in the process bounded. e.g.
+  //
+  // memory_governor::params_t params;
+  // params.soft_limit = 256 << 20;
+  // params.hard_limit = 512 << 20;
+  // params.on_soft_limit = [](memory_governor::report_t const &r) { ... };
+  // memory_governor gov(params);
+  // gov.attach(db, "orders", 8 << 20);
+  //
+  // Limits are installed by `sqlite3_soft_heap_limit64` and
+  // `sqlite3_hard_heap_limit64`; past the hard limit allocations of sqlite3
+  // fail with SQLITE_NOMEM. A background thread polls memory usage. Once it
+  // crosses the soft limit, the governor releases page cache memory of
+  // attached connections, most used first, until usage drops below the soft
+  // limit, and reports per connection usage to the callbacks so the
+  // culprit can be identified.
+  //
+  // A cache budget of an attached connection is enforced by setting its
+  // `cache_size` to the budget; connections using more than their budget,
+  // e.g. by spilled or pinned pages, are asked to release memory on every
+  // poll. Connections are used from the governor thread, so sqlite3 must be
+  // built thread safe (the default). Limits are process wide; the previous
+  // limits are restored when the governor is destroyed.
+
+  struct usage_t {
+    std::string name;
+    db_stats stats;
+    int64_t cache_budget = 0;
+  };
+
+  struct report_t {
+    heap_stats heap;
+    // Attached connections ordered by page cache used, most first.
+    std::vector<usage_t> connections;
+  };
+
+  struct params_t {
+    // Bytes of memory sqlite3 may use; 0 for no limit.
+    int64_t soft_limit = 0;
+    int64_t hard_limit = 0;
+    std::chrono::milliseconds interval{100};
+    // Called on the governor thread when memory usage rises above the soft
+    // limit, and above |hard_warning| of the hard limit. Each is called once
+    // per crossing. Exceptions are ignored.
+    std::function<void(report_t const &)> on_soft_limit;
+    std::function<void(report_t const &)> on_hard_limit;
+    double hard_warning = 0.9;
+  };
+
+  memory_governor(params_t params);
+  ~memory_governor();
+
+  memory_governor(memory_governor const &) = delete;
+  memory_governor &operator=(memory_governor const &) = delete;
+
+  // Govern |db| as |name| with |cache_budget| bytes of page cache; 0 for no
+  // budget. |db| must be detached before it is closed.
+  void attach(database &db, std::string name, int64_t cache_budget = 0);
+  void detach(database &db);
+
+  // Current usage of the process and attached connections.
+  report_t report() const;
+
+  // Poll now rather than at next interval; mostly for tests.
+  void poll_now();
+
+  // Number of polls which found memory above the soft limit.
+  uint64_t soft_limit_hits() const;
+
+ private:
+  struct entry {
+    database *db;
+    std::string name;
+    int64_t cache_budget;
+  };
+
+  void run() noexcept;
+  void poll();
+  report_t report_locked() const;
+
+  params_t m_params;
+  int64_t m_prev_soft = 0;
+  int64_t m_prev_hard = 0;
+
+  // NOTE(acer): Polls are serialized by |m_poll_mutex| and release |m_mutex|
+  // before calling back, such that callbacks may call |report()|.
+  std::mutex m_poll_mutex;
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::vector<entry> m_entries;
+  bool m_above_soft = false;
+  bool m_above_hard = false;
+  uint64_t m_soft_hits = 0;
+  bool m_stop = false;
+  std::thread m_thread;
+};
+
+}  // namespace sqlite3cpp
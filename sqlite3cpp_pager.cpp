@@ -0,0 +1,249 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_pager.h"
+#include <cstring>
+
+namespace sqlite3cpp {
+
+namespace {
+
+char const b64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+uint32_t fnv1a(uint32_t h, std::string_view s) noexcept {
+  for (char c : s) h = (h ^ (unsigned char)c) * 16777619u;
+  return h;
+}
+
+void put_u64(std::string &out, uint64_t v) {
+  for (int i = 0; i < 8; ++i) out += (char)(v >> (8 * i));
+}
+
+std::string encode_b64(std::string_view in) {
+  std::string out;
+  out.reserve((in.size() * 4 + 2) / 3);
+  size_t i = 0;
+  for (; i + 3 <= in.size(); i += 3) {
+    uint32_t v = (unsigned char)in[i] << 16 | (unsigned char)in[i + 1] << 8 |
+                 (unsigned char)in[i + 2];
+    for (int s = 18; s >= 0; s -= 6) out += b64[(v >> s) & 63];
+  }
+  if (i < in.size()) {
+    uint32_t v = (unsigned char)in[i] << 16;
+    if (i + 1 < in.size()) v |= (unsigned char)in[i + 1] << 8;
+    out += b64[(v >> 18) & 63];
+    out += b64[(v >> 12) & 63];
+    if (i + 1 < in.size()) out += b64[(v >> 6) & 63];
+  }
+  return out;
+}
+
+std::string decode_b64(std::string_view in) {
+  if (in.size() % 4 == 1) throw error(SQLITE_MISMATCH);
+  std::string out;
+  out.reserve(in.size() * 3 / 4);
+  uint32_t v = 0;
+  int bits = 0;
+  for (char c : in) {
+    char const *p = c ? std::strchr(b64, c) : nullptr;
+    if (!p) throw error(SQLITE_MISMATCH);
+    v = v << 6 | (uint32_t)(p - b64);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out += (char)(v >> bits);
+    }
+  }
+  return out;
+}
+
+// Reads fields of a decoded token; throws on truncated input.
+struct token_reader {
+  std::string_view data;
+
+  std::string_view take(size_t n) {
+    if (n > data.size()) throw error(SQLITE_MISMATCH);
+    auto s = data.substr(0, n);
+    data.remove_prefix(n);
+    return s;
+  }
+
+  uint64_t u64() {
+    auto s = take(8);
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = v << 8 | (unsigned char)s[i];
+    return v;
+  }
+};
+
+}  // namespace
+
+keyset_pager::keyset_pager(database &db, std::string query,
+                           std::vector<std::string> keys)
+    : keyset_pager(db, std::move(query), std::move(keys), {}) {}
+
+keyset_pager::keyset_pager(database &db, std::string query,
+                           std::vector<std::string> keys,
+                           params_t const &params)
+    : m_params(params) {
+  if (keys.empty() || m_params.page_size == 0) throw error(SQLITE_MISUSE);
+
+  // NOTE(acer): Row values have no directions; only ORDER BY has
+  std::string names, order, marks;
+  for (auto const &k : keys) {
+    if (!names.empty()) names += ", ", order += ", ", marks += ", ";
+    auto quoted = detail::quote_identifier(k);
+    names += quoted;
+    order += quoted + (m_params.descending ? " desc" : "");
+    marks += "?";
+  }
+
+  std::string from = "select * from (" + query + ") ";
+  std::string seek = "where (" + names + ") " +
+                     (m_params.descending ? "< (" : "> (") + marks + ") ";
+  std::string tail = "order by " + order + " limit ?";
+
+  auto prepare = [&db](std::string const &sql) {
+    sqlite3_stmt *stmt = nullptr;
+    int ec = sqlite3_prepare_v3(db.get(), sql.c_str(), (int)sql.size(),
+                                SQLITE_PREPARE_PERSISTENT, &stmt, nullptr);
+    if (ec) throw error(ec);
+    return std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter>(stmt);
+  };
+  m_first = prepare(from + tail);
+  m_seek = prepare(from + seek + tail);
+
+  for (auto const &k : keys) {
+    int found = -1;
+    for (int i = 0; i < sqlite3_column_count(m_first.get()); ++i) {
+      if (sqlite3_stricmp(sqlite3_column_name(m_first.get(), i),
+                          k.c_str()) == 0) {
+        found = i;
+        break;
+      }
+    }
+    if (found < 0) throw error(SQLITE_ERROR);
+    m_key_columns.push_back(found);
+  }
+
+  m_fingerprint = fnv1a(2166136261u, query);
+  for (auto const &k : keys)
+    m_fingerprint = fnv1a(fnv1a(m_fingerprint, std::string_view("", 1)), k);
+  m_fingerprint = fnv1a(m_fingerprint, m_params.descending ? "<" : ">");
+}
+
+sqlite3_stmt *keyset_pager::start(std::string_view token) {
+  sqlite3_stmt *stmt = token.empty() ? m_first.get() : m_seek.get();
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  // Seek values and the limit are the last parameters
+  int index = sqlite3_bind_parameter_count(stmt);
+  int ec =
+      sqlite3_bind_int64(stmt, index, (sqlite3_int64)m_params.page_size + 1);
+  if (ec) throw error(ec);
+  if (token.empty()) return stmt;
+
+  std::string raw = decode_b64(token);
+  token_reader in{raw};
+  if ((uint32_t)in.u64() != m_fingerprint) throw error(SQLITE_MISMATCH);
+
+  index -= (int)m_key_columns.size();
+  for (size_t i = 0; i < m_key_columns.size(); ++i, ++index) {
+    int type = (unsigned char)in.take(1)[0];
+    switch (type) {
+      case SQLITE_INTEGER:
+        ec = sqlite3_bind_int64(stmt, index, (sqlite3_int64)in.u64());
+        break;
+      case SQLITE_FLOAT: {
+        uint64_t bits = in.u64();
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        ec = sqlite3_bind_double(stmt, index, d);
+        break;
+      }
+      case SQLITE_TEXT:
+      case SQLITE_BLOB: {
+        auto s = in.take((size_t)in.u64());
+        ec = type == SQLITE_TEXT
+                 ? sqlite3_bind_text(stmt, index, s.data(), (int)s.size(),
+                                     SQLITE_TRANSIENT)
+                 : sqlite3_bind_blob(stmt, index, s.data(), (int)s.size(),
+                                     SQLITE_TRANSIENT);
+        break;
+      }
+      default:
+        throw error(SQLITE_MISMATCH);
+    }
+    if (ec) throw error(ec);
+  }
+  if (!in.data.empty()) throw error(SQLITE_MISMATCH);
+  return stmt;
+}
+
+std::string keyset_pager::make_token(sqlite3_stmt *stmt) const {
+  std::string raw;
+  put_u64(raw, m_fingerprint);
+  for (int col : m_key_columns) {
+    int type = sqlite3_column_type(stmt, col);
+    raw += (char)type;
+    switch (type) {
+      case SQLITE_INTEGER:
+        put_u64(raw, (uint64_t)sqlite3_column_int64(stmt, col));
+        break;
+      case SQLITE_FLOAT: {
+        double d = sqlite3_column_double(stmt, col);
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(d));
+        put_u64(raw, bits);
+        break;
+      }
+      case SQLITE_TEXT:
+      case SQLITE_BLOB: {
+        auto *p = type == SQLITE_TEXT
+                      ? (char const *)sqlite3_column_text(stmt, col)
+                      : (char const *)sqlite3_column_blob(stmt, col);
+        size_t n = (size_t)sqlite3_column_bytes(stmt, col);
+        if (!p && n) throw error(SQLITE_NOMEM);
+        put_u64(raw, n);
+        raw.append(p ? p : "", n);
+        break;
+      }
+      default:
+        throw error(SQLITE_MISMATCH);
+    }
+  }
+  return encode_b64(raw);
+}
+
+}  // namespace sqlite3cpp
@@ -0,0 +1,159 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT keyset_pager {
+  // Page through results of a query by seeking past the keys of the last
+  // row instead of LIMIT/OFFSET, which steps over every skipped row. e.g.
+  //
+  // keyset_pager users(db, "select name, id, email from User where org = ?",
+  //                    {"name", "id"});
+  // auto page = users.fetch<std::string, int64_t, std::string>("", org);
+  // // ... later, with page.next handed back by the client
+  // page = users.fetch<std::string, int64_t, std::string>(next, org);
+  //
+  // Rows are ordered by |keys|, which must be result columns of |query| and
+  // identify a row together, e.g. end with a primary key. Each page after
+  // the first runs
+  //
+  //   select * from (query) where (name, id) > (?, ?)
+  //   order by name, id limit ?
+  //
+  // With an index on the keys the cost of a page does not depend on its
+  // depth. |query| should not have its own ORDER BY or LIMIT; its
+  // parameters are bound from the arguments of |fetch()|. Statements are
+  // prepared once by the constructor.
+  //
+  // Tokens are opaque URL-safe strings carrying the key values of the last
+  // row of a page, and a fingerprint of the query and keys. A token of
+  // another pager or a malformed one raises sqlite3cpp::error with
+  // SQLITE_MISMATCH, as does a NULL key value. Rows inserted or deleted
+  // between pages shift neither earlier nor later pages.
+
+  struct params_t {
+    size_t page_size = 100;
+    // Order by keys descending instead.
+    bool descending = false;
+  };
+
+  template <typename... Cols>
+  struct page {
+    std::vector<std::tuple<Cols...>> rows;
+    // Token of the next page; empty if this is the last one.
+    std::string next;
+  };
+
+  keyset_pager(database &db, std::string query, std::vector<std::string> keys);
+  keyset_pager(database &db, std::string query, std::vector<std::string> keys,
+               params_t const &params);
+
+  keyset_pager(keyset_pager const &) = delete;
+  keyset_pager &operator=(keyset_pager const &) = delete;
+
+  // Fetch the page after |token|, or the first page if |token| is empty.
+  // |args| are bound to parameters of the query.
+  template <typename... Cols, typename... Args>
+  page<Cols...> fetch(std::string_view token, Args &&... args);
+
+  params_t const &params() const noexcept { return m_params; }
+
+ private:
+  struct reset_guard {
+    ~reset_guard() { sqlite3_reset(stmt); }
+    sqlite3_stmt *stmt;
+  };
+
+  // Pick and reset the statement for |token|, then bind its key values and
+  // the limit.
+  sqlite3_stmt *start(std::string_view token);
+  // Token for the key values of current row of |stmt|.
+  std::string make_token(sqlite3_stmt *stmt) const;
+
+  std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> m_first;
+  std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> m_seek;
+  // Result column of each key.
+  std::vector<int> m_key_columns;
+  uint32_t m_fingerprint = 0;
+  params_t m_params;
+};
+
+/**
+ * keyset_pager impl
+ */
+template <typename... Cols, typename... Args>
+keyset_pager::page<Cols...> keyset_pager::fetch(std::string_view token,
+                                                Args &&... args) {
+  static_assert((... && !std::is_same_v<Cols, std::string_view>),
+                "std::string_view columns expire once the page is fetched");
+  static_assert(
+      (... && !std::is_same_v<Cols, std::optional<std::string_view>>),
+      "std::string_view columns expire once the page is fetched");
+
+  sqlite3_stmt *stmt = start(token);
+  reset_guard guard{stmt};
+  detail::bind_to_stmt(stmt, 1, std::forward<Args>(args)...);
+
+  // NOTE(acer): One more row than a page is asked for to tell whether
+  // another page follows, so the last page is never an empty one.
+  page<Cols...> result;
+  result.rows.reserve(m_params.page_size);
+  std::string next;
+  int ec = 0;
+  while (SQLITE_ROW == (ec = sqlite3_step(stmt))) {
+    if (result.rows.size() == m_params.page_size) {
+      result.next = std::move(next);
+      return result;
+    }
+    // Keys are read before conversions of |get_col_val()| alter their types
+    if (result.rows.size() + 1 == m_params.page_size) next = make_token(stmt);
+    auto &row = result.rows.emplace_back();
+    detail::enumerate(
+        [stmt](int index, auto &&val) {
+          detail::get_col_val(stmt, index, val);
+        },
+        row);
+  }
+  if (ec != SQLITE_DONE) throw error(ec);
+  return result;
+}
+
+}  // namespace sqlite3cpp
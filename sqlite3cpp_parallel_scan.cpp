@@ -0,0 +1,191 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_parallel_scan.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace sqlite3cpp {
+
+namespace {
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+struct snapshot_deleter {
+  void operator()(sqlite3_snapshot *s) const { sqlite3_snapshot_free(s); }
+};
+
+// End read transactions of readers whatever happens to the scan.
+struct read_guard {
+  std::vector<std::unique_ptr<database>> &readers;
+  ~read_guard() {
+    for (auto &r : readers) {
+      if (!sqlite3_get_autocommit(r->get()))
+        sqlite3_exec(r->get(), "commit", nullptr, nullptr, nullptr);
+    }
+  }
+};
+
+void check(int ec) {
+  if (ec) throw error(ec);
+}
+#endif
+
+// Bind range [lo, hi] to |csr| which was executed with the same statement.
+void bind_range(cursor &csr, int64_t lo, int64_t hi) {
+  sqlite3_stmt *stmt = csr.get();
+  sqlite3_reset(stmt);
+  int ec = 0;
+  if (0 != (ec = sqlite3_bind_int64(stmt, 1, lo)) ||
+      0 != (ec = sqlite3_bind_int64(stmt, 2, hi)))
+    throw error(ec);
+}
+
+}  // namespace
+
+/**
+ * parallel_scan impl
+ */
+parallel_scan::parallel_scan(database &db, std::string table)
+    : parallel_scan(db, std::move(table), {}) {}
+
+parallel_scan::parallel_scan(database &db, std::string table,
+                             params_t const &params)
+    : m_db(db), m_table(std::move(table)), m_params(params) {
+  if (!m_params.threads)
+    m_params.threads = std::max(1u, std::thread::hardware_concurrency());
+  m_params.ranges_per_thread = std::max(1u, m_params.ranges_per_thread);
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+  char const *fn = sqlite3_db_filename(m_db.get(), "main");
+  if (m_params.threads < 2 || !fn || !*fn) return;
+
+  auto [mode] = m_db.execute("pragma journal_mode").begin()->to<std::string>();
+  if (mode != "wal") return;
+
+  for (unsigned i = 0; i < m_params.threads; ++i) {
+    auto reader = std::make_unique<database>(fn);
+    // NOTE(acer): Make the reader open the WAL; opening a snapshot on a
+    // connection which has never read the database fails.
+    reader->execute("pragma journal_mode");
+    m_readers.push_back(std::move(reader));
+  }
+#endif
+}
+
+size_t parallel_scan::concurrency() const noexcept {
+  return m_readers.empty() ? 1 : m_readers.size();
+}
+
+void parallel_scan::run_serial(std::string const &sql,
+                               range_scan_t const &scan) {
+  auto csr = m_db.make_cursor();
+  csr.execute(sql, nullptr, nullptr);
+  bind_range(csr, std::numeric_limits<int64_t>::min(),
+             std::numeric_limits<int64_t>::max());
+  scan(0, csr);
+}
+
+void parallel_scan::run(std::string const &sql, range_scan_t const &scan) {
+#ifndef SQLITE_ENABLE_SNAPSHOT
+  run_serial(sql, scan);
+#else
+  if (m_readers.empty()) return run_serial(sql, scan);
+
+  read_guard guard{m_readers};
+  database &lead = *m_readers[0];
+
+  // Pin a snapshot by the read transaction of the lead reader, which also
+  // finds bounds of rowid. Other readers join the snapshot before reading.
+  lead.executescript("begin");
+  auto [lo, hi] = lead.execute("select coalesce(min(rowid), 0), "
+                               "coalesce(max(rowid), -1) from " +
+                               detail::quote_identifier(m_table))
+                      .begin()
+                      ->to<int64_t, int64_t>();
+  sqlite3_snapshot *snapshot = nullptr;
+  check(sqlite3_snapshot_get(lead.get(), "main", &snapshot));
+  std::unique_ptr<sqlite3_snapshot, snapshot_deleter> snapshot_guard(snapshot);
+
+  for (size_t i = 1; i < m_readers.size(); ++i) {
+    m_readers[i]->executescript("begin");
+    check(sqlite3_snapshot_open(m_readers[i]->get(), "main", snapshot));
+  }
+
+  if (lo > hi) return;
+
+  // NOTE(acer): Work in unsigned offsets from |lo| as max - min could
+  // overflow int64_t.
+  uint64_t const ranges =
+      (uint64_t)m_readers.size() * m_params.ranges_per_thread;
+  uint64_t const span = (uint64_t)hi - (uint64_t)lo;
+  uint64_t const width = span / ranges + 1;
+
+  std::atomic<uint64_t> next{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr first_error;
+  std::mutex error_mutex;
+
+  auto work = [&](size_t worker) {
+    try {
+      auto csr = m_readers[worker]->make_cursor();
+      // NOTE(acer): Null bounds match no rowid. This prepares the statement
+      // once per reader; ranges are bound to it afterwards.
+      csr.execute(sql, nullptr, nullptr);
+
+      for (uint64_t i; !failed && (i = next++) < ranges;) {
+        if (i > span / width) break;
+        uint64_t begin = i * width;
+        uint64_t end = begin + std::min(width - 1, span - begin);
+        bind_range(csr, (int64_t)((uint64_t)lo + begin),
+                   (int64_t)((uint64_t)lo + end));
+        scan(worker, csr);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lk(error_mutex);
+      if (!failed.exchange(true)) first_error = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < m_readers.size(); ++i) threads.emplace_back(work, i);
+  work(0);
+  for (auto &t : threads) t.join();
+
+  if (first_error) std::rethrow_exception(first_error);
+#endif
+}
+
+}  // namespace sqlite3cpp
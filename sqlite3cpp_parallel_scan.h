@@ -0,0 +1,116 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT parallel_scan {
+  // Scan a table by rowid ranges on a pool of reader connections, all reading
+  // the same snapshot of the database. e.g.
+  //
+  // parallel_scan scan(db, "Event");
+  // auto total = scan.reduce(
+  //     "select amount from Event where rowid between ?1 and ?2", int64_t(0),
+  //     [](int64_t &sum, row const &r) {
+  //       auto [amount] = r.to<int64_t>();
+  //       sum += amount;
+  //     },
+  //     [](int64_t &sum, int64_t partial) { sum += partial; });
+  //
+  // The first reader opens a read transaction and captures a
+  // `sqlite3_snapshot`, which others open before reading, so every range
+  // sees the same committed state while writers go on. Ranges split
+  // [min(rowid), max(rowid)] evenly and are claimed by readers one at a
+  // time, such that sparse ranges do not leave threads idle.
+  //
+  // Snapshots require SQLITE_ENABLE_SNAPSHOT and a database file in WAL
+  // mode. Otherwise, or if only one thread is asked for, the query runs once
+  // on |db| over all rowids.
+
+  struct params_t {
+    // Number of reader connections and threads; hardware concurrency if 0.
+    unsigned threads = 0;
+    // Ranges per thread. More ranges balance skewed tables better at the
+    // cost of more statement resets.
+    unsigned ranges_per_thread = 8;
+  };
+
+  // |table| is a name, not SQL; it is quoted as an identifier.
+  parallel_scan(database &db, std::string table);
+  parallel_scan(database &db, std::string table, params_t const &params);
+
+  parallel_scan(parallel_scan const &) = delete;
+  parallel_scan &operator=(parallel_scan const &) = delete;
+
+  // Run |sql| for each range and fold its rows into per-thread copies of
+  // |init| by |scan(T &partial, row const &)|, then merge the copies into
+  // |init| by |merge(T &total, T &&partial)| on the calling thread. |sql|
+  // must bound rowid by ?1 and ?2, both inclusive. Exceptions from
+  // any thread stop the scan and are rethrown.
+  template <typename T, typename SCAN, typename MERGE>
+  T reduce(std::string const &sql, T init, SCAN scan, MERGE merge);
+
+  // Number of threads scanning concurrently, 1 if scans are serial.
+  size_t concurrency() const noexcept;
+
+ private:
+  using range_scan_t = std::function<void(size_t worker, cursor &csr)>;
+
+  void run(std::string const &sql, range_scan_t const &scan);
+  void run_serial(std::string const &sql, range_scan_t const &scan);
+
+  database &m_db;
+  std::string m_table;
+  params_t m_params;
+  std::vector<std::unique_ptr<database>> m_readers;
+};
+
+template <typename T, typename SCAN, typename MERGE>
+T parallel_scan::reduce(std::string const &sql, T init, SCAN scan,
+                        MERGE merge) {
+  std::vector<T> partials(concurrency(), init);
+  run(sql, [&partials, &scan](size_t worker, cursor &csr) {
+    for (auto const &r : csr) scan(partials[worker], r);
+  });
+  for (auto &p : partials) merge(init, std::move(p));
+  return init;
+}
+
+}  // namespace sqlite3cpp
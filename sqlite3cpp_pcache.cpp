@@ -0,0 +1,475 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_pcache.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace sqlite3cpp {
+
+namespace {
+
+struct cache_impl;
+
+// Header of a page slot; the page buffer and the extra bytes follow.
+struct slot {
+  sqlite3_pcache_page page;
+  // Null if the slot is free.
+  cache_impl *owner = nullptr;
+  unsigned key = 0;
+  bool pinned = false;
+  bool referenced = false;
+  // Links of the LRU list of unpinned pages of |owner|, or of the free list.
+  slot *prev = nullptr;
+  slot *next = nullptr;
+};
+
+size_t const slot_header = (sizeof(slot) + 15) & ~size_t(15);
+
+struct size_class {
+  int page_size;
+  int extra_size;
+  size_t slot_size;
+  // All slots carved for the class; the ring of the clock.
+  std::vector<slot *> slots;
+  size_t hand = 0;
+  slot *free = nullptr;
+};
+
+struct cache_impl {
+  size_class *cls;
+  bool purgeable;
+  unsigned max_pages = 0;
+  std::unordered_map<unsigned, slot *> pages;
+  // Sentinel of the LRU list; |lru.next| is the most recently unpinned.
+  slot lru;
+
+  cache_impl(size_class *cls, bool purgeable) : cls(cls), purgeable(purgeable) {
+    lru.prev = lru.next = &lru;
+  }
+};
+
+struct arena {
+  shared_page_cache::params_t params;
+  size_t slab_bytes = 0;
+  sqlite3_pcache_methods2 previous{};
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<size_class>> classes;
+  // Mapped slabs and their sizes.
+  std::vector<std::pair<void *, size_t>> slabs;
+  shared_page_cache::stats_t stats;
+};
+
+arena *g_arena = nullptr;
+
+void *map_slab(size_t bytes, bool huge) {
+#ifdef _WIN32
+  (void)huge;
+  return VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT,
+                      PAGE_READWRITE);
+#else
+  // NOTE(acer): Huge pages need slabs aligned to their size; map more and
+  // trim both ends.
+  size_t const align = huge ? bytes : 0;
+  void *p = mmap(nullptr, bytes + align, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return nullptr;
+  if (!align) return p;
+
+  uintptr_t const start = (uintptr_t)p;
+  uintptr_t const aligned = (start + align - 1) & ~(uintptr_t)(align - 1);
+  if (aligned > start) munmap(p, aligned - start);
+  if (start + align > aligned)
+    munmap((void *)(aligned + bytes), start + align - aligned);
+#ifdef MADV_HUGEPAGE
+  madvise((void *)aligned, bytes, MADV_HUGEPAGE);
+#endif
+  return (void *)aligned;
+#endif
+}
+
+void unmap_slab(void *p, size_t bytes) {
+#ifdef _WIN32
+  (void)bytes;
+  VirtualFree(p, 0, MEM_RELEASE);
+#else
+  munmap(p, bytes);
+#endif
+}
+
+/**
+ * Helpers; callers hold |arena::mutex|.
+ */
+void lru_unlink(slot *s) noexcept {
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+  s->prev = s->next = nullptr;
+}
+
+void lru_push(cache_impl *c, slot *s) noexcept {
+  s->prev = &c->lru;
+  s->next = c->lru.next;
+  c->lru.next->prev = s;
+  c->lru.next = s;
+}
+
+// Detach |s| from its cache and keep it for reuse by the caller.
+void detach(slot *s) noexcept {
+  cache_impl *c = s->owner;
+  if (s->pinned)
+    g_arena->stats.pinned -= 1;
+  else if (s->prev)
+    lru_unlink(s);
+  c->pages.erase(s->key);
+  s->owner = nullptr;
+  s->pinned = false;
+  g_arena->stats.pages -= 1;
+}
+
+void free_slot(size_class *cls, slot *s) noexcept {
+  if (s->owner) detach(s);
+  s->next = cls->free;
+  cls->free = s;
+}
+
+bool grow(size_class *cls, bool over_capacity) noexcept {
+  arena &a = *g_arena;
+  size_t const bytes = std::max(a.slab_bytes, cls->slot_size);
+  if (a.stats.bytes_reserved + (int64_t)bytes > a.params.capacity) {
+    if (!over_capacity) return false;
+    a.stats.overcommits += 1;
+  }
+
+  void *slab = map_slab(bytes, a.params.huge_pages && bytes == a.slab_bytes);
+  if (!slab) return false;
+  try {
+    a.slabs.emplace_back(slab, bytes);
+    cls->slots.reserve(cls->slots.size() + bytes / cls->slot_size);
+  } catch (...) {
+    if (!a.slabs.empty() && a.slabs.back().first == slab) a.slabs.pop_back();
+    unmap_slab(slab, bytes);
+    return false;
+  }
+  a.stats.bytes_reserved += (int64_t)bytes;
+
+  auto *base = (char *)slab;
+  for (size_t off = 0; off + cls->slot_size <= bytes; off += cls->slot_size) {
+    auto *s = new (base + off) slot();
+    s->page.pBuf = base + off + slot_header;
+    s->page.pExtra = (char *)s->page.pBuf + cls->page_size;
+    cls->slots.push_back(s);
+    s->next = cls->free;
+    cls->free = s;
+  }
+  return true;
+}
+
+// Recycle the unpinned page of |cls| least recently referenced, by clock.
+slot *clock_evict(size_class *cls) noexcept {
+  size_t const n = cls->slots.size();
+  // Two rounds: the first may only clear reference bits
+  for (size_t i = 0; i < 2 * n; ++i) {
+    slot *s = cls->slots[cls->hand];
+    cls->hand = (cls->hand + 1) % n;
+    if (!s->owner || s->pinned || !s->owner->purgeable) continue;
+    if (s->referenced) {
+      s->referenced = false;
+      continue;
+    }
+    detach(s);
+    g_arena->stats.evictions += 1;
+    return s;
+  }
+  return nullptr;
+}
+
+slot *lru_evict(cache_impl *c) noexcept {
+  if (c->lru.prev == &c->lru) return nullptr;
+  slot *s = c->lru.prev;
+  detach(s);
+  g_arena->stats.evictions += 1;
+  return s;
+}
+
+bool over_cache_size(cache_impl *c) noexcept {
+  return g_arena->params.honor_cache_size && c->purgeable &&
+         c->max_pages > 0 && c->pages.size() >= c->max_pages;
+}
+
+// Get a slot for a new page of |c|; null if none can be had for
+// |create_flag|.
+slot *acquire(cache_impl *c, int create_flag) noexcept {
+  size_class *cls = c->cls;
+  if (over_cache_size(c)) {
+    if (slot *s = lru_evict(c)) return s;
+    if (create_flag < 2) return nullptr;
+  }
+
+  if (cls->free || grow(cls, !c->purgeable)) {
+    slot *s = cls->free;
+    cls->free = s->next;
+    s->next = nullptr;
+    return s;
+  }
+  if (slot *s = clock_evict(cls)) return s;
+  if (create_flag == 2 && grow(cls, true)) {
+    slot *s = cls->free;
+    cls->free = s->next;
+    s->next = nullptr;
+    return s;
+  }
+  return nullptr;
+}
+
+/**
+ * sqlite3_pcache_methods2
+ */
+int pc_init(void *) { return SQLITE_OK; }
+
+void pc_shutdown(void *) {}
+
+sqlite3_pcache *pc_create(int page_size, int extra_size, int purgeable) {
+  arena &a = *g_arena;
+  std::lock_guard<std::mutex> lk(a.mutex);
+  try {
+    size_class *cls = nullptr;
+    for (auto &c : a.classes) {
+      if (c->page_size == page_size && c->extra_size == extra_size)
+        cls = c.get();
+    }
+    if (!cls) {
+      auto c = std::make_unique<size_class>();
+      c->page_size = page_size;
+      c->extra_size = extra_size;
+      c->slot_size =
+          (slot_header + (size_t)page_size + (size_t)extra_size + 15) &
+          ~size_t(15);
+      a.classes.push_back(std::move(c));
+      cls = a.classes.back().get();
+    }
+    auto *cache = new cache_impl(cls, purgeable != 0);
+    a.stats.caches += 1;
+    return (sqlite3_pcache *)cache;
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void pc_cachesize(sqlite3_pcache *p, int max_pages) {
+  auto *c = (cache_impl *)p;
+  std::lock_guard<std::mutex> lk(g_arena->mutex);
+  c->max_pages = max_pages > 0 ? (unsigned)max_pages : 0;
+  while (over_cache_size(c) && c->pages.size() > c->max_pages) {
+    slot *s = lru_evict(c);
+    if (!s) break;
+    free_slot(c->cls, s);
+  }
+}
+
+int pc_pagecount(sqlite3_pcache *p) {
+  auto *c = (cache_impl *)p;
+  std::lock_guard<std::mutex> lk(g_arena->mutex);
+  return (int)c->pages.size();
+}
+
+sqlite3_pcache_page *pc_fetch(sqlite3_pcache *p, unsigned key,
+                              int create_flag) {
+  auto *c = (cache_impl *)p;
+  arena &a = *g_arena;
+  std::lock_guard<std::mutex> lk(a.mutex);
+
+  auto i = c->pages.find(key);
+  if (i != c->pages.end()) {
+    slot *s = i->second;
+    if (!s->pinned) {
+      if (s->prev) lru_unlink(s);
+      s->pinned = true;
+      a.stats.pinned += 1;
+    }
+    s->referenced = true;
+    a.stats.hits += 1;
+    return &s->page;
+  }
+  a.stats.misses += create_flag ? 1 : 0;
+  if (!create_flag) return nullptr;
+
+  slot *s = acquire(c, create_flag);
+  if (!s) {
+    a.stats.failures += 1;
+    return nullptr;
+  }
+  try {
+    c->pages.emplace(key, s);
+  } catch (...) {
+    free_slot(c->cls, s);
+    a.stats.failures += 1;
+    return nullptr;
+  }
+  // NOTE(acer): sqlite3 tells a new page by zeroed extra bytes
+  std::memset(s->page.pExtra, 0, (size_t)c->cls->extra_size);
+  s->owner = c;
+  s->key = key;
+  s->pinned = true;
+  s->referenced = true;
+  a.stats.pages += 1;
+  a.stats.pinned += 1;
+  return &s->page;
+}
+
+void pc_unpin(sqlite3_pcache *p, sqlite3_pcache_page *page, int discard) {
+  auto *c = (cache_impl *)p;
+  auto *s = (slot *)page;
+  std::lock_guard<std::mutex> lk(g_arena->mutex);
+  if (discard) {
+    free_slot(c->cls, s);
+    return;
+  }
+  s->pinned = false;
+  g_arena->stats.pinned -= 1;
+  // Pages of in-memory databases are never recycled
+  if (!c->purgeable) return;
+  lru_push(c, s);
+  if (over_cache_size(c) && c->pages.size() > c->max_pages)
+    free_slot(c->cls, lru_evict(c));
+}
+
+void pc_rekey(sqlite3_pcache *p, sqlite3_pcache_page *page, unsigned old_key,
+              unsigned new_key) {
+  auto *c = (cache_impl *)p;
+  auto *s = (slot *)page;
+  std::lock_guard<std::mutex> lk(g_arena->mutex);
+  auto i = c->pages.find(new_key);
+  if (i != c->pages.end() && i->second != s) free_slot(c->cls, i->second);
+  c->pages.erase(old_key);
+  s->key = new_key;
+  // NOTE(acer): The node of |old_key| was just freed; this does not throw
+  // unless allocation fails, which leaves the page out of the cache.
+  try {
+    c->pages.emplace(new_key, s);
+  } catch (...) {
+    s->owner = nullptr;
+    if (s->pinned) g_arena->stats.pinned -= 1;
+    if (s->prev) lru_unlink(s);
+    g_arena->stats.pages -= 1;
+    s->next = c->cls->free;
+    c->cls->free = s;
+  }
+}
+
+void pc_truncate(sqlite3_pcache *p, unsigned limit) {
+  auto *c = (cache_impl *)p;
+  std::lock_guard<std::mutex> lk(g_arena->mutex);
+  std::vector<slot *> drop;
+  for (auto const &kv : c->pages) {
+    if (kv.first >= limit) drop.push_back(kv.second);
+  }
+  for (slot *s : drop) free_slot(c->cls, s);
+}
+
+void pc_destroy(sqlite3_pcache *p) {
+  auto *c = (cache_impl *)p;
+  {
+    std::lock_guard<std::mutex> lk(g_arena->mutex);
+    while (!c->pages.empty()) free_slot(c->cls, c->pages.begin()->second);
+    g_arena->stats.caches -= 1;
+  }
+  delete c;
+}
+
+void pc_shrink(sqlite3_pcache *p) {
+  auto *c = (cache_impl *)p;
+  std::lock_guard<std::mutex> lk(g_arena->mutex);
+  while (slot *s = lru_evict(c)) free_slot(c->cls, s);
+}
+
+sqlite3_pcache_methods2 const methods = {
+    1,           nullptr,     &pc_init,     &pc_shutdown,
+    &pc_create,  &pc_cachesize, &pc_pagecount, &pc_fetch,
+    &pc_unpin,   &pc_rekey,   &pc_truncate, &pc_destroy,
+    &pc_shrink};
+
+}  // namespace
+
+/**
+ * shared_page_cache impl
+ */
+shared_page_cache::shared_page_cache(params_t const &params) {
+  if (g_arena) throw error(SQLITE_MISUSE);
+
+  auto a = std::make_unique<arena>();
+  a->params = params;
+  size_t const unit = params.huge_pages ? (2 << 20) : (64 << 10);
+  a->slab_bytes = std::max<size_t>(
+      (params.slab_bytes + unit - 1) / unit * unit, unit);
+
+  sqlite3_shutdown();
+  int ec = sqlite3_config(SQLITE_CONFIG_GETPCACHE2, &a->previous);
+  if (!ec) {
+    g_arena = a.get();
+    ec = sqlite3_config(SQLITE_CONFIG_PCACHE2, &methods);
+  }
+  if (ec) {
+    g_arena = nullptr;
+    throw error(ec);
+  }
+  a.release();
+}
+
+shared_page_cache::~shared_page_cache() {
+  sqlite3_shutdown();
+  sqlite3_config(SQLITE_CONFIG_PCACHE2, &g_arena->previous);
+
+  for (auto const &slab : g_arena->slabs) unmap_slab(slab.first, slab.second);
+  delete g_arena;
+  g_arena = nullptr;
+}
+
+shared_page_cache::stats_t shared_page_cache::stats() const {
+  std::lock_guard<std::mutex> lk(g_arena->mutex);
+  stats_t s = g_arena->stats;
+  s.capacity = g_arena->params.capacity;
+  return s;
+}
+
+}  // namespace sqlite3cpp
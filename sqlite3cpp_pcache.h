@@ -0,0 +1,106 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <cstdint>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT shared_page_cache {
+  // Page cache of all connections in the process drawing from one slab
+  // arena with a global memory cap. e.g.
+  //
+  // shared_page_cache::params_t params;
+  // params.capacity = int64_t(512) << 20;
+  // shared_page_cache cache(params);  // before connections are opened
+  // database db("app.db");
+  //
+  // Installed by `sqlite3_config(SQLITE_CONFIG_PCACHE2)`, so no connection
+  // may be open while a shared_page_cache is constructed or destroyed; both
+  // call `sqlite3_shutdown()`. The default page cache is restored on
+  // destruction. At most one instance exists at a time.
+  //
+  // sqlite3 still asks for one cache per connection and writes pages into
+  // it, so a page read by two connections is cached twice; what is shared
+  // is memory. Slots come from slabs of |slab_bytes| (transparent huge
+  // pages on Linux), and once |capacity| is reserved, a new page recycles
+  // the unpinned page least recently referenced by any connection (clock
+  // eviction), so hot connections take memory from cold ones. With
+  // |honor_cache_size| each connection also keeps within its
+  // `pragma cache_size`.
+  //
+  // Caches of in-memory databases can not drop pages and are allowed past
+  // |capacity|, as are pages sqlite3 can not do without; both are counted
+  // in |stats_t::overcommits|. Memory of the arena is not part of
+  // `sqlite3_memory_used()`. All caches share one mutex.
+
+  struct params_t {
+    // Bytes of slabs to reserve at most.
+    int64_t capacity = int64_t(256) << 20;
+    // Bytes per slab, rounded up to 64KiB (2MiB with |huge_pages|).
+    size_t slab_bytes = 2 << 20;
+    bool huge_pages = true;
+    bool honor_cache_size = true;
+  };
+
+  struct stats_t {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // Pages recycled for other pages, by the global clock or to keep a
+    // connection within its cache size.
+    uint64_t evictions = 0;
+    // Slabs reserved past |capacity|.
+    uint64_t overcommits = 0;
+    // Fetches that got no page as nothing could be recycled.
+    uint64_t failures = 0;
+    int64_t pages = 0;
+    int64_t pinned = 0;
+    int64_t caches = 0;
+    int64_t bytes_reserved = 0;
+    int64_t capacity = 0;
+  };
+
+  // Install as the page cache of the process. Throws sqlite3cpp::error
+  // with SQLITE_MISUSE if another instance is installed, or the error of
+  // `sqlite3_config()`.
+  shared_page_cache(params_t const &params);
+  ~shared_page_cache();
+
+  shared_page_cache(shared_page_cache const &) = delete;
+  shared_page_cache &operator=(shared_page_cache const &) = delete;
+
+  stats_t stats() const;
+};
+
+}  // namespace sqlite3cpp
@@ -0,0 +1,286 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "sqlite3cpp.h"
+#include "sqlite3cpp_ring.h"
+
+namespace sqlite3cpp {
+
+template <typename... Cols>
+struct prefetch {
+  // Step the query of a cursor on a producer thread ahead of the consumer,
+  // so sqlite3 work overlaps per-row work of the application. e.g.
+  //
+  // auto c = db.make_cursor();
+  // c.execute("select id, body from Doc");
+  // for (auto const &[id, body] : prefetch<int64_t, std::string>(c)) {
+  //   expensive(id, body);
+  // }
+  //
+  // The producer decodes rows into batches of std::tuple<Cols...> by
+  // |row::to()| and hands them over via a lock-free ring of |batches|
+  // slots; it blocks while the ring is full and the consumer blocks while
+  // it is empty, so at most |batches| + 2 batches are in memory.
+  //
+  // An exception raised by the producer, e.g. sqlite3cpp::error or
+  // interrupted, is rethrown to the consumer after rows before it were
+  // consumed. Destroying the prefetch stops the producer after its current
+  // row and resets the statement.
+  //
+  // The query runs from its first row regardless of rows already iterated.
+  // Neither the cursor nor its connection may be used by other threads
+  // until the prefetch is destroyed. Views, i.e. std::string_view, are not
+  // supported as they expire once the producer steps.
+  static_assert((... && !std::is_same_v<Cols, std::string_view>),
+                "std::string_view columns expire before they are consumed");
+  static_assert(
+      (... && !std::is_same_v<Cols, std::optional<std::string_view>>),
+      "std::string_view columns expire before they are consumed");
+
+  using row_t = std::tuple<Cols...>;
+  using batch_t = std::vector<row_t>;
+
+  struct params_t {
+    // Rows per batch; handing over a batch costs about two atomic stores.
+    size_t batch_rows = 256;
+    // Slots of the ring, rounded up to a power of two.
+    size_t batches = 4;
+  };
+
+  struct stats_t {
+    uint64_t rows = 0;
+    uint64_t batches = 0;
+    // Times the producer waited for a free slot, i.e. backpressure.
+    uint64_t producer_waits = 0;
+    // Times the consumer waited for a batch.
+    uint64_t consumer_waits = 0;
+  };
+
+  struct iterator {
+    using iterator_category = std::input_iterator_tag;
+    using value_type = row_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = row_t *;
+    using reference = row_t &;
+
+    iterator() noexcept = default;
+    row_t &operator*() const noexcept { return m_owner->m_current[m_index]; }
+    row_t *operator->() const noexcept { return &**this; }
+    iterator &operator++();
+    bool operator==(iterator const &i) const noexcept {
+      return m_owner == i.m_owner && m_index == i.m_index;
+    }
+    bool operator!=(iterator const &i) const noexcept { return !(*this == i); }
+
+   private:
+    friend struct prefetch;
+    explicit iterator(prefetch *owner) noexcept : m_owner(owner) {}
+    prefetch *m_owner = nullptr;
+    size_t m_index = 0;
+  };
+
+  prefetch(cursor &csr) : prefetch(csr, params_t()) {}
+  prefetch(cursor &csr, params_t const &params);
+  ~prefetch();
+
+  prefetch(prefetch const &) = delete;
+  prefetch &operator=(prefetch const &) = delete;
+
+  // Get the next batch, blocking until one is available. Returns false at
+  // the end of results. Rethrows the exception raised by the producer.
+  bool next_batch(batch_t &batch);
+
+  // Iterate rows of remaining batches. A single pass only; |begin()|
+  // continues where the last iteration stopped.
+  iterator begin();
+  iterator end() noexcept { return {}; }
+
+  stats_t stats() const noexcept;
+
+ private:
+  void run() noexcept;
+  bool publish(batch_t &&batch);
+  void notify();
+
+  cursor &m_csr;
+  params_t m_params;
+  detail::spsc_ring<batch_t> m_ring;
+  batch_t m_current;
+
+  // NOTE(acer): The ring is lock-free; the mutex only guards sleeping on
+  // a full or empty ring, once per batch at most.
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::atomic<bool> m_stop{false};
+  bool m_done = false;
+  std::exception_ptr m_error;
+
+  std::atomic<uint64_t> m_rows{0};
+  std::atomic<uint64_t> m_batches{0};
+  std::atomic<uint64_t> m_producer_waits{0};
+  std::atomic<uint64_t> m_consumer_waits{0};
+
+  std::thread m_thread;
+};
+
+/**
+ * prefetch impl
+ */
+template <typename... Cols>
+prefetch<Cols...>::prefetch(cursor &csr, params_t const &params)
+    : m_csr(csr),
+      m_params(params),
+      m_ring(params.batches),
+      m_thread([this] { run(); }) {}
+
+template <typename... Cols>
+prefetch<Cols...>::~prefetch() {
+  m_stop = true;
+  notify();
+  m_thread.join();
+}
+
+template <typename... Cols>
+void prefetch<Cols...>::notify() {
+  // NOTE(acer): Locking orders the notification after a waiter checks its
+  // condition, or the wake-up could be lost.
+  { std::lock_guard<std::mutex> lk(m_mutex); }
+  m_cond.notify_all();
+}
+
+template <typename... Cols>
+bool prefetch<Cols...>::publish(batch_t &&batch) {
+  size_t const rows = batch.size();
+  bool pushed = m_ring.push(std::move(batch));
+  if (!pushed) {
+    m_producer_waits.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_cond.wait(lk, [&] {
+      return m_stop.load() || (pushed = m_ring.push(std::move(batch)));
+    });
+  }
+  if (!pushed) return false;
+
+  m_rows.fetch_add(rows, std::memory_order_relaxed);
+  m_batches.fetch_add(1, std::memory_order_relaxed);
+  notify();
+  return true;
+}
+
+template <typename... Cols>
+void prefetch<Cols...>::run() noexcept {
+  std::exception_ptr error;
+  batch_t batch;
+  try {
+    size_t const batch_rows = std::max<size_t>(m_params.batch_rows, 1);
+    batch.reserve(batch_rows);
+    for (auto i = m_csr.begin(); i != m_csr.end(); ++i) {
+      if (m_stop.load(std::memory_order_relaxed)) break;
+      batch.push_back(i->template to<Cols...>());
+      if (batch.size() < batch_rows) continue;
+      if (!publish(std::move(batch))) break;
+      batch = batch_t();
+      batch.reserve(batch_rows);
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  // Rows decoded before an error are delivered before the error
+  try {
+    if (!batch.empty()) publish(std::move(batch));
+  } catch (...) {
+    if (!error) error = std::current_exception();
+  }
+
+  if (m_csr.get()) sqlite3_reset(m_csr.get());
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_error = error;
+    m_done = true;
+  }
+  m_cond.notify_all();
+}
+
+template <typename... Cols>
+bool prefetch<Cols...>::next_batch(batch_t &batch) {
+  bool popped = m_ring.pop(batch);
+  if (!popped) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (!m_done) m_consumer_waits.fetch_add(1, std::memory_order_relaxed);
+    m_cond.wait(lk, [&] { return (popped = m_ring.pop(batch)) || m_done; });
+    if (!popped) {
+      if (m_error) std::rethrow_exception(std::exchange(m_error, nullptr));
+      return false;
+    }
+  }
+  notify();
+  return true;
+}
+
+template <typename... Cols>
+typename prefetch<Cols...>::iterator prefetch<Cols...>::begin() {
+  if (!next_batch(m_current)) return end();
+  return iterator(this);
+}
+
+template <typename... Cols>
+typename prefetch<Cols...>::iterator &
+prefetch<Cols...>::iterator::operator++() {
+  if (++m_index < m_owner->m_current.size()) return *this;
+  m_index = 0;
+  if (!m_owner->next_batch(m_owner->m_current)) m_owner = nullptr;
+  return *this;
+}
+
+template <typename... Cols>
+typename prefetch<Cols...>::stats_t prefetch<Cols...>::stats() const noexcept {
+  stats_t s;
+  s.rows = m_rows.load(std::memory_order_relaxed);
+  s.batches = m_batches.load(std::memory_order_relaxed);
+  s.producer_waits = m_producer_waits.load(std::memory_order_relaxed);
+  s.consumer_waits = m_consumer_waits.load(std::memory_order_relaxed);
+  return s;
+}
+
+}  // namespace sqlite3cpp
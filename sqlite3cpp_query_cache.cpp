@@ -0,0 +1,407 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_query_cache.h"
+#include <algorithm>
+
+namespace sqlite3cpp {
+
+/**
+ * value_scratch impl
+ */
+namespace detail {
+
+sqlite3_stmt *value_scratch::lock() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_stmt) {
+    sqlite3 *db = nullptr;
+    int ec = sqlite3_open_v2(":memory:", &db,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                             nullptr);
+    std::unique_ptr<sqlite3, sqlite3_deleter> guard(db);
+    if (ec) throw error(ec);
+
+    sqlite3_stmt *stmt = nullptr;
+    ec = sqlite3_prepare_v2(db, "select ?1", -1, &stmt, nullptr);
+    if (ec) throw error(ec);
+    m_db = std::move(guard);
+    m_stmt.reset(stmt);
+  }
+  lock.release();
+  return m_stmt.get();
+}
+
+void value_scratch::unlock() noexcept {
+  sqlite3_reset(m_stmt.get());
+  sqlite3_clear_bindings(m_stmt.get());
+  m_mutex.unlock();
+}
+
+void scratch_row::bind(int type, int64_t i, double d, std::string_view s) {
+  // NOTE(acer): Text and blob reference the cached result, which outlives
+  // this row.
+  int ec = 0;
+  switch (type) {
+    case SQLITE_INTEGER:
+      ec = sqlite3_bind_int64(m_stmt, 1, i);
+      break;
+    case SQLITE_FLOAT:
+      ec = sqlite3_bind_double(m_stmt, 1, d);
+      break;
+    case SQLITE_TEXT:
+      ec = sqlite3_bind_text(m_stmt, 1, s.data(), (int)s.size(),
+                             SQLITE_STATIC);
+      break;
+    case SQLITE_BLOB:
+      ec = sqlite3_bind_blob(m_stmt, 1, s.data(), (int)s.size(),
+                             SQLITE_STATIC);
+      break;
+    default:
+      ec = sqlite3_bind_null(m_stmt, 1);
+      break;
+  }
+  if (ec) throw error(ec);
+}
+
+void scratch_row::step() {
+  int ec = sqlite3_step(m_stmt);
+  if (ec != SQLITE_ROW) throw error(ec);
+}
+
+}  // namespace detail
+
+/**
+ * cached_row impl
+ */
+bool cached_row::is_null(size_t col) const noexcept {
+  return m_res->get(m_index, col).type == SQLITE_NULL;
+}
+
+/**
+ * cached_result impl
+ */
+size_t cached_result::memory() const noexcept {
+  return sizeof(*this) + m_offsets.capacity() * sizeof(uint32_t) +
+         m_arena.capacity();
+}
+
+void cached_result::append(sqlite3_stmt *stmt) {
+  auto put = [this](void const *p, size_t n) {
+    auto *c = (char const *)p;
+    m_arena.insert(m_arena.end(), c, c + n);
+  };
+
+  for (size_t col = 0; col < m_columns; ++col) {
+    int i = (int)col;
+    char type = (char)sqlite3_column_type(stmt, i);
+    m_offsets.push_back((uint32_t)m_arena.size());
+    put(&type, 1);
+
+    switch (type) {
+      case SQLITE_INTEGER: {
+        int64_t v = sqlite3_column_int64(stmt, i);
+        put(&v, sizeof(v));
+        break;
+      }
+      case SQLITE_FLOAT: {
+        double v = sqlite3_column_double(stmt, i);
+        put(&v, sizeof(v));
+        break;
+      }
+      case SQLITE_TEXT:
+      case SQLITE_BLOB: {
+        void const *p = type == SQLITE_TEXT
+                            ? (void const *)sqlite3_column_text(stmt, i)
+                            : sqlite3_column_blob(stmt, i);
+        uint32_t n = (uint32_t)sqlite3_column_bytes(stmt, i);
+        put(&n, sizeof(n));
+        if (n) put(p, n);
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  ++m_rows;
+}
+
+cached_result::cell cached_result::get(size_t row,
+                                       size_t col) const noexcept {
+  cell c{SQLITE_NULL, 0, 0.0, {}};
+  if (row >= m_rows || col >= m_columns) return c;
+
+  char const *p = m_arena.data() + m_offsets[row * m_columns + col];
+  c.type = *p++;
+  switch (c.type) {
+    case SQLITE_INTEGER:
+      std::memcpy(&c.i, p, sizeof(c.i));
+      break;
+    case SQLITE_FLOAT:
+      std::memcpy(&c.d, p, sizeof(c.d));
+      break;
+    case SQLITE_TEXT:
+    case SQLITE_BLOB: {
+      uint32_t n = 0;
+      std::memcpy(&n, p, sizeof(n));
+      c.s = std::string_view(p + sizeof(n), n);
+      break;
+    }
+    default:
+      break;
+  }
+  return c;
+}
+
+/**
+ * query_cache impl
+ */
+query_cache::query_cache(database &db) : query_cache(db, {}) {}
+
+query_cache::query_cache(database &db, params_t const &params)
+    : m_db(db),
+      m_params(params),
+      m_scratch(std::make_shared<detail::value_scratch>()) {
+  change_listener listener;
+  listener.update = [this](int, char const *, char const *table,
+                           sqlite3_int64) {
+    ++m_hooked_changes;
+    auto it = m_table_gen.find(table);
+    if (it != m_table_gen.end()) it->second += 1;
+  };
+  m_listener = m_db.add_change_listener(std::move(listener));
+
+  // NOTE(acer): Added once as every change of the authorizer expires all
+  // statements prepared on the connection; it records tables read only
+  // while |prepare()| collects them.
+  m_authorizer = m_db.add_authorizer([this](int action, char const *table,
+                                            char const *, char const *,
+                                            char const *) {
+    if (m_collecting && action == SQLITE_READ && table) {
+      auto &deps = *m_collecting;
+      auto it = std::find_if(deps.begin(), deps.end(), [table](auto const &e) {
+        return e.first == table;
+      });
+      if (it == deps.end()) deps.emplace_back(table, 0);
+    }
+    return SQLITE_OK;
+  });
+  m_total_changes = sqlite3_total_changes64(m_db.get());
+}
+
+query_cache::~query_cache() {
+  m_db.remove_authorizer(m_authorizer);
+  m_db.remove_change_listener(m_listener);
+}
+
+void query_cache::clear() noexcept {
+  m_entries.clear();
+  m_lru.clear();
+  m_stats.memory = 0;
+  m_stats.entries = 0;
+}
+
+query_cache::stats_t query_cache::stats() const noexcept { return m_stats; }
+
+void query_cache::encode(std::string &key, int64_t val) {
+  key.push_back('i');
+  key.append((char const *)&val, sizeof(val));
+}
+
+void query_cache::encode(std::string &key, double val) {
+  key.push_back('f');
+  key.append((char const *)&val, sizeof(val));
+}
+
+void query_cache::encode(std::string &key, std::string_view val) {
+  uint32_t n = (uint32_t)val.size();
+  key.push_back('t');
+  key.append((char const *)&n, sizeof(n));
+  key.append(val.data(), val.size());
+}
+
+void query_cache::encode(std::string &key, std::nullptr_t) {
+  key.push_back('n');
+}
+
+void query_cache::encode(std::string &key, sqlite3_value *val) {
+  switch (sqlite3_value_type(val)) {
+    case SQLITE_INTEGER:
+      encode(key, (int64_t)sqlite3_value_int64(val));
+      break;
+    case SQLITE_FLOAT:
+      encode(key, sqlite3_value_double(val));
+      break;
+    case SQLITE_TEXT:
+      encode(key, std::string_view((char const *)sqlite3_value_text(val),
+                                   (size_t)sqlite3_value_bytes(val)));
+      break;
+    case SQLITE_BLOB: {
+      uint32_t n = (uint32_t)sqlite3_value_bytes(val);
+      key.push_back('b');
+      key.append((char const *)&n, sizeof(n));
+      if (n) key.append((char const *)sqlite3_value_blob(val), n);
+      break;
+    }
+    default:
+      encode(key, nullptr);
+      break;
+  }
+}
+
+void query_cache::validate() {
+  if (!m_version_stmt) {
+    sqlite3_stmt *stmt = nullptr;
+    int ec = sqlite3_prepare_v2(
+        m_db.get(),
+        "select data_version, (select schema_version from "
+        "pragma_schema_version) from pragma_data_version",
+        -1, &stmt, nullptr);
+    if (ec) throw error(ec);
+    m_version_stmt.reset(stmt);
+  }
+
+  auto *stmt = m_version_stmt.get();
+  int ec = sqlite3_step(stmt);
+  if (ec != SQLITE_ROW) {
+    sqlite3_reset(stmt);
+    throw error(ec);
+  }
+  int64_t data_version = sqlite3_column_int64(stmt, 0);
+  int64_t schema_version = sqlite3_column_int64(stmt, 1);
+  sqlite3_reset(stmt);
+
+  // Changes made by this connection but not reported by the update hook,
+  // e.g. WITHOUT ROWID tables, can not be attributed to a table.
+  int64_t total_changes = sqlite3_total_changes64(m_db.get());
+  bool unattributed = (uint64_t)(total_changes - m_total_changes) >
+                      m_hooked_changes - m_seen_hooked_changes;
+  m_total_changes = total_changes;
+  m_seen_hooked_changes = m_hooked_changes;
+
+  bool changed = data_version != m_data_version ||
+                 schema_version != m_schema_version || unattributed;
+  m_data_version = data_version;
+  m_schema_version = schema_version;
+
+  if (changed && !m_entries.empty()) {
+    m_stats.invalidations += m_entries.size();
+    clear();
+  }
+}
+
+sqlite3_stmt *query_cache::prepare(std::string const &sql, deps_t &deps) {
+  // NOTE(acer): Authorizers of the application still decide; statements they
+  // deny fail as they would without the cache.
+  m_collecting = &deps;
+  sqlite3_stmt *stmt = nullptr;
+  int ec = sqlite3_prepare_v2(m_db.get(), sql.c_str(), (int)sql.size(), &stmt,
+                              nullptr);
+  m_collecting = nullptr;
+
+  if (ec) throw error(ec);
+  if (!sqlite3_stmt_readonly(stmt)) {
+    sqlite3_finalize(stmt);
+    throw error(SQLITE_MISUSE);
+  }
+
+  for (auto &d : deps) d.second = m_table_gen[d.first];
+  return stmt;
+}
+
+query_cache::result_ptr query_cache::lookup(std::string const &key) {
+  auto it = m_entries.find(key);
+  if (it == m_entries.end()) {
+    m_stats.misses += 1;
+    return {};
+  }
+
+  for (auto const &d : it->second.deps) {
+    if (m_table_gen[d.first] != d.second) {
+      m_stats.invalidations += 1;
+      m_stats.misses += 1;
+      evict(it);
+      return {};
+    }
+  }
+
+  m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+  m_stats.hits += 1;
+  return it->second.result;
+}
+
+query_cache::result_ptr query_cache::materialize(std::string key,
+                                                 sqlite3_stmt *stmt,
+                                                 deps_t deps) {
+  auto res = std::make_shared<cached_result>();
+  res->m_scratch = m_scratch;
+  res->m_columns = (size_t)sqlite3_column_count(stmt);
+
+  int ec = 0;
+  while (SQLITE_ROW == (ec = sqlite3_step(stmt))) res->append(stmt);
+  if (ec != SQLITE_DONE) throw error(ec);
+
+  res->m_offsets.shrink_to_fit();
+  res->m_arena.shrink_to_fit();
+
+  // NOTE(acer): Rows read inside a transaction may include its own changes,
+  // which neither data_version nor a ROLLBACK (TO) would invalidate.
+  if (!sqlite3_get_autocommit(m_db.get())) return res;
+
+  size_t bytes = res->memory() + key.size() * 2 + sizeof(entry);
+  if (bytes > m_params.memory_budget) return res;
+
+  while (!m_lru.empty() &&
+         m_stats.memory + bytes > m_params.memory_budget) {
+    m_stats.evictions += 1;
+    evict(m_entries.find(m_lru.back()));
+  }
+
+  m_lru.push_front(key);
+  auto &e = m_entries[std::move(key)];
+  e.lru = m_lru.begin();
+  e.result = res;
+  e.deps = std::move(deps);
+  e.bytes = bytes;
+  m_stats.memory += bytes;
+  m_stats.entries = m_entries.size();
+  return res;
+}
+
+void query_cache::evict(
+    std::unordered_map<std::string, entry>::iterator it) noexcept {
+  m_stats.memory -= it->second.bytes;
+  m_lru.erase(it->second.lru);
+  m_entries.erase(it);
+  m_stats.entries = m_entries.size();
+}
+
+}  // namespace sqlite3cpp
@@ -0,0 +1,349 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct cached_result;
+
+namespace detail {
+
+struct SQLITE3CPP_EXPORT value_scratch {
+  // Statement `select ?1` on a private in-memory connection, used to convert
+  // values of types not native to sqlite3 by |type_traits| outside of a
+  // query: bind, then read column 0. The connection is opened on first use.
+  // Use by |scratch_row| only.
+  sqlite3_stmt *lock();
+  void unlock() noexcept;
+
+ private:
+  std::mutex m_mutex;
+  std::unique_ptr<sqlite3, sqlite3_deleter> m_db;
+  std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> m_stmt;
+};
+
+struct SQLITE3CPP_EXPORT scratch_row {
+  explicit scratch_row(value_scratch &scratch)
+      : m_scratch(scratch), m_stmt(scratch.lock()) {}
+  ~scratch_row() { m_scratch.unlock(); }
+  scratch_row(scratch_row const &) = delete;
+  scratch_row &operator=(scratch_row const &) = delete;
+
+  sqlite3_stmt *get() const noexcept { return m_stmt; }
+  // Bind a value of a cached cell.
+  void bind(int type, int64_t i, double d, std::string_view s);
+  // Step to the row of the bound value.
+  void step();
+
+ private:
+  value_scratch &m_scratch;
+  sqlite3_stmt *m_stmt;
+};
+
+}  // namespace detail
+
+struct SQLITE3CPP_EXPORT cached_row {
+  // Retrieve tuple of values from this row. Supported types are those of
+  // |type_traits|. std::string_view refers to the cached result and is valid
+  // as long as the result is alive. Numeric values read as text are empty.
+  template <typename... Cols>
+  std::tuple<Cols...> to() const;
+
+  bool is_null(size_t col) const noexcept;
+
+ private:
+  friend struct cached_result;
+  cached_row(cached_result const *res, size_t index) noexcept
+      : m_res(res), m_index(index) {}
+  cached_result const *m_res;
+  size_t m_index;
+};
+
+struct SQLITE3CPP_EXPORT cached_result {
+  // Immutable, materialized rows of a query. Values of all cells are packed
+  // into one arena; each cell is a type tag followed by its payload.
+
+  struct iterator {
+    cached_row operator*() const noexcept { return m_res->at(m_index); }
+    iterator &operator++() noexcept {
+      ++m_index;
+      return *this;
+    }
+    bool operator==(iterator const &i) const noexcept {
+      return m_index == i.m_index;
+    }
+    bool operator!=(iterator const &i) const noexcept { return !(*this == i); }
+
+    cached_result const *m_res;
+    size_t m_index;
+  };
+
+  size_t size() const noexcept { return m_rows; }
+  size_t columns() const noexcept { return m_columns; }
+  cached_row at(size_t index) const noexcept { return {this, index}; }
+  iterator begin() const noexcept { return {this, 0}; }
+  iterator end() const noexcept { return {this, m_rows}; }
+
+  // Bytes taken by this result.
+  size_t memory() const noexcept;
+
+ private:
+  friend struct cached_row;
+  friend struct query_cache;
+
+  struct cell {
+    int type;
+    int64_t i;
+    double d;
+    std::string_view s;
+  };
+
+  void append(sqlite3_stmt *stmt);
+  cell get(size_t row, size_t col) const noexcept;
+
+  size_t m_rows = 0;
+  size_t m_columns = 0;
+  std::vector<uint32_t> m_offsets;
+  std::vector<char> m_arena;
+  std::shared_ptr<detail::value_scratch> m_scratch;
+};
+
+struct SQLITE3CPP_EXPORT query_cache {
+  // Read-through cache of query results keyed by SQL and bound values. e.g.
+  //
+  // query_cache cache(db);
+  // auto res = cache.query("select a, b from T where a > ?", 1);
+  // for (auto const &row : *res) {
+  //   auto [a, b] = row.to<int, std::string_view>();
+  // }
+  //
+  // Only read-only statements are cached; others raise
+  // sqlite3cpp::error(SQLITE_MISUSE). A result is invalidated when
+  //
+  // - a table it reads is changed via this connection (update hook), or
+  // - another connection commits to the database (`pragma data_version`), or
+  // - the schema changes (`pragma schema_version`).
+  //
+  // Results of queries run inside a transaction are returned but not
+  // cached, as the transaction can still roll back.
+  //
+  // Tables read by a statement are collected by an authorizer the cache
+  // adds for its lifetime (see |database::add_authorizer()|); authorizers of
+  // the application stay in effect. The cache is not thread-safe.
+
+  struct params_t {
+    // Total bytes of cached results; least recently used ones are evicted.
+    size_t memory_budget = 16 << 20;
+  };
+
+  struct stats_t {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+    size_t entries = 0;
+    size_t memory = 0;
+
+    double hit_rate() const noexcept {
+      auto total = hits + misses;
+      return total ? (double)hits / total : 0.0;
+    }
+  };
+
+  using result_ptr = std::shared_ptr<cached_result const>;
+
+  query_cache(database &db);
+  query_cache(database &db, params_t const &params);
+  ~query_cache();
+
+  query_cache(query_cache const &) = delete;
+  query_cache &operator=(query_cache const &) = delete;
+
+  // Get rows of |sql| with bound |args| from cache, or execute and cache them.
+  template <typename... Args>
+  result_ptr query(std::string const &sql, Args &&... args);
+
+  // Drop all cached results.
+  void clear() noexcept;
+
+  stats_t stats() const noexcept;
+
+ private:
+  using deps_t = std::vector<std::pair<std::string, uint64_t>>;
+
+  struct entry {
+    std::list<std::string>::iterator lru;
+    result_ptr result;
+    deps_t deps;
+    size_t bytes;
+  };
+
+  static void encode(std::string &key, int64_t val);
+  static void encode(std::string &key, double val);
+  static void encode(std::string &key, std::string_view val);
+  static void encode(std::string &key, std::nullptr_t);
+  static void encode(std::string &key, sqlite3_value *val);
+  template <typename T>
+  void encode_arg(std::string &key, T const &val);
+
+  sqlite3_stmt *prepare(std::string const &sql, deps_t &deps);
+  result_ptr lookup(std::string const &key);
+  result_ptr materialize(std::string key, sqlite3_stmt *stmt, deps_t deps);
+  void validate();
+  void evict(std::unordered_map<std::string, entry>::iterator it) noexcept;
+
+  database &m_db;
+  params_t m_params;
+  int m_listener = -1;
+  int m_authorizer = -1;
+  // Tables read by the statement being prepared, if any
+  deps_t *m_collecting = nullptr;
+
+  std::unordered_map<std::string, entry> m_entries;
+  std::list<std::string> m_lru;
+  std::unordered_map<std::string, uint64_t> m_table_gen;
+  // Shared with results for conversions by |type_traits|
+  std::shared_ptr<detail::value_scratch> m_scratch;
+
+  std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> m_version_stmt;
+  int64_t m_data_version = -1;
+  int64_t m_schema_version = -1;
+  int64_t m_total_changes = 0;
+  uint64_t m_hooked_changes = 0;
+  uint64_t m_seen_hooked_changes = 0;
+
+  stats_t m_stats;
+};
+
+/**
+ * cached_row impl
+ */
+namespace detail {
+
+template <typename T, typename Cell>
+void get_cached_val(Cell const &c, T &val, value_scratch &scratch) {
+  if constexpr (is_optional<T>::value) {
+    if (c.type == SQLITE_NULL) {
+      val.reset();
+    } else {
+      typename T::value_type v;
+      get_cached_val(c, v, scratch);
+      val = std::move(v);
+    }
+  } else if constexpr (std::is_same_v<T, std::string> ||
+                       std::is_same_v<T, std::string_view>) {
+    if (c.type == SQLITE_TEXT || c.type == SQLITE_BLOB)
+      val = T(c.s);
+    else
+      val = T();
+  } else if constexpr (std::is_floating_point_v<T>) {
+    val = c.type == SQLITE_INTEGER ? (T)c.i : (T)c.d;
+  } else if constexpr (std::is_integral_v<T>) {
+    val = c.type == SQLITE_FLOAT ? (T)c.d : (T)c.i;
+  } else {
+    // Others are read by |type_traits<T>| from a copy of the cell
+    scratch_row row(scratch);
+    row.bind(c.type, c.i, c.d, c.s);
+    row.step();
+    val = type_traits<T>::column(row.get(), 0);
+  }
+}
+
+}  // namespace detail
+
+template <typename... Cols>
+std::tuple<Cols...> cached_row::to() const {
+  std::tuple<Cols...> result;
+  detail::enumerate(
+      [this](int index, auto &&tuple_value) {
+        detail::get_cached_val(m_res->get(m_index, index), tuple_value,
+                               *m_res->m_scratch);
+      },
+      result);
+  return result;
+}
+
+/**
+ * query_cache impl
+ */
+template <typename T>
+void query_cache::encode_arg(std::string &key, T const &val) {
+  using U = std::decay_t<T>;
+  if constexpr (std::is_same_v<U, std::nullptr_t>) {
+    encode(key, nullptr);
+  } else if constexpr (detail::is_optional<U>::value) {
+    val ? encode_arg(key, *val) : encode(key, nullptr);
+  } else if constexpr (std::is_convertible_v<U, std::string_view>) {
+    encode(key, std::string_view(val));
+  } else if constexpr (std::is_floating_point_v<U>) {
+    encode(key, (double)val);
+  } else if constexpr (std::is_integral_v<U>) {
+    encode(key, (int64_t)val);
+  } else {
+    // Others are keyed by the value |type_traits<U>| binds
+    detail::scratch_row row(*m_scratch);
+    int ec = type_traits<U>::bind(row.get(), 1, val);
+    if (ec) throw error(ec);
+    row.step();
+    encode(key, sqlite3_column_value(row.get(), 0));
+  }
+}
+
+template <typename... Args>
+query_cache::result_ptr query_cache::query(std::string const &sql,
+                                           Args &&... args) {
+  validate();
+
+  std::string key = sql;
+  key.push_back('\0');
+  (encode_arg(key, args), ...);
+
+  if (auto res = lookup(key)) return res;
+
+  deps_t deps;
+  sqlite3_stmt *stmt = prepare(sql, deps);
+  std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> guard(stmt);
+  detail::bind_to_stmt(stmt, 1, std::forward<Args>(args)...);
+  return materialize(std::move(key), stmt, std::move(deps));
+}
+
+}  // namespace sqlite3cpp
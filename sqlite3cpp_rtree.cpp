@@ -0,0 +1,89 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_rtree.h"
+
+#ifdef SQLITE_ENABLE_RTREE
+
+namespace sqlite3cpp {
+
+void create_rtree(database &db, std::string const &name,
+                  std::vector<std::string> const &dims,
+                  std::vector<std::string> const &aux) {
+  if (dims.empty() || dims.size() > 5) throw error(SQLITE_RANGE);
+
+  using detail::quote_identifier;
+  std::string sql = "create virtual table if not exists " +
+                    quote_identifier(name) + " using rtree(id";
+  for (auto const &d : dims) {
+    sql += ", " + quote_identifier("min_" + d) + ", " +
+           quote_identifier("max_" + d);
+  }
+  for (auto const &a : aux) sql += ", +" + quote_identifier(a);
+  db.execute(sql + ")");
+}
+
+struct rtree_query_access {
+  static int invoke(sqlite3_rtree_query_info *info) {
+    auto *func = (detail::rtree_query_t *)info->pContext;
+    try {
+      rtree_query_info q(info);
+      info->eWithin = (int)(*func)(q);
+      return SQLITE_OK;
+    } catch (error const &e) {
+      return e.code;
+    } catch (std::bad_alloc const &) {
+      return SQLITE_NOMEM;
+    } catch (...) {
+      return SQLITE_ERROR;
+    }
+  }
+};
+
+namespace detail {
+
+void create_rtree_query(database &db, std::string const &name,
+                        rtree_query_t func) {
+  auto f = std::make_unique<rtree_query_t>(std::move(func));
+  int ec = sqlite3_rtree_query_callback(
+      db.get(), name.c_str(), &rtree_query_access::invoke, (void *)f.get(),
+      [](void *p) { delete (rtree_query_t *)p; });
+  // NOTE(acer): sqlite3 calls the destructor on failure
+  f.release();
+  if (ec) throw error(ec);
+}
+
+}  // namespace detail
+
+}  // namespace sqlite3cpp
+
+#endif
@@ -0,0 +1,170 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "sqlite3cpp.h"
+
+#ifdef SQLITE_ENABLE_RTREE
+
+namespace sqlite3cpp {
+
+// Create R*Tree table |name| if not exists, with an `id` column, a min and
+// max column per name of |dims| (1 to 5), and auxiliary columns |aux|.
+// e.g.
+//
+// create_rtree(db, "Place", {"x", "y"}, {"name"});
+//
+// creates `Place(id, min_x, max_x, min_y, max_y, +name)`. Names are quoted
+// as identifiers.
+SQLITE3CPP_EXPORT void create_rtree(database &db, std::string const &name,
+                                    std::vector<std::string> const &dims,
+                                    std::vector<std::string> const &aux = {});
+
+enum rtree_within {
+  rtree_not_within = NOT_WITHIN,
+  rtree_partly_within = PARTLY_WITHIN,
+  rtree_fully_within = FULLY_WITHIN,
+};
+
+struct SQLITE3CPP_EXPORT rtree_query_info {
+  // Node or entry of an R*Tree visited by a query function. Wraps
+  // `sqlite3_rtree_query_info`.
+
+  // Number of dimensions.
+  int dims() const noexcept { return m_info->nCoord / 2; }
+  // Bounds of the box in dimension |d|.
+  double min(int d) const noexcept { return m_info->aCoord[2 * d]; }
+  double max(int d) const noexcept { return m_info->aCoord[2 * d + 1]; }
+
+  // 0 for entries of the table, higher for inner nodes.
+  int level() const noexcept { return m_info->iLevel; }
+  bool is_entry() const noexcept { return m_info->iLevel == 0; }
+  // Rowid of an entry; undefined for nodes.
+  int64_t rowid() const noexcept { return m_info->iRowid; }
+  rtree_within parent_within() const noexcept {
+    return (rtree_within)m_info->eParentWithin;
+  }
+  double parent_score() const noexcept { return m_info->rParentScore; }
+
+  // Arguments of the function in SQL, e.g. `circle(0, 0, 5)` has three.
+  int param_count() const noexcept { return m_info->nParam; }
+  double param(int index) const noexcept { return m_info->aParam[index]; }
+  sqlite3_value *sql_param(int index) const noexcept {
+    return m_info->apSqlParam[index];
+  }
+
+  // Order of the box in the search; boxes are visited by ascending score
+  // among the boxes queued.
+  void set_score(double score) noexcept { m_info->rScore = score; }
+
+  // State of T kept across callbacks of one query, e.g. a polygon parsed
+  // from the arguments. T is default constructed on the first call and
+  // must be the same type for all calls of the function.
+  template <typename T>
+  T &state() const;
+
+  sqlite3_rtree_query_info *get() const noexcept { return m_info; }
+
+ private:
+  friend struct rtree_query_access;
+  explicit rtree_query_info(sqlite3_rtree_query_info *info) noexcept
+      : m_info(info) {}
+
+  sqlite3_rtree_query_info *m_info;
+};
+
+// Register query function |name| for R*Tree tables of |db|, used as
+// `where id match name(args...)`. |func| takes rtree_query_info & and
+// returns rtree_within of the box, letting the query prune nodes not
+// within. e.g.
+//
+// create_rtree_query(db, "circle", [](rtree_query_info &q) {
+//   double dx = std::max({q.min(0) - q.param(0), q.param(0) - q.max(0), 0.});
+//   double dy = std::max({q.min(1) - q.param(1), q.param(1) - q.max(1), 0.});
+//   double r = q.param(2);
+//   return dx * dx + dy * dy <= r * r ? rtree_partly_within
+//                                     : rtree_not_within;
+// });
+// db.execute("select id from Place where id match circle(?, ?, ?)", x, y, r);
+//
+// Exceptions thrown by |func| fail the statement.
+template <typename FUNC>
+void create_rtree_query(database &db, std::string const &name, FUNC func);
+
+// Register geometry function |name|: shorthand of create_rtree_query()
+// where |func| takes rtree_query_info const & and returns whether the box
+// may hold matches; entries are tested exactly as nodes are.
+template <typename FUNC>
+void create_rtree_geometry(database &db, std::string const &name, FUNC func);
+
+/**
+ * Implementations
+ */
+namespace detail {
+
+using rtree_query_t = std::function<rtree_within(rtree_query_info &)>;
+
+SQLITE3CPP_EXPORT void create_rtree_query(database &db,
+                                          std::string const &name,
+                                          rtree_query_t func);
+
+}  // namespace detail
+
+template <typename T>
+T &rtree_query_info::state() const {
+  if (!m_info->pUser) {
+    m_info->pUser = new T();
+    m_info->xDelUser = [](void *p) { delete (T *)p; };
+  }
+  return *(T *)m_info->pUser;
+}
+
+template <typename FUNC>
+void create_rtree_query(database &db, std::string const &name, FUNC func) {
+  detail::create_rtree_query(db, name, std::move(func));
+}
+
+template <typename FUNC>
+void create_rtree_geometry(database &db, std::string const &name, FUNC func) {
+  detail::create_rtree_query(
+      db, name, [func = std::move(func)](rtree_query_info &q) {
+        return func((rtree_query_info const &)q) ? rtree_partly_within
+                                                 : rtree_not_within;
+      });
+}
+
+}  // namespace sqlite3cpp
+
+#endif
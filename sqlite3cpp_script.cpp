@@ -0,0 +1,126 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_script.h"
+#include <cctype>
+
+namespace sqlite3cpp {
+
+/**
+ * script impl
+ */
+script::script(database &db, std::string sql)
+    : m_db(db), m_sql(std::move(sql)) {
+  char const *head = m_sql.c_str();
+  char const *const end = head + m_sql.size();
+
+  while (head < end) {
+    sqlite3_stmt *stmt = nullptr;
+    char const *tail = nullptr;
+    int ec = sqlite3_prepare_v2(m_db.get(), head, (int)(end - head), &stmt,
+                                &tail);
+    std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> guard(stmt);
+    // Can not tell where the statement ends
+    if (ec && (!tail || tail <= head)) throw error(ec);
+
+    // NOTE(acer): Statements failed to prepare are kept and prepared again
+    // by |run()|; a null statement without error is whitespace or comment.
+    if (ec || stmt) {
+      while (head < tail && std::isspace((unsigned char)*head)) ++head;
+      entry e{(size_t)(head - m_sql.c_str()), (size_t)(tail - m_sql.c_str()),
+              std::move(guard), {}, {}};
+      m_entries.push_back(std::move(e));
+    }
+    head = tail;
+  }
+}
+
+void script::set_binder(size_t index, binder_t binder) {
+  if (index >= m_entries.size()) throw error(SQLITE_RANGE);
+
+  auto &e = m_entries[index];
+  if (e.stmt) {
+    sqlite3_clear_bindings(e.stmt.get());
+    binder(e.stmt.get());
+  }
+  e.binder = std::move(binder);
+}
+
+void script::prepare(entry &e) {
+  sqlite3_stmt *stmt = nullptr;
+  int ec = sqlite3_prepare_v2(m_db.get(), m_sql.c_str() + e.begin,
+                              (int)(e.end - e.begin), &stmt, nullptr);
+  if (ec) throw error(ec);
+  e.stmt.reset(stmt);
+  if (stmt && e.binder) e.binder(stmt);
+}
+
+void script::run() {
+  using namespace std::chrono;
+
+  for (auto &e : m_entries) {
+    if (!e.stmt) prepare(e);
+    sqlite3_stmt *stmt = e.stmt.get();
+    if (!stmt) continue;
+
+    auto start = steady_clock::now();
+    int ec = 0;
+    while (SQLITE_ROW == (ec = sqlite3_step(stmt)))
+      ;
+    sqlite3_reset(stmt);
+    m_db.flush_changes();
+    if (ec != SQLITE_DONE) throw error(ec);
+
+    auto elapsed = duration_cast<nanoseconds>(steady_clock::now() - start);
+    e.stats.runs += 1;
+    e.stats.last = elapsed;
+    e.stats.total += elapsed;
+    e.stats.max = std::max(e.stats.max, elapsed);
+  }
+}
+
+std::vector<script::statement_stats> script::stats() const {
+  std::vector<statement_stats> result;
+  result.reserve(m_entries.size());
+  for (auto const &e : m_entries) {
+    result.push_back(e.stats);
+    result.back().sql =
+        std::string_view(m_sql).substr(e.begin, e.end - e.begin);
+  }
+  return result;
+}
+
+sqlite3_stmt *script::get(size_t index) const noexcept {
+  return index < m_entries.size() ? m_entries[index].stmt.get() : nullptr;
+}
+
+}  // namespace sqlite3cpp
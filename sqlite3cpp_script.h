@@ -0,0 +1,123 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <chrono>
+#include <tuple>
+#include <vector>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT script {
+  // Multiple SQL statements prepared once and run many times, unlike
+  // |cursor::executescript()| which parses the SQL on every call. e.g.
+  //
+  // script job(db,
+  //            "insert into Log values(?, ?);"
+  //            "delete from Log where ts < ?;");
+  // job.bind(0, now, msg).bind(1, now - 3600);
+  // job.run();
+  //
+  // Statements are split by the tail of `sqlite3_prepare_v2`. One that can
+  // not be prepared yet, e.g. it refers to a table created by an earlier
+  // statement of the script, is prepared when |run()| reaches it.
+  //
+  // |run()| executes statements in order and discards rows of queries. It
+  // stops at the first failing statement and raises sqlite3cpp::error;
+  // statements executed before are not rolled back.
+
+  struct statement_stats {
+    // SQL text of the statement; valid as long as the script is.
+    std::string_view sql;
+    uint64_t runs = 0;
+    std::chrono::nanoseconds last{0};
+    std::chrono::nanoseconds total{0};
+    std::chrono::nanoseconds max{0};
+  };
+
+  script(database &db, std::string sql);
+  script(script &&) = default;
+
+  // Number of statements.
+  size_t size() const noexcept { return m_entries.size(); }
+
+  // Bind |args| to parameters of statement |index| in order. Values are
+  // copied and stay bound for later runs until bound again.
+  template <typename... Args>
+  script &bind(size_t index, Args &&... args);
+
+  // Execute all statements.
+  void run();
+
+  // Get timing of statements, one per statement.
+  std::vector<statement_stats> stats() const;
+
+  // Get underlying sqlite3_stmt pointer of statement |index|, or nullptr if
+  // it is not prepared yet.
+  sqlite3_stmt *get(size_t index) const noexcept;
+
+ private:
+  using binder_t = std::function<void(sqlite3_stmt *)>;
+
+  struct entry {
+    size_t begin;
+    size_t end;
+    std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> stmt;
+    binder_t binder;
+    statement_stats stats;
+  };
+
+  void set_binder(size_t index, binder_t binder);
+  void prepare(entry &e);
+
+  database &m_db;
+  std::string m_sql;
+  std::vector<entry> m_entries;
+};
+
+template <typename... Args>
+script &script::bind(size_t index, Args &&... args) {
+  set_binder(index,
+             [values = std::tuple<detail::stored_t<Args>...>(
+                  std::forward<Args>(args)...)](sqlite3_stmt *stmt) {
+               std::apply(
+                   [stmt](auto const &... v) {
+                     detail::bind_to_stmt(stmt, 1, v...);
+                   },
+                   values);
+             });
+  return *this;
+}
+
+}  // namespace sqlite3cpp
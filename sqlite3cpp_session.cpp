@@ -0,0 +1,159 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_session.h"
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+
+namespace sqlite3cpp {
+
+/**
+ * session impl
+ */
+session::session(database &db, std::string const &schema)
+    : m_db(db), m_schema(schema) {
+  start();
+}
+
+session::session(database &db, std::vector<std::string> const &tables,
+                 std::string const &schema)
+    : m_db(db), m_schema(schema), m_tables(tables) {
+  start();
+}
+
+session::~session() { stop(); }
+
+void session::start() {
+  sqlite3_session *s = nullptr;
+  int ec = 0;
+
+  m_db.acquire_session_hook();
+  try {
+    if (0 != (ec = sqlite3session_create(m_db.get(), m_schema.c_str(), &s)))
+      throw error(ec);
+    std::unique_ptr<sqlite3_session, sqlite3_session_deleter> guard(s);
+
+    if (m_tables.empty()) {
+      if (0 != (ec = sqlite3session_attach(s, nullptr))) throw error(ec);
+    }
+    for (auto const &t : m_tables) {
+      if (0 != (ec = sqlite3session_attach(s, t.c_str()))) throw error(ec);
+    }
+    m_session = std::move(guard);
+  } catch (...) {
+    m_db.release_session_hook();
+    throw;
+  }
+}
+
+void session::stop() noexcept {
+  if (!m_session) return;
+  m_session.reset();
+  m_db.release_session_hook();
+}
+
+changeset session::take_changeset() {
+  int n = 0;
+  void *p = nullptr;
+  int ec = 0;
+
+  if (0 != (ec = sqlite3session_changeset(m_session.get(), &n, &p)))
+    throw error(ec);
+
+  std::unique_ptr<void, void (*)(void *)> guard(p, sqlite3_free);
+  changeset cs((unsigned char *)p, (unsigned char *)p + n);
+
+  // NOTE(acer): There is no way to reset a sqlite3_session; recreate it
+  // before the next change is made.
+  stop();
+  start();
+  return cs;
+}
+
+bool session::empty() const noexcept {
+  return sqlite3session_isempty(m_session.get()) != 0;
+}
+
+/**
+ * apply_changesets impl
+ */
+namespace {
+struct apply_context {
+  conflict_handler *handler;
+  std::exception_ptr exception;
+};
+
+int on_conflict(void *ctx, int type, sqlite3_changeset_iter *iter) {
+  auto *ac = (apply_context *)ctx;
+  if (!*ac->handler) return SQLITE_CHANGESET_OMIT;
+
+  changeset_conflict c{type, 0, nullptr, iter};
+  int cols = 0, indirect = 0;
+  sqlite3changeset_op(iter, &c.table, &cols, &c.op, &indirect);
+
+  try {
+    return (int)(*ac->handler)(c);
+  } catch (...) {
+    ac->exception = std::current_exception();
+    return SQLITE_CHANGESET_ABORT;
+  }
+}
+}  // namespace
+
+void apply_changesets(database &db, std::vector<changeset> const &changesets,
+                      conflict_handler handler) {
+  apply_context ctx{&handler, nullptr};
+
+  // NOTE(acer): Commit is issued explicitly instead of via transaction so
+  // that commit errors are raised.
+  db.executescript("begin");
+  try {
+    for (auto const &cs : changesets) {
+      int ec = sqlite3changeset_apply(db.get(), (int)cs.size(),
+                                      (void *)cs.data(), nullptr, &on_conflict,
+                                      &ctx);
+      if (ctx.exception) std::rethrow_exception(ctx.exception);
+      if (ec) throw error(ec);
+    }
+    db.executescript("commit");
+  } catch (...) {
+    try {
+      db.executescript("rollback");
+    } catch (...) {
+    }
+    throw;
+  }
+}
+
+}  // namespace sqlite3cpp
+
+#endif
@@ -0,0 +1,124 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <vector>
+#include "sqlite3cpp.h"
+
+#if defined(SQLITE_ENABLE_SESSION) && defined(SQLITE_ENABLE_PREUPDATE_HOOK)
+
+namespace sqlite3cpp {
+
+C_STYLE_DELETER(sqlite3_session, sqlite3session_delete);
+
+// Binary changeset produced by the sqlite3 session extension.
+using changeset = std::vector<unsigned char>;
+
+struct SQLITE3CPP_EXPORT session {
+  // Record changes of a database as changesets. e.g.
+  //
+  // session s(edge);
+  // {
+  //   transaction trns(edge);
+  //   edge.execute("insert into T values(?)", 1);
+  //   trns.commit();
+  // }
+  // changeset cs = s.take_changeset();
+  // apply_changesets(central, {cs});
+  //
+  // Only tables with a PRIMARY KEY are recorded (a sqlite3 session
+  // limitation). Requires sqlite3 built with SQLITE_ENABLE_SESSION and
+  // SQLITE_ENABLE_PREUPDATE_HOOK. Sessions take the pre-update hook of the
+  // connection, so they can not be created while a |change_stream| of the
+  // same database captures values; see |database::acquire_session_hook()|.
+
+  // Record changes of all tables of |schema| in |db|.
+  session(database &db, std::string const &schema = "main");
+
+  // Record changes of |tables| of |schema| in |db| only.
+  session(database &db, std::vector<std::string> const &tables,
+          std::string const &schema = "main");
+
+  ~session();
+
+  // Return changes recorded so far and restart recording. Call it after each
+  // commit to get one changeset per transaction.
+  changeset take_changeset();
+
+  // True if no change has been recorded since last |take_changeset()|.
+  bool empty() const noexcept;
+
+ private:
+  void start();
+  void stop() noexcept;
+
+  database &m_db;
+  std::string m_schema;
+  std::vector<std::string> m_tables;
+  std::unique_ptr<sqlite3_session, sqlite3_session_deleter> m_session;
+};
+
+struct changeset_conflict {
+  // One of SQLITE_CHANGESET_DATA, SQLITE_CHANGESET_NOTFOUND,
+  // SQLITE_CHANGESET_CONFLICT, SQLITE_CHANGESET_CONSTRAINT, or
+  // SQLITE_CHANGESET_FOREIGN_KEY.
+  int type;
+  // One of SQLITE_INSERT, SQLITE_UPDATE, or SQLITE_DELETE.
+  int op;
+  char const *table;
+  // Iterator at the conflicting change for use with
+  // `sqlite3changeset_old/new/conflict`.
+  sqlite3_changeset_iter *iter;
+};
+
+enum class conflict_action {
+  omit = SQLITE_CHANGESET_OMIT,
+  replace = SQLITE_CHANGESET_REPLACE,
+  abort = SQLITE_CHANGESET_ABORT,
+};
+
+using conflict_handler =
+    std::function<conflict_action(changeset_conflict const &)>;
+
+// Apply |changesets| in order to |db| within one transaction. Conflicts are
+// resolved by |handler|; without a handler, conflicting changes are omitted.
+// If any changeset fails to apply or |handler| returns
+// conflict_action::abort, the transaction is rolled back and
+// sqlite3cpp::error is raised.
+SQLITE3CPP_EXPORT void apply_changesets(
+    database &db, std::vector<changeset> const &changesets,
+    conflict_handler handler = {});
+
+}  // namespace sqlite3cpp
+
+#endif
@@ -0,0 +1,316 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_slow_query.h"
+#include <cstdio>
+#include <fstream>
+#include <map>
+
+namespace sqlite3cpp {
+
+namespace {
+
+void append_json_string(std::string &out, std::string_view s) {
+  out += '"';
+  for (char c : s) {
+    switch (c) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+          out += buf;
+        } else {
+          out += c;
+        }
+    }
+  }
+  out += '"';
+}
+
+void append_json_strings(std::string &out, std::vector<std::string> const &v) {
+  out += '[';
+  for (size_t i = 0; i < v.size(); ++i) {
+    if (i) out += ',';
+    append_json_string(out, v[i]);
+  }
+  out += ']';
+}
+
+// Table name following SCAN or SEARCH of a plan detail, e.g. "SCAN T" and
+// "SEARCH TABLE T USING ..." of older sqlite3 give T.
+std::string_view plan_table(std::string_view detail, std::string_view verb) {
+  auto pos = detail.find(verb);
+  if (pos == std::string_view::npos) return {};
+  detail.remove_prefix(pos + verb.size());
+  if (detail.substr(0, 6) == "TABLE ") detail.remove_prefix(6);
+  return detail.substr(0, detail.find(' '));
+}
+
+// Columns of an automatic index, e.g. "(a=? AND b>?)" gives "a, b".
+std::string index_columns(std::string_view detail) {
+  auto open = detail.find('(');
+  auto close = detail.find(')', open);
+  if (open == std::string_view::npos || close == std::string_view::npos)
+    return {};
+
+  std::string cols;
+  auto terms = detail.substr(open + 1, close - open - 1);
+  while (!terms.empty()) {
+    auto end = terms.find(" AND ");
+    auto term = terms.substr(0, end);
+    auto name_end = term.find_first_of("=<>");
+    if (!cols.empty()) cols += ", ";
+    cols += term.substr(0, name_end);
+    if (end == std::string_view::npos) break;
+    terms.remove_prefix(end + 5);
+  }
+  return cols;
+}
+
+std::vector<std::string> make_hints(slow_query const &q) {
+  std::vector<std::string> hints;
+  for (auto const &line : q.plan) {
+    std::string_view detail(line);
+    detail.remove_prefix(detail.find_first_not_of(' '));
+
+    if (detail.find("AUTOMATIC") != std::string_view::npos) {
+      auto table = plan_table(detail, "SEARCH ");
+      hints.push_back("create index on " + std::string(table) + "(" +
+                      index_columns(detail) + ")");
+    } else if (detail.substr(0, 5) == "SCAN " &&
+               detail.find(" USING ") == std::string_view::npos &&
+               q.fullscan_steps > 0) {
+      hints.push_back("full scan of " +
+                      std::string(plan_table(detail, "SCAN ")) +
+                      "; index columns it is filtered or joined by");
+    } else if (detail.substr(0, 19) == "USE TEMP B-TREE FOR") {
+      hints.push_back("sort by temp b-tree for" +
+                      std::string(detail.substr(19)) +
+                      "; an index in that order avoids it");
+    }
+  }
+  return hints;
+}
+
+}  // namespace
+
+/**
+ * slow_query impl
+ */
+std::string slow_query::to_json() const {
+  using namespace std::chrono;
+
+  std::string out = "{\"ts_ms\":";
+  out += std::to_string(
+      duration_cast<milliseconds>(when.time_since_epoch()).count());
+  out += ",\"sql\":";
+  append_json_string(out, sql);
+  out += ",\"elapsed_us\":" +
+         std::to_string(duration_cast<microseconds>(elapsed).count());
+  out += ",\"fullscan_steps\":" + std::to_string(fullscan_steps);
+  out += ",\"autoindex_rows\":" + std::to_string(autoindex_rows);
+  out += ",\"sorts\":" + std::to_string(sorts);
+  out += ",\"vm_steps\":" + std::to_string(vm_steps);
+  out += ",\"plan\":";
+  append_json_strings(out, plan);
+  out += ",\"loops\":[";
+  for (size_t i = 0; i < loops.size(); ++i) {
+    auto const &l = loops[i];
+    if (i) out += ',';
+    out += "{\"name\":";
+    append_json_string(out, l.name);
+    out += ",\"explain\":";
+    append_json_string(out, l.explain);
+    out += ",\"loops\":" + std::to_string(l.loops);
+    out += ",\"rows_visited\":" + std::to_string(l.rows_visited);
+    out += ",\"rows_estimated\":" + std::to_string(l.rows_estimated) + "}";
+  }
+  out += "],\"hints\":";
+  append_json_strings(out, hints);
+  return out + "}";
+}
+
+/**
+ * slow_query_log impl
+ */
+slow_query_log::slow_query_log(database &db, params_t params)
+    : m_db(db), m_params(std::move(params)) {
+  if (!m_params.path.empty()) {
+    std::ifstream in(m_params.path, std::ios::binary | std::ios::ate);
+    if (in) m_file_size = (size_t)in.tellg();
+  }
+
+  int ec = 0;
+  if (0 != (ec = sqlite3_trace_v2(m_db.get(), SQLITE_TRACE_PROFILE,
+                                  &slow_query_log::on_trace, this)))
+    throw error(ec);
+}
+
+slow_query_log::~slow_query_log() {
+  sqlite3_trace_v2(m_db.get(), 0, nullptr, nullptr);
+}
+
+int slow_query_log::on_trace(unsigned, void *self, void *stmt, void *elapsed) {
+  auto *log = (slow_query_log *)self;
+  auto *s = (sqlite3_stmt *)stmt;
+  std::chrono::nanoseconds ns(*(sqlite3_int64 *)elapsed);
+
+  log->m_statements += 1;
+  // NOTE(acer): Statements run by |analyze()| are traced as well
+  if (!log->m_analyzing && ns >= log->m_params.threshold) {
+    log->m_analyzing = true;
+    try {
+      log->analyze(s, ns);
+    } catch (...) {
+    }
+    log->m_analyzing = false;
+  }
+
+  // Counters accumulate over runs; start over for the next run
+  sqlite3_stmt_status(s, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+  sqlite3_stmt_status(s, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+  sqlite3_stmt_status(s, SQLITE_STMTSTATUS_SORT, 1);
+  sqlite3_stmt_status(s, SQLITE_STMTSTATUS_VM_STEP, 1);
+#ifdef SQLITE_ENABLE_STMT_SCANSTATUS
+  sqlite3_stmt_scanstatus_reset(s);
+#endif
+  return 0;
+}
+
+void slow_query_log::analyze(sqlite3_stmt *stmt,
+                             std::chrono::nanoseconds elapsed) {
+  slow_query q;
+  char const *sql = sqlite3_sql(stmt);
+  q.sql = sql ? sql : "";
+  q.elapsed = elapsed;
+  q.when = std::chrono::system_clock::now();
+  q.fullscan_steps =
+      sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+  q.autoindex_rows = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_AUTOINDEX, 0);
+  q.sorts = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 0);
+  q.vm_steps = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 0);
+
+#ifdef SQLITE_ENABLE_STMT_SCANSTATUS
+  for (int i = 0;; ++i) {
+    sqlite3_int64 loops = 0, visited = 0;
+    double est = 0;
+    char const *name = nullptr, *explain = nullptr;
+    if (sqlite3_stmt_scanstatus(stmt, i, SQLITE_SCANSTAT_NLOOP, &loops))
+      break;
+    sqlite3_stmt_scanstatus(stmt, i, SQLITE_SCANSTAT_NVISIT, &visited);
+    sqlite3_stmt_scanstatus(stmt, i, SQLITE_SCANSTAT_EST, &est);
+    sqlite3_stmt_scanstatus(stmt, i, SQLITE_SCANSTAT_NAME, &name);
+    sqlite3_stmt_scanstatus(stmt, i, SQLITE_SCANSTAT_EXPLAIN, &explain);
+    q.loops.push_back({name ? name : "", explain ? explain : "", loops,
+                       visited, est});
+  }
+#endif
+
+  if (!sqlite3_stmt_isexplain(stmt)) q.plan = explain(q.sql);
+  q.hints = make_hints(q);
+  m_offenders += 1;
+
+  if (!m_params.path.empty()) write(q.to_json());
+  if (m_params.on_slow) m_params.on_slow(q);
+}
+
+std::vector<std::string> slow_query_log::explain(std::string const &sql) {
+  auto it = m_plans.find(sql);
+  if (it != m_plans.end()) {
+    m_plan_lru.splice(m_plan_lru.begin(), m_plan_lru, it->second.lru);
+    return it->second.plan;
+  }
+
+  std::vector<std::string> plan;
+  sqlite3_stmt *stmt = nullptr;
+  std::string eqp = "explain query plan " + sql;
+  // NOTE(acer): Parameters are left unbound; the plan does not depend on
+  // them unless sqlite3 is built with SQLITE_ENABLE_STAT4.
+  if (SQLITE_OK ==
+      sqlite3_prepare_v2(m_db.get(), eqp.c_str(), -1, &stmt, nullptr)) {
+    std::unique_ptr<sqlite3_stmt, sqlite3_stmt_deleter> guard(stmt);
+    std::map<int, int> depth;
+    while (SQLITE_ROW == sqlite3_step(stmt)) {
+      int id = sqlite3_column_int(stmt, 0);
+      int parent = sqlite3_column_int(stmt, 1);
+      auto *detail = (char const *)sqlite3_column_text(stmt, 3);
+      int d = depth[id] = parent ? depth[parent] + 1 : 0;
+      plan.push_back(std::string(2 * d, ' ') + (detail ? detail : ""));
+    }
+  }
+
+  // NOTE(acer): SQL with inlined literals makes a plan per statement; keep
+  // recently used ones only.
+  while (!m_plan_lru.empty() && m_plans.size() >= m_params.max_plans) {
+    m_plans.erase(m_plan_lru.back());
+    m_plan_lru.pop_back();
+  }
+  if (m_params.max_plans) {
+    m_plan_lru.push_front(sql);
+    m_plans[sql] = {plan, m_plan_lru.begin()};
+  }
+  return plan;
+}
+
+void slow_query_log::write(std::string const &line) {
+  if (m_file_size > 0 && m_file_size + line.size() + 1 > m_params.max_bytes) {
+    // path.N-1 -> path.N, ..., path -> path.1
+    auto name = [this](int i) {
+      return i ? m_params.path + "." + std::to_string(i) : m_params.path;
+    };
+    std::remove(name(m_params.max_files).c_str());
+    for (int i = m_params.max_files; i > 0; --i)
+      std::rename(name(i - 1).c_str(), name(i).c_str());
+    m_file_size = 0;
+  }
+
+  std::ofstream out(m_params.path, std::ios::binary | std::ios::app);
+  out << line << '\n';
+  if (out) m_file_size += line.size() + 1;
+}
+
+}  // namespace sqlite3cpp
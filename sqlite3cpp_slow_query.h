@@ -0,0 +1,151 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT slow_query {
+  // A statement which ran longer than the threshold of slow_query_log.
+
+  struct loop_t {
+    // Per-loop counters of `sqlite3_stmt_scanstatus`; only available if
+    // sqlite3 is built with SQLITE_ENABLE_STMT_SCANSTATUS.
+    std::string name;
+    std::string explain;
+    int64_t loops = 0;
+    int64_t rows_visited = 0;
+    double rows_estimated = 0;
+  };
+
+  // SQL text with parameters unexpanded.
+  std::string sql;
+  std::chrono::nanoseconds elapsed{0};
+  std::chrono::system_clock::time_point when;
+
+  // `sqlite3_stmt_status` counters of this run.
+  int fullscan_steps = 0;
+  int autoindex_rows = 0;
+  int sorts = 0;
+  int vm_steps = 0;
+
+  // `EXPLAIN QUERY PLAN` details, indented two spaces per level.
+  std::vector<std::string> plan;
+  std::vector<loop_t> loops;
+  // Suggestions derived from the plan, e.g. indexes to create.
+  std::vector<std::string> hints;
+
+  // Format as a single line JSON object.
+  std::string to_json() const;
+};
+
+struct SQLITE3CPP_EXPORT slow_query_log {
+  // Catch statements of a connection running longer than a threshold and
+  // record why. e.g.
+  //
+  // slow_query_log::params_t params;
+  // params.threshold = std::chrono::milliseconds(50);
+  // params.path = "slow.jsonl";
+  // slow_query_log log(db, params);
+  //
+  // Each offender is appended to |path| as a line of JSON with its query
+  // plan, loop counters, full scan and automatic index counters, and hints
+  // such as `create index on T(a)` for automatic indexes. The file is rotated
+  // to `path.1`, `path.2`, ... once it exceeds |max_bytes|.
+  //
+  // Statements are timed by `sqlite3_trace_v2` with SQLITE_TRACE_PROFILE,
+  // which is a per connection slot; do not install another trace callback on
+  // |db| while the log is alive. Counters of `sqlite3_stmt_status` are reset
+  // as each statement finishes. Plans are cached per SQL text, up to
+  // |max_plans| recently used ones. Callbacks of a connection are serialized
+  // by sqlite3, so is the log.
+
+  struct params_t {
+    // NOTE: sqlite3 times statements by the clock of the VFS, which ticks in
+    // milliseconds on unix.
+    std::chrono::nanoseconds threshold = std::chrono::milliseconds(100);
+    // Log file; nothing is written if empty.
+    std::string path;
+    size_t max_bytes = 16 << 20;
+    // Number of rotated files kept besides |path|.
+    int max_files = 4;
+    // Number of cached plans; least recently used ones are evicted.
+    size_t max_plans = 256;
+    // Called for each offender on the thread running the statement. It must
+    // not use the connection. Exceptions are ignored.
+    std::function<void(slow_query const &)> on_slow;
+  };
+
+  slow_query_log(database &db, params_t params);
+  ~slow_query_log();
+
+  slow_query_log(slow_query_log const &) = delete;
+  slow_query_log &operator=(slow_query_log const &) = delete;
+
+  // Number of statements finished and of offenders so far.
+  uint64_t statements() const noexcept { return m_statements; }
+  uint64_t offenders() const noexcept { return m_offenders; }
+
+  // Number of cached plans.
+  size_t plans() const noexcept { return m_plans.size(); }
+
+ private:
+  static int on_trace(unsigned type, void *self, void *stmt, void *elapsed);
+  void analyze(sqlite3_stmt *stmt, std::chrono::nanoseconds elapsed);
+  std::vector<std::string> explain(std::string const &sql);
+  void write(std::string const &line);
+
+  database &m_db;
+  params_t m_params;
+  bool m_analyzing = false;
+  std::atomic<uint64_t> m_statements{0};
+  std::atomic<uint64_t> m_offenders{0};
+  struct plan_entry {
+    std::vector<std::string> plan;
+    std::list<std::string>::iterator lru;
+  };
+  std::unordered_map<std::string, plan_entry> m_plans;
+  std::list<std::string> m_plan_lru;
+  size_t m_file_size = 0;
+};
+
+}  // namespace sqlite3cpp
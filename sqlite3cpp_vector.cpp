@@ -0,0 +1,645 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_vector.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SQLITE3CPP_VECTOR_X86 1
+#include <immintrin.h>
+#endif
+
+namespace sqlite3cpp {
+
+namespace {
+
+/**
+ * Scalar kernels
+ */
+float dot_f32_scalar(float const *a, float const *b, size_t n) {
+  float s = 0;
+  for (size_t i = 0; i < n; ++i) s += a[i] * b[i];
+  return s;
+}
+
+float l2sq_f32_scalar(float const *a, float const *b, size_t n) {
+  float s = 0;
+  for (size_t i = 0; i < n; ++i) {
+    float d = a[i] - b[i];
+    s += d * d;
+  }
+  return s;
+}
+
+void cosine_f32_scalar(float const *a, float const *b, size_t n, float *dot,
+                       float *norm_a, float *norm_b) {
+  float d = 0, na = 0, nb = 0;
+  for (size_t i = 0; i < n; ++i) {
+    d += a[i] * b[i];
+    na += a[i] * a[i];
+    nb += b[i] * b[i];
+  }
+  *dot = d;
+  *norm_a = na;
+  *norm_b = nb;
+}
+
+int64_t dot_i8_scalar(int8_t const *a, int8_t const *b, size_t n) {
+  int64_t s = 0;
+  for (size_t i = 0; i < n; ++i) s += (int32_t)a[i] * b[i];
+  return s;
+}
+
+int64_t l2sq_i8_scalar(int8_t const *a, int8_t const *b, size_t n) {
+  int64_t s = 0;
+  for (size_t i = 0; i < n; ++i) {
+    int32_t d = (int32_t)a[i] - b[i];
+    s += d * d;
+  }
+  return s;
+}
+
+void cosine_i8_scalar(int8_t const *a, int8_t const *b, size_t n,
+                      int64_t *dot, int64_t *norm_a, int64_t *norm_b) {
+  *dot = dot_i8_scalar(a, b, n);
+  *norm_a = dot_i8_scalar(a, a, n);
+  *norm_b = dot_i8_scalar(b, b, n);
+}
+
+vector_kernels const scalar_kernels = {
+    simd_level::scalar, dot_f32_scalar, l2sq_f32_scalar, cosine_f32_scalar,
+    dot_i8_scalar,      l2sq_i8_scalar, cosine_i8_scalar};
+
+#ifdef SQLITE3CPP_VECTOR_X86
+
+// NOTE(acer): int8 kernels accumulate in int32 lanes; sum per chunk of
+// |i8_chunk| elements into int64 so that lanes never overflow. A lane of a
+// chunk holds at most 2 * 65025 * |i8_chunk| / 16, but the sum of lanes
+// does not fit int32; horizontal sums widen to int64.
+constexpr size_t i8_chunk = 1 << 16;
+
+/**
+ * AVX2 kernels
+ */
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 float hsum256(__m256 v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_hadd_ps(s, s);
+  s = _mm_hadd_ps(s, s);
+  return _mm_cvtss_f32(s);
+}
+
+// Sum of int32 lanes; widened to int64 first as the sum of lanes of a full
+// chunk exceeds int32.
+AVX2 int64_t hsum256i(__m256i v) {
+  __m256i w = _mm256_add_epi64(
+      _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)),
+      _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+  __m128i s = _mm_add_epi64(_mm256_castsi256_si128(w),
+                            _mm256_extracti128_si256(w, 1));
+  s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+  return _mm_cvtsi128_si64(s);
+}
+
+AVX2 float dot_f32_avx2(float const *a, float const *b, size_t n) {
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+    s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),
+                         _mm256_loadu_ps(b + i + 8), s1);
+  }
+  for (; i + 8 <= n; i += 8)
+    s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+  return hsum256(_mm256_add_ps(s0, s1)) + dot_f32_scalar(a + i, b + i, n - i);
+}
+
+AVX2 float l2sq_f32_avx2(float const *a, float const *b, size_t n) {
+  __m256 s = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    s = _mm256_fmadd_ps(d, d, s);
+  }
+  return hsum256(s) + l2sq_f32_scalar(a + i, b + i, n - i);
+}
+
+AVX2 void cosine_f32_avx2(float const *a, float const *b, size_t n,
+                          float *dot, float *norm_a, float *norm_b) {
+  __m256 d = _mm256_setzero_ps(), na = d, nb = d;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 va = _mm256_loadu_ps(a + i), vb = _mm256_loadu_ps(b + i);
+    d = _mm256_fmadd_ps(va, vb, d);
+    na = _mm256_fmadd_ps(va, va, na);
+    nb = _mm256_fmadd_ps(vb, vb, nb);
+  }
+  cosine_f32_scalar(a + i, b + i, n - i, dot, norm_a, norm_b);
+  *dot += hsum256(d);
+  *norm_a += hsum256(na);
+  *norm_b += hsum256(nb);
+}
+
+AVX2 __m256i load_i8x16(int8_t const *p) {
+  return _mm256_cvtepi8_epi16(_mm_loadu_si128((__m128i const *)p));
+}
+
+AVX2 int64_t dot_i8_avx2(int8_t const *a, int8_t const *b, size_t n) {
+  int64_t total = 0;
+  size_t i = 0;
+  while (n - i >= 16) {
+    size_t end = i + std::min(n - i, i8_chunk);
+    __m256i s = _mm256_setzero_si256();
+    for (; i + 16 <= end; i += 16)
+      s = _mm256_add_epi32(
+          s, _mm256_madd_epi16(load_i8x16(a + i), load_i8x16(b + i)));
+    total += hsum256i(s);
+  }
+  return total + dot_i8_scalar(a + i, b + i, n - i);
+}
+
+AVX2 int64_t l2sq_i8_avx2(int8_t const *a, int8_t const *b, size_t n) {
+  int64_t total = 0;
+  size_t i = 0;
+  while (n - i >= 16) {
+    size_t end = i + std::min(n - i, i8_chunk);
+    __m256i s = _mm256_setzero_si256();
+    for (; i + 16 <= end; i += 16) {
+      __m256i d = _mm256_sub_epi16(load_i8x16(a + i), load_i8x16(b + i));
+      s = _mm256_add_epi32(s, _mm256_madd_epi16(d, d));
+    }
+    total += hsum256i(s);
+  }
+  return total + l2sq_i8_scalar(a + i, b + i, n - i);
+}
+
+AVX2 void cosine_i8_avx2(int8_t const *a, int8_t const *b, size_t n,
+                         int64_t *dot, int64_t *norm_a, int64_t *norm_b) {
+  int64_t td = 0, ta = 0, tb = 0;
+  size_t i = 0;
+  while (n - i >= 16) {
+    size_t end = i + std::min(n - i, i8_chunk);
+    __m256i d = _mm256_setzero_si256(), na = d, nb = d;
+    for (; i + 16 <= end; i += 16) {
+      __m256i va = load_i8x16(a + i), vb = load_i8x16(b + i);
+      d = _mm256_add_epi32(d, _mm256_madd_epi16(va, vb));
+      na = _mm256_add_epi32(na, _mm256_madd_epi16(va, va));
+      nb = _mm256_add_epi32(nb, _mm256_madd_epi16(vb, vb));
+    }
+    td += hsum256i(d);
+    ta += hsum256i(na);
+    tb += hsum256i(nb);
+  }
+  cosine_i8_scalar(a + i, b + i, n - i, dot, norm_a, norm_b);
+  *dot += td;
+  *norm_a += ta;
+  *norm_b += tb;
+}
+
+#undef AVX2
+
+vector_kernels const avx2_kernels = {
+    simd_level::avx2, dot_f32_avx2, l2sq_f32_avx2, cosine_f32_avx2,
+    dot_i8_avx2,      l2sq_i8_avx2, cosine_i8_avx2};
+
+/**
+ * AVX-512 kernels; tails are handled by masked loads.
+ */
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+AVX512 __mmask16 tail_mask16(size_t n) {
+  return (__mmask16)((1u << n) - 1);
+}
+
+// NOTE(acer): Instead of _mm512_reduce_add_*, which trips
+// -Wuninitialized in some GCC versions. Called once per kernel call.
+AVX512 float hsum512(__m512 v) {
+  alignas(64) float t[16];
+  _mm512_store_ps(t, v);
+  float s = 0;
+  for (float x : t) s += x;
+  return s;
+}
+
+AVX512 int64_t hsum512i(__m512i v) {
+  alignas(64) int32_t t[16];
+  _mm512_store_si512((void *)t, v);
+  int64_t s = 0;
+  for (int32_t x : t) s += x;
+  return s;
+}
+
+AVX512 float dot_f32_avx512(float const *a, float const *b, size_t n) {
+  __m512 s = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    s = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s);
+  if (i < n) {
+    __mmask16 m = tail_mask16(n - i);
+    s = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i),
+                        _mm512_maskz_loadu_ps(m, b + i), s);
+  }
+  return hsum512(s);
+}
+
+AVX512 float l2sq_f32_avx512(float const *a, float const *b, size_t n) {
+  __m512 s = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+    s = _mm512_fmadd_ps(d, d, s);
+  }
+  if (i < n) {
+    __mmask16 m = tail_mask16(n - i);
+    __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i),
+                             _mm512_maskz_loadu_ps(m, b + i));
+    s = _mm512_fmadd_ps(d, d, s);
+  }
+  return hsum512(s);
+}
+
+AVX512 void cosine_f32_avx512(float const *a, float const *b, size_t n,
+                              float *dot, float *norm_a, float *norm_b) {
+  __m512 d = _mm512_setzero_ps(), na = d, nb = d;
+  size_t i = 0;
+  for (; i < n; i += 16) {
+    __mmask16 m = n - i >= 16 ? (__mmask16)0xffff : tail_mask16(n - i);
+    __m512 va = _mm512_maskz_loadu_ps(m, a + i);
+    __m512 vb = _mm512_maskz_loadu_ps(m, b + i);
+    d = _mm512_fmadd_ps(va, vb, d);
+    na = _mm512_fmadd_ps(va, va, na);
+    nb = _mm512_fmadd_ps(vb, vb, nb);
+  }
+  *dot = hsum512(d);
+  *norm_a = hsum512(na);
+  *norm_b = hsum512(nb);
+}
+
+AVX512 __m512i load_i8x32(int8_t const *p) {
+  return _mm512_cvtepi8_epi16(_mm256_loadu_si256((__m256i const *)p));
+}
+
+AVX512 int64_t dot_i8_avx512(int8_t const *a, int8_t const *b, size_t n) {
+  int64_t total = 0;
+  size_t i = 0;
+  while (n - i >= 32) {
+    size_t end = i + std::min(n - i, i8_chunk);
+    __m512i s = _mm512_setzero_si512();
+    for (; i + 32 <= end; i += 32)
+      s = _mm512_add_epi32(
+          s, _mm512_madd_epi16(load_i8x32(a + i), load_i8x32(b + i)));
+    total += hsum512i(s);
+  }
+  return total + dot_i8_avx2(a + i, b + i, n - i);
+}
+
+AVX512 int64_t l2sq_i8_avx512(int8_t const *a, int8_t const *b, size_t n) {
+  int64_t total = 0;
+  size_t i = 0;
+  while (n - i >= 32) {
+    size_t end = i + std::min(n - i, i8_chunk);
+    __m512i s = _mm512_setzero_si512();
+    for (; i + 32 <= end; i += 32) {
+      __m512i d = _mm512_sub_epi16(load_i8x32(a + i), load_i8x32(b + i));
+      s = _mm512_add_epi32(s, _mm512_madd_epi16(d, d));
+    }
+    total += hsum512i(s);
+  }
+  return total + l2sq_i8_avx2(a + i, b + i, n - i);
+}
+
+AVX512 void cosine_i8_avx512(int8_t const *a, int8_t const *b, size_t n,
+                             int64_t *dot, int64_t *norm_a,
+                             int64_t *norm_b) {
+  int64_t td = 0, ta = 0, tb = 0;
+  size_t i = 0;
+  while (n - i >= 32) {
+    size_t end = i + std::min(n - i, i8_chunk);
+    __m512i d = _mm512_setzero_si512(), na = d, nb = d;
+    for (; i + 32 <= end; i += 32) {
+      __m512i va = load_i8x32(a + i), vb = load_i8x32(b + i);
+      d = _mm512_add_epi32(d, _mm512_madd_epi16(va, vb));
+      na = _mm512_add_epi32(na, _mm512_madd_epi16(va, va));
+      nb = _mm512_add_epi32(nb, _mm512_madd_epi16(vb, vb));
+    }
+    td += hsum512i(d);
+    ta += hsum512i(na);
+    tb += hsum512i(nb);
+  }
+  cosine_i8_avx2(a + i, b + i, n - i, dot, norm_a, norm_b);
+  *dot += td;
+  *norm_a += ta;
+  *norm_b += tb;
+}
+
+#undef AVX512
+
+vector_kernels const avx512_kernels = {
+    simd_level::avx512, dot_f32_avx512, l2sq_f32_avx512, cosine_f32_avx512,
+    dot_i8_avx512,      l2sq_i8_avx512, cosine_i8_avx512};
+
+#endif  // SQLITE3CPP_VECTOR_X86
+
+/**
+ * SQL functions
+ */
+template <typename T>
+struct vec_view {
+  T const *data;
+  size_t size;
+  // Aligned copy of a BLOB when sqlite3 hands out a misaligned one.
+  std::vector<T> copy;
+
+  void assign(sqlite3_value *v, size_t n) {
+    void const *p = sqlite3_value_blob(v);
+    size = n;
+    if ((uintptr_t)p % alignof(T) == 0) {
+      data = (T const *)p;
+    } else {
+      copy.resize(n);
+      std::memcpy(copy.data(), p, n * sizeof(T));
+      data = copy.data();
+    }
+  }
+};
+
+// Get vector arguments |a| and |b|; false if the result has been set.
+template <typename T>
+bool get_vectors(sqlite3_context *ctx, sqlite3_value **argv, vec_view<T> &a,
+                 vec_view<T> &b) {
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL ||
+      sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+    sqlite3_result_null(ctx);
+    return false;
+  }
+
+  size_t na = (size_t)sqlite3_value_bytes(argv[0]);
+  size_t nb = (size_t)sqlite3_value_bytes(argv[1]);
+  if (na != nb || na % sizeof(T)) {
+    sqlite3_result_error(ctx, "vector size mismatch", -1);
+    return false;
+  }
+  try {
+    a.assign(argv[0], na / sizeof(T));
+    b.assign(argv[1], nb / sizeof(T));
+  } catch (std::bad_alloc const &) {
+    sqlite3_result_error_nomem(ctx);
+    return false;
+  }
+  return true;
+}
+
+vector_kernels const &kernels_of(sqlite3_context *ctx) {
+  return *(vector_kernels const *)sqlite3_user_data(ctx);
+}
+
+void vec_dot(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  vec_view<float> a, b;
+  if (get_vectors(ctx, argv, a, b))
+    sqlite3_result_double(ctx, kernels_of(ctx).dot_f32(a.data, b.data, a.size));
+}
+
+void vec_l2(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  vec_view<float> a, b;
+  if (get_vectors(ctx, argv, a, b))
+    sqlite3_result_double(
+        ctx, std::sqrt(kernels_of(ctx).l2sq_f32(a.data, b.data, a.size)));
+}
+
+void result_cosine(sqlite3_context *ctx, double dot, double na, double nb) {
+  if (na == 0 || nb == 0)
+    sqlite3_result_null(ctx);
+  else
+    sqlite3_result_double(ctx, dot / std::sqrt(na * nb));
+}
+
+void vec_cosine(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  vec_view<float> a, b;
+  if (!get_vectors(ctx, argv, a, b)) return;
+  float dot = 0, na = 0, nb = 0;
+  kernels_of(ctx).cosine_f32(a.data, b.data, a.size, &dot, &na, &nb);
+  result_cosine(ctx, dot, na, nb);
+}
+
+void vec_dot_i8(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  vec_view<int8_t> a, b;
+  if (get_vectors(ctx, argv, a, b))
+    sqlite3_result_int64(ctx, kernels_of(ctx).dot_i8(a.data, b.data, a.size));
+}
+
+void vec_l2_i8(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  vec_view<int8_t> a, b;
+  if (get_vectors(ctx, argv, a, b))
+    sqlite3_result_double(ctx, std::sqrt((double)kernels_of(ctx).l2sq_i8(
+                                   a.data, b.data, a.size)));
+}
+
+void vec_cosine_i8(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  vec_view<int8_t> a, b;
+  if (!get_vectors(ctx, argv, a, b)) return;
+  int64_t dot = 0, na = 0, nb = 0;
+  kernels_of(ctx).cosine_i8(a.data, b.data, a.size, &dot, &na, &nb);
+  result_cosine(ctx, (double)dot, (double)na, (double)nb);
+}
+
+// Parse a JSON array of numbers; false on malformed input.
+bool parse_numbers(char const *s, std::vector<double> &out) {
+  while (*s == ' ') ++s;
+  if (*s++ != '[') return false;
+  for (;;) {
+    while (*s == ' ') ++s;
+    if (*s == ']' && out.empty()) return true;
+    char *end = nullptr;
+    double v = std::strtod(s, &end);
+    if (end == s) return false;
+    out.push_back(v);
+    s = end;
+    while (*s == ' ') ++s;
+    if (*s == ']') return true;
+    if (*s++ != ',') return false;
+  }
+}
+
+template <typename T>
+void vec_from_json(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  auto *text = (char const *)sqlite3_value_text(argv[0]);
+  if (!text) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  std::vector<double> nums;
+  if (!parse_numbers(text, nums)) {
+    sqlite3_result_error(ctx, "malformed vector", -1);
+    return;
+  }
+
+  std::vector<T> vec(nums.size());
+  for (size_t i = 0; i < nums.size(); ++i) {
+    if constexpr (std::is_same_v<T, int8_t>)
+      vec[i] = (int8_t)std::clamp(std::lround(nums[i]), -128l, 127l);
+    else
+      vec[i] = (T)nums[i];
+  }
+  sqlite3_result_blob(ctx, vec.data(), (int)(vec.size() * sizeof(T)),
+                      SQLITE_TRANSIENT);
+}
+
+struct topk_state {
+  size_t k = 0;
+  // Min-heap of (score, id) s.t. the lowest kept score is on top.
+  std::vector<std::pair<double, int64_t>> heap;
+};
+
+void vec_topk_step(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  auto **state =
+      (topk_state **)sqlite3_aggregate_context(ctx, sizeof(topk_state *));
+  if (!state) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+
+  try {
+    if (!*state) {
+      int64_t k = sqlite3_value_int64(argv[2]);
+      if (k <= 0) {
+        sqlite3_result_error(ctx, "vec_topk: k must be positive", -1);
+        return;
+      }
+      *state = new topk_state;
+      (*state)->k = (size_t)k;
+    }
+    if (sqlite3_value_type(argv[1]) == SQLITE_NULL) return;
+
+    auto &s = **state;
+    std::pair<double, int64_t> e(sqlite3_value_double(argv[1]),
+                                 sqlite3_value_int64(argv[0]));
+    auto greater = std::greater<std::pair<double, int64_t>>();
+    if (s.heap.size() < s.k) {
+      s.heap.push_back(e);
+      std::push_heap(s.heap.begin(), s.heap.end(), greater);
+    } else if (e.first > s.heap.front().first) {
+      std::pop_heap(s.heap.begin(), s.heap.end(), greater);
+      s.heap.back() = e;
+      std::push_heap(s.heap.begin(), s.heap.end(), greater);
+    }
+  } catch (std::bad_alloc const &) {
+    sqlite3_result_error_nomem(ctx);
+  }
+}
+
+void vec_topk_final(sqlite3_context *ctx) {
+  auto **state = (topk_state **)sqlite3_aggregate_context(ctx, 0);
+  std::unique_ptr<topk_state> guard(state ? *state : nullptr);
+
+  try {
+    std::string json = "[";
+    if (guard) {
+      auto &heap = guard->heap;
+      std::sort(heap.begin(), heap.end(),
+                std::greater<std::pair<double, int64_t>>());
+      for (auto const &e : heap) {
+        if (json.size() > 1) json.push_back(',');
+        json += std::to_string(e.second);
+      }
+    }
+    json.push_back(']');
+    sqlite3_result_text(ctx, json.data(), (int)json.size(), SQLITE_TRANSIENT);
+  } catch (std::bad_alloc const &) {
+    sqlite3_result_error_nomem(ctx);
+  }
+}
+
+}  // namespace
+
+simd_level detect_simd_level() noexcept {
+#ifdef SQLITE3CPP_VECTOR_X86
+  static simd_level const level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+      return simd_level::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      return simd_level::avx2;
+    return simd_level::scalar;
+  }();
+  return level;
+#else
+  return simd_level::scalar;
+#endif
+}
+
+vector_kernels const &get_vector_kernels(simd_level level) noexcept {
+  level = std::min(level, detect_simd_level());
+#ifdef SQLITE3CPP_VECTOR_X86
+  if (level == simd_level::avx512) return avx512_kernels;
+  if (level == simd_level::avx2) return avx2_kernels;
+#endif
+  return scalar_kernels;
+}
+
+void create_vector_functions(database &db, simd_level level) {
+  struct func {
+    char const *name;
+    int arity;
+    void (*xfunc)(sqlite3_context *, int, sqlite3_value **);
+  } const funcs[] = {
+      {"vec_f32", 1, &vec_from_json<float>},
+      {"vec_i8", 1, &vec_from_json<int8_t>},
+      {"vec_dot", 2, &vec_dot},
+      {"vec_l2", 2, &vec_l2},
+      {"vec_cosine", 2, &vec_cosine},
+      {"vec_dot_i8", 2, &vec_dot_i8},
+      {"vec_l2_i8", 2, &vec_l2_i8},
+      {"vec_cosine_i8", 2, &vec_cosine_i8},
+  };
+
+  auto *kernels = (void *)&get_vector_kernels(level);
+  int const flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+  int ec = 0;
+  for (auto const &f : funcs) {
+    if (0 != (ec = sqlite3_create_function_v2(db.get(), f.name, f.arity, flags,
+                                              kernels, f.xfunc, nullptr,
+                                              nullptr, nullptr)))
+      throw error(ec);
+  }
+  if (0 != (ec = sqlite3_create_function_v2(
+                db.get(), "vec_topk", 3, SQLITE_UTF8 | SQLITE_INNOCUOUS,
+                nullptr, nullptr, &vec_topk_step, &vec_topk_final, nullptr)))
+    throw error(ec);
+}
+
+}  // namespace sqlite3cpp
@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+enum class simd_level {
+  scalar = 0,
+  avx2,    // AVX2 + FMA
+  avx512,  // AVX-512 F + BW
+};
+
+// Best SIMD level supported by both this build and the running CPU.
+SQLITE3CPP_EXPORT simd_level detect_simd_level() noexcept;
+
+struct vector_kernels {
+  // Kernels over packed vectors of |n| elements. Results of the same level
+  // may differ from other levels in rounding only.
+  simd_level level;
+  float (*dot_f32)(float const *a, float const *b, size_t n);
+  float (*l2sq_f32)(float const *a, float const *b, size_t n);
+  // Compute dot product and squared norms of |a| and |b| in one pass.
+  void (*cosine_f32)(float const *a, float const *b, size_t n, float *dot,
+                     float *norm_a, float *norm_b);
+  int64_t (*dot_i8)(int8_t const *a, int8_t const *b, size_t n);
+  int64_t (*l2sq_i8)(int8_t const *a, int8_t const *b, size_t n);
+  void (*cosine_i8)(int8_t const *a, int8_t const *b, size_t n, int64_t *dot,
+                    int64_t *norm_a, int64_t *norm_b);
+};
+
+// Kernels of |level|, or of the best supported level below it.
+SQLITE3CPP_EXPORT vector_kernels const &get_vector_kernels(
+    simd_level level = detect_simd_level()) noexcept;
+
+// Register vector similarity functions to |db|. Vectors are BLOBs of packed
+// float32 (native byte order) or int8 values. e.g.
+//
+// create_vector_functions(db);
+// db.execute("insert into E values(?, vec_f32(?))", 1, "[0.1, 0.2, 0.3]");
+// db.execute("select id from E where vec_cosine(v, vec_f32(?)) > 0.8", q);
+// db.execute("select vec_topk(id, -vec_l2(v, vec_f32(?)), 10) from E", q);
+//
+// Scalar functions (NULL if any argument is NULL):
+//
+//   vec_f32(json), vec_i8(json)  BLOB from a JSON array of numbers
+//   vec_dot(a, b)                dot product of float32 vectors
+//   vec_l2(a, b)                 euclidean distance of float32 vectors
+//   vec_cosine(a, b)             cosine similarity of float32 vectors, NULL
+//                                if either one is a zero vector
+//   vec_dot_i8(a, b), vec_l2_i8(a, b), vec_cosine_i8(a, b)
+//                                the same over int8 vectors
+//
+// Aggregate:
+//
+//   vec_topk(id, score, k)       JSON array of integer |id|s of the |k|
+//                                highest |score|s, highest first
+//
+// Vectors of different sizes raise an error. Kernels of |level| are used;
+// see get_vector_kernels().
+SQLITE3CPP_EXPORT void create_vector_functions(
+    database &db, simd_level level = detect_simd_level());
+
+}  // namespace sqlite3cpp
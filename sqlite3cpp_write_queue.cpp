@@ -0,0 +1,237 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#include "sqlite3cpp_write_queue.h"
+#include <vector>
+
+namespace sqlite3cpp {
+
+/**
+ * write_queue impl
+ */
+write_queue::write_queue(std::string const &urn) : write_queue(urn, {}) {}
+
+write_queue::write_queue(std::string const &urn, params_t const &params)
+    : m_params(params), m_head(&m_stub), m_tail(&m_stub) {
+  if (m_params.max_batch == 0) m_params.max_batch = 1;
+
+  std::promise<void> started;
+  auto ready = started.get_future();
+  m_thread = std::thread([this, urn, &started] { run(urn, started); });
+  try {
+    ready.get();
+  } catch (...) {
+    m_thread.join();
+    throw;
+  }
+}
+
+write_queue::~write_queue() {
+  {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_stop = true;
+  }
+  m_cond.notify_one();
+  m_thread.join();
+}
+
+std::future<void> write_queue::submit(job_t job) {
+  auto *n = new node;
+  n->job = std::move(job);
+  auto fut = n->done.get_future();
+  push(n);
+  m_size.fetch_add(1);
+  if (m_sleeping.load()) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_cond.notify_one();
+  }
+  return fut;
+}
+
+write_queue::stats_t write_queue::stats() const noexcept {
+  stats_t s;
+  s.jobs = m_jobs.load();
+  s.failed_jobs = m_failed_jobs.load();
+  s.batches = m_batches.load();
+  s.failed_batches = m_failed_batches.load();
+  s.max_batch = m_max_batch.load();
+  return s;
+}
+
+void write_queue::push(node *n) noexcept {
+  n->next.store(nullptr, std::memory_order_relaxed);
+  node *prev = m_head.exchange(n, std::memory_order_acq_rel);
+  prev->next.store(n, std::memory_order_release);
+}
+
+write_queue::node *write_queue::pop() noexcept {
+  node *tail = m_tail;
+  node *next = tail->next.load(std::memory_order_acquire);
+
+  if (tail == &m_stub) {
+    if (!next) return nullptr;
+    m_tail = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    m_tail = next;
+    return tail;
+  }
+  // A producer is in the middle of |push()|; try again later.
+  if (tail != m_head.load(std::memory_order_acquire)) return nullptr;
+
+  push(&m_stub);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next) {
+    m_tail = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+void write_queue::run(std::string const &urn,
+                      std::promise<void> &started) noexcept {
+  using clock = std::chrono::steady_clock;
+
+  std::unique_ptr<database> db;
+  try {
+    db = std::make_unique<database>(urn);
+    if (m_params.init) m_params.init(*db);
+    started.set_value();
+  } catch (...) {
+    started.set_exception(std::current_exception());
+    return;
+  }
+
+  std::vector<node *> batch;
+  batch.reserve(m_params.max_batch);
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lk(m_mutex);
+      m_sleeping = true;
+      m_cond.wait(lk, [this] { return m_stop || m_size.load() > 0; });
+      m_sleeping = false;
+      if (m_stop && m_size.load() == 0) break;
+    }
+
+    // Group jobs arriving within |max_latency| since the first one.
+    auto const deadline = clock::now() + m_params.max_latency;
+    while (batch.size() < m_params.max_batch) {
+      if (node *n = pop()) {
+        m_size.fetch_sub(1);
+        batch.push_back(n);
+        continue;
+      }
+      if (m_size.load() > 0) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (batch.empty()) break;
+
+      std::unique_lock<std::mutex> lk(m_mutex);
+      m_sleeping = true;
+      bool more = m_cond.wait_until(lk, deadline, [this] {
+        return m_stop || m_size.load() > 0;
+      });
+      m_sleeping = false;
+      if (!more || m_size.load() == 0) break;
+    }
+
+    if (!batch.empty()) commit_batch(*db, batch);
+    batch.clear();
+  }
+}
+
+void write_queue::commit_batch(database &db,
+                               std::vector<node *> &batch) noexcept {
+  std::vector<node *> succeeded;
+  succeeded.reserve(batch.size());
+
+  auto fail_all = [this](std::vector<node *> &nodes) {
+    for (node *n : nodes) {
+      n->done.set_exception(std::current_exception());
+      delete n;
+    }
+    m_failed_jobs += nodes.size();
+    m_failed_batches += 1;
+  };
+
+  m_batches += 1;
+  m_jobs += batch.size();
+  if (m_max_batch.load() < batch.size()) m_max_batch = batch.size();
+
+  try {
+    db.executescript(m_params.begin_sql);
+  } catch (...) {
+    fail_all(batch);
+    return;
+  }
+
+  for (node *n : batch) {
+    try {
+      db.executescript("savepoint write_queue_job");
+      n->job(db);
+      db.executescript("release write_queue_job");
+      succeeded.push_back(n);
+    } catch (...) {
+      n->done.set_exception(std::current_exception());
+      delete n;
+      m_failed_jobs += 1;
+      try {
+        db.executescript(
+            "rollback to write_queue_job;"
+            "release write_queue_job;");
+      } catch (...) {
+      }
+    }
+  }
+
+  try {
+    db.executescript("commit");
+  } catch (...) {
+    try {
+      db.executescript("rollback");
+    } catch (...) {
+    }
+    fail_all(succeeded);
+    return;
+  }
+
+  for (node *n : succeeded) {
+    n->done.set_value();
+    delete n;
+  }
+}
+
+}  // namespace sqlite3cpp
@@ -0,0 +1,151 @@
+/*****************************************************************************
+ * The BSD 3-Clause License
+ *
+ * Copyright (c) 2019, Acer Yun-Tse Yang All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ ******************************************************************************/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include "sqlite3cpp.h"
+
+namespace sqlite3cpp {
+
+struct SQLITE3CPP_EXPORT write_queue {
+  // Serialize writes of many threads onto one writer connection and commit
+  // them in groups. e.g.
+  //
+  // write_queue wq("app.db");
+  //
+  // // From any thread
+  // auto done = wq.execute("insert into T values(?, ?)", 1, "text");
+  // auto done2 = wq.submit([](database &db) {
+  //   db.execute("update T set b = ? where a = ?", "new", 1);
+  // });
+  // done.get();  // Returns after the batch containing the insert committed
+  //
+  // Jobs are executed in submission order on a dedicated thread. A batch is
+  // closed when it has |max_batch| jobs or |max_latency| passed since its
+  // first job, and is then committed as one transaction. Each job runs in
+  // its own savepoint; a job that throws is rolled back alone and its future
+  // carries the exception. A failed commit fails all jobs of the batch.
+  //
+  // Futures are fulfilled once `commit` returns. Whether that commit is
+  // durable on power loss depends on `pragma synchronous` of the connection.
+
+  using job_t = std::function<void(database &)>;
+
+  struct params_t {
+    size_t max_batch = 256;
+    std::chrono::microseconds max_latency{1000};
+    std::string begin_sql = "begin immediate";
+    // Called on the writer thread before any job, e.g. for pragmas.
+    job_t init;
+  };
+
+  struct stats_t {
+    uint64_t jobs = 0;
+    uint64_t failed_jobs = 0;
+    uint64_t batches = 0;
+    uint64_t failed_batches = 0;
+    uint64_t max_batch = 0;
+  };
+
+  // Open the writer connection to |urn|. Throws sqlite3cpp::error if the
+  // connection can not be opened or |params.init| throws.
+  write_queue(std::string const &urn);
+  write_queue(std::string const &urn, params_t const &params);
+
+  // Execute pending jobs and stop the writer thread.
+  ~write_queue();
+
+  write_queue(write_queue const &) = delete;
+  write_queue &operator=(write_queue const &) = delete;
+
+  // Enqueue |job|. Thread-safe and lock-free.
+  std::future<void> submit(job_t job);
+
+  // Enqueue a statement with bound arguments. Arguments are copied.
+  template <typename... Args>
+  std::future<void> execute(std::string sql, Args &&... args);
+
+  stats_t stats() const noexcept;
+
+ private:
+  struct node {
+    std::atomic<node *> next{nullptr};
+    job_t job;
+    std::promise<void> done;
+  };
+
+  void push(node *n) noexcept;
+  node *pop() noexcept;
+  void run(std::string const &urn, std::promise<void> &started) noexcept;
+  void commit_batch(database &db, std::vector<node *> &batch) noexcept;
+
+  params_t m_params;
+
+  // Intrusive MPSC queue (D. Vyukov). Producers exchange |m_head| and the
+  // writer thread consumes from |m_tail|.
+  std::atomic<node *> m_head;
+  node *m_tail;
+  node m_stub;
+  std::atomic<size_t> m_size{0};
+
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::atomic<bool> m_sleeping{false};
+  std::atomic<bool> m_stop{false};
+
+  std::atomic<uint64_t> m_jobs{0};
+  std::atomic<uint64_t> m_failed_jobs{0};
+  std::atomic<uint64_t> m_batches{0};
+  std::atomic<uint64_t> m_failed_batches{0};
+  std::atomic<uint64_t> m_max_batch{0};
+
+  std::thread m_thread;
+};
+
+template <typename... Args>
+std::future<void> write_queue::execute(std::string sql, Args &&... args) {
+  return submit(
+      [sql = std::move(sql),
+       values = std::tuple<detail::stored_t<Args>...>(
+           std::forward<Args>(args)...)](database &db) {
+        std::apply([&](auto const &... v) { db.execute(sql, v...); }, values);
+      });
+}
+
+}  // namespace sqlite3cpp